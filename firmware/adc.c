@@ -13,6 +13,8 @@
 #include "stm8s_adc1.h"
 #include "stm8s_tim2.h"
 #include "adc.h"
+#include "motor.h"
+#include "hal.h"
 
 void adc_trigger (void);
 
@@ -30,6 +32,12 @@ void adc_init (void)
 	    (CURRENT_MOTOR_TOTAL_FILTERED__PIN),
 	    GPIO_MODE_IN_FL_NO_IT);
 
+#ifdef MOTOR_TEMPERATURE_SENSOR
+  GPIO_Init(MOTOR_TEMPERATURE__PORT,
+	    MOTOR_TEMPERATURE__PIN,
+	    GPIO_MODE_IN_FL_NO_IT);
+#endif
+
   //de-Init ADC peripheral
   ADC1_DeInit();
 
@@ -54,8 +62,8 @@ void adc_init (void)
     ui16_counter = TIM2_GetCounter () + 78;
     while (TIM2_GetCounter () < ui16_counter) ; // delay ~10ms
     adc_trigger ();
-    while (!ADC1_GetFlagStatus (ADC1_FLAG_EOC)) ; // wait for end of conversion
-    ui8_motor_total_current_offset = ui8_adc_read_motor_total_current ();
+    while (!HAL_ADC1_END_OF_CONVERSION ()) ; // wait for end of conversion
+    motor_pwm_cycle.ui8_motor_total_current_offset = ui8_adc_read_motor_total_current ();
   }
 
   // read and average a few values of ADC
@@ -64,19 +72,18 @@ void adc_init (void)
   {
     ui16_counter = TIM2_GetCounter () + 78; // delay ~10ms
     adc_trigger ();
-    while (!ADC1_GetFlagStatus (ADC1_FLAG_EOC)) ; // wait for end of conversion
+    while (!HAL_ADC1_END_OF_CONVERSION ()) ; // wait for end of conversion
     ui16_motor_total_current_offset_10b += ui16_adc_read_motor_total_current_10b ();
   }
   ui16_motor_total_current_offset_10b >>= 4;
   ui16_motor_total_current_offset_10b -= 4;
-  ui8_motor_total_current_offset = ui16_motor_total_current_offset_10b >> 2;
+  motor_pwm_cycle.ui8_motor_total_current_offset = ui16_motor_total_current_offset_10b >> 2;
 }
 
 void adc_trigger (void)
 {
   // trigger ADC conversion of all channels (scan conversion, buffered)
-  ADC1->CSR &= 0x09; // clear EOC flag first (selected also channel 9)
-  ADC1->CR1 |= ADC1_CR1_ADON; // Start ADC1 conversion
+  HAL_ADC1_START_CONVERSION ();
 }
 
 uint8_t ui8_adc_read_phase_B_current (void)
@@ -88,7 +95,7 @@ uint8_t ui8_adc_read_phase_B_current (void)
 //#define ADC1_BaseAddress        0x53E0
 //phase_B_current --> ADC_AIN5
 // 0x53E0 + 2*5 = 0x53EA
-  return *(uint8_t*)(0x53EA);
+  return ADC1->DB5RH;
 }
 
 uint16_t ui16_adc_read_phase_B_current (void)
@@ -96,8 +103,8 @@ uint16_t ui16_adc_read_phase_B_current (void)
   uint16_t temph;
   uint8_t templ;
 
-  templ = *(uint8_t*)(0x53EB);
-  temph = *(uint8_t*)(0x53EA);
+  templ = ADC1->DB5RL;
+  temph = ADC1->DB5RH;
 
   return ((uint16_t) temph) << 2 | ((uint16_t) templ);
 }
@@ -105,14 +112,13 @@ uint16_t ui16_adc_read_phase_B_current (void)
 uint8_t ui8_adc_read_throttle (void)
 {
 // 0x53E0 + 2*4 = 0x53E8
-//  return *(uint8_t*)(0x53E8);
-  return *(uint8_t*)(0x53E8);
+  return ADC1->DB4RH;
 }
 
 uint8_t ui8_adc_read_motor_total_current (void)
 {
 // 0x53E0 + 2*8 = 0x53F0
-  return *(uint8_t*)(0x53F0);
+  return ADC1->DB8RH;
 }
 
 uint16_t ui16_adc_read_motor_total_current_10b (void)
@@ -120,8 +126,8 @@ uint16_t ui16_adc_read_motor_total_current_10b (void)
   uint16_t temph;
   uint8_t templ;
 
-  templ = *(uint8_t*)(0x53F1);
-  temph = *(uint8_t*)(0x53F0);
+  templ = ADC1->DB8RL;
+  temph = ADC1->DB8RH;
 
   return ((uint16_t) temph) << 2 | ((uint16_t) templ);
 }
@@ -129,5 +135,17 @@ uint16_t ui16_adc_read_motor_total_current_10b (void)
 uint8_t ui8_adc_read_battery_voltage (void)
 {
   // 0x53E0 + 2*9 = 0x53F2
-  return *(uint8_t*)(0x53F2);
+  return ADC1->DB9RH;
+}
+
+uint16_t ui16_adc_read_motor_temperature_10b (void)
+{
+  uint16_t temph;
+  uint8_t templ;
+
+  // 0x53E0 + 2*3 = 0x53E6
+  templ = ADC1->DB3RL;
+  temph = ADC1->DB3RH;
+
+  return ((uint16_t) temph) << 2 | ((uint16_t) templ);
 }
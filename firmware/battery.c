@@ -0,0 +1,238 @@
+/*
+ * BMSBattery S series motor controllers firmware
+ *
+ * Copyright (C) Casainho, 2017.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+#include <stdint.h>
+#include "stm8s.h"
+#include "battery.h"
+#include "eeprom.h"
+#include "motor.h"
+#include "adc.h"
+#include "utils.h"
+#include "timers.h"
+
+// open circuit voltage of the battery pack at 0%, 20%, 40%, 60%, 80% and 100% state of charge, in units
+// of the battery voltage filter (8 bits ADC * 64)
+static const uint16_t ui16_battery_ocv_x64_table [6] =
+{
+  (uint16_t) ((BATTERY_LI_ION_CELLS_NUMBER * LI_ION_CELL_VOLTS_0 * 64) / ADC_BATTERY_VOLTAGE_PER_ADC_STEP),
+  (uint16_t) ((BATTERY_LI_ION_CELLS_NUMBER * LI_ION_CELL_VOLTS_20 * 64) / ADC_BATTERY_VOLTAGE_PER_ADC_STEP),
+  (uint16_t) ((BATTERY_LI_ION_CELLS_NUMBER * LI_ION_CELL_VOLTS_40 * 64) / ADC_BATTERY_VOLTAGE_PER_ADC_STEP),
+  (uint16_t) ((BATTERY_LI_ION_CELLS_NUMBER * LI_ION_CELL_VOLTS_60 * 64) / ADC_BATTERY_VOLTAGE_PER_ADC_STEP),
+  (uint16_t) ((BATTERY_LI_ION_CELLS_NUMBER * LI_ION_CELL_VOLTS_80 * 64) / ADC_BATTERY_VOLTAGE_PER_ADC_STEP),
+  (uint16_t) ((BATTERY_LI_ION_CELLS_NUMBER * LI_ION_CELL_VOLTS_100 * 64) / ADC_BATTERY_VOLTAGE_PER_ADC_STEP)
+};
+
+uint16_t ui16_battery_used_mah; // since the battery was full
+int32_t i32_battery_used_steps = 0; // fraction of 1mAh, BATTERY_CURRENT_STEPS_PER_MAH
+uint16_t ui16_battery_current_zero_x4;
+uint32_t ui32_battery_rest_start_ms = 0;
+
+uint16_t ui16_battery_resistance_mohm_x8 = BATTERY_INTERNAL_RESISTANCE_MOHM << 3;
+uint16_t ui16_battery_voltage_x64_last;
+int16_t i16_battery_current_x4_last = 0;
+uint8_t ui8_battery_last_is_valid = 0;
+
+uint8_t ui8_battery_derating_current_max = ADC_MOTOR_CURRENT_MAX;
+uint8_t ui8_battery_current_max = ADC_MOTOR_CURRENT_MAX;
+
+uint8_t ui8_battery_get_ocv_soc (void);
+void battery_estimate_resistance (uint16_t ui16_voltage_x64, int16_t i16_current_x4);
+void battery_limit_current (uint16_t ui16_voltage_x64, int16_t i16_current_x4);
+void battery_derate_current (uint16_t ui16_voltage_x64);
+uint8_t ui8_battery_derating_curve (uint16_t ui16_voltage_x64);
+
+// must be called after eeprom_init () and adc_init ()
+void battery_init (void)
+{
+  // 0 if statistics were never saved: battery is considered full up to the first rest
+  ui16_battery_used_mah = ui16_from_bytes (&eeprom_get_record (EEPROM_AREA_STATISTICS) [RECORD_STATISTICS_BATTERY_USED]);
+  if (ui16_battery_used_mah > BATTERY_CAPACITY_MAH) { ui16_battery_used_mah = BATTERY_CAPACITY_MAH; }
+
+  // ADC offset is calibrated 4 steps under the real zero and the 8 bits values read on PWM cycle are
+  // truncated, in average 1.5 steps (10 bits) lower
+  ui16_battery_current_zero_x4 = ui16_motor_total_current_offset_10b + 4 - 2;
+}
+
+// call every 100ms
+void battery_controller (void)
+{
+  uint32_t ui32_current_accumulated;
+  uint32_t ui32_voltage_accumulated;
+  uint16_t ui16_current_samples;
+  int32_t i32_steps;
+  int16_t i16_mah;
+  int16_t i16_current_x4;
+  uint16_t ui16_voltage_x64;
+
+  // current and voltage accumulated by the PWM cycle interrupt since last time
+  disableInterrupts ();
+  ui32_current_accumulated = motor_pwm_cycle.ui32_adc_battery_current_accumulated;
+  ui32_voltage_accumulated = motor_pwm_cycle.ui32_adc_battery_voltage_cycles_accumulated;
+  ui16_current_samples = motor_pwm_cycle.ui16_adc_battery_current_samples;
+  motor_pwm_cycle.ui32_adc_battery_current_accumulated = 0;
+  motor_pwm_cycle.ui32_adc_battery_voltage_cycles_accumulated = 0;
+  motor_pwm_cycle.ui16_adc_battery_current_samples = 0;
+  enableInterrupts ();
+
+  if (ui16_current_samples == 0) { return; }
+
+  // positive is from the battery, negative is regen
+  i32_steps = ((int32_t) (ui32_current_accumulated << 2)) - (((int32_t) ui16_current_samples) * ui16_battery_current_zero_x4);
+
+  i32_battery_used_steps += i32_steps;
+  i16_mah = (int16_t) (i32_battery_used_steps / BATTERY_CURRENT_STEPS_PER_MAH);
+  i32_battery_used_steps -= ((int32_t) i16_mah) * BATTERY_CURRENT_STEPS_PER_MAH;
+
+  if ((i16_mah < 0) && (((uint16_t) (-i16_mah)) > ui16_battery_used_mah)) { ui16_battery_used_mah = 0; }
+  else
+  {
+    ui16_battery_used_mah += i16_mah;
+    if (ui16_battery_used_mah > BATTERY_CAPACITY_MAH) { ui16_battery_used_mah = BATTERY_CAPACITY_MAH; }
+  }
+
+  // average of the last 100ms
+  i16_current_x4 = (int16_t) (i32_steps / ui16_current_samples);
+  ui16_voltage_x64 = (uint16_t) ((ui32_voltage_accumulated << 6) / ui16_current_samples);
+
+  battery_estimate_resistance (ui16_voltage_x64, i16_current_x4);
+  battery_derate_current (ui16_voltage_x64);
+  battery_limit_current (ui16_voltage_x64, i16_current_x4);
+
+  // battery resting: open circuit voltage gives the state of charge, use it to correct the integration errors
+  if ((i16_current_x4 < BATTERY_REST_CURRENT_X4) && (i16_current_x4 > -BATTERY_REST_CURRENT_X4))
+  {
+    if (system_time_is_timeout (ui32_battery_rest_start_ms, BATTERY_REST_TIME_MS))
+    {
+      ui16_battery_used_mah = (uint16_t) ((((uint32_t) (100 - ui8_battery_get_ocv_soc ())) * BATTERY_CAPACITY_MAH) / 100);
+      i32_battery_used_steps = 0;
+    }
+  }
+  else { ui32_battery_rest_start_ms = ui32_system_time_get_ms (); }
+}
+
+// A current change of at least BATTERY_RESISTANCE_MIN_CURRENT_STEP, with the voltage changing the
+// other way, gives a resistance sample; samples are low pass filtered.
+void battery_estimate_resistance (uint16_t ui16_voltage_x64, int16_t i16_current_x4)
+{
+  int16_t i16_delta_current;
+  int16_t i16_delta_voltage;
+  int32_t i32_resistance;
+
+  if (ui8_battery_last_is_valid)
+  {
+    i16_delta_current = i16_current_x4 - i16_battery_current_x4_last;
+    i16_delta_voltage = ((int16_t) ui16_battery_voltage_x64_last) - ((int16_t) ui16_voltage_x64);
+
+    if (((i16_delta_current >= BATTERY_RESISTANCE_MIN_CURRENT_STEP) && (i16_delta_voltage > 0)) ||
+	((i16_delta_current <= -BATTERY_RESISTANCE_MIN_CURRENT_STEP) && (i16_delta_voltage < 0)))
+    {
+      i32_resistance = (((int32_t) i16_delta_voltage) * BATTERY_RESISTANCE_K) / i16_delta_current;
+      if (i32_resistance < BATTERY_RESISTANCE_MIN_MOHM) { i32_resistance = BATTERY_RESISTANCE_MIN_MOHM; }
+      else if (i32_resistance > BATTERY_RESISTANCE_MAX_MOHM) { i32_resistance = BATTERY_RESISTANCE_MAX_MOHM; }
+
+      ui16_battery_resistance_mohm_x8 -= ui16_battery_resistance_mohm_x8 >> 3;
+      ui16_battery_resistance_mohm_x8 += (uint16_t) i32_resistance;
+    }
+  }
+
+  ui16_battery_voltage_x64_last = ui16_voltage_x64;
+  i16_battery_current_x4_last = i16_current_x4;
+  ui8_battery_last_is_valid = 1;
+}
+
+// Open circuit voltage = loaded voltage + current * resistance; the max current is the one that takes the
+// battery voltage down to BATTERY_SAG_VOLTAGE_MIN_X64.
+void battery_limit_current (uint16_t ui16_voltage_x64, int16_t i16_current_x4)
+{
+  uint16_t ui16_resistance = ui16_battery_get_resistance_mohm ();
+  uint32_t ui32_ocv_x64 = ui16_voltage_x64;
+  uint32_t ui32_current_max_x4 = 0;
+
+  if (i16_current_x4 > 0) { ui32_ocv_x64 += (((uint32_t) i16_current_x4) * ui16_resistance) / BATTERY_RESISTANCE_K; }
+
+  if (ui32_ocv_x64 > BATTERY_SAG_VOLTAGE_MIN_X64)
+  {
+    ui32_current_max_x4 = ((ui32_ocv_x64 - BATTERY_SAG_VOLTAGE_MIN_X64) * BATTERY_RESISTANCE_K) / ui16_resistance;
+  }
+
+  // motor current max is in 8 bits ADC steps
+  ui32_current_max_x4 >>= 2;
+  if (ui32_current_max_x4 > ui8_battery_derating_current_max) { ui32_current_max_x4 = ui8_battery_derating_current_max; }
+  ui8_battery_current_max = (uint8_t) ui32_current_max_x4;
+}
+
+void battery_derate_current (uint16_t ui16_voltage_x64)
+{
+  uint8_t ui8_current_max = ui8_battery_derating_curve (ui16_voltage_x64);
+
+  if (ui8_current_max < ui8_battery_derating_current_max)
+  {
+    ui8_battery_derating_current_max = ui8_current_max;
+  }
+  else if ((ui16_voltage_x64 > BATTERY_DERATING_HYSTERESIS_X64) &&
+      (ui8_battery_derating_curve (ui16_voltage_x64 - BATTERY_DERATING_HYSTERESIS_X64) > ui8_battery_derating_current_max))
+  {
+    ui8_battery_derating_current_max++;
+  }
+}
+
+uint8_t ui8_battery_derating_curve (uint16_t ui16_voltage_x64)
+{
+  if (ui16_voltage_x64 >= BATTERY_DERATING_VOLTAGE_START_X64) { return ADC_MOTOR_CURRENT_MAX; }
+  if (ui16_voltage_x64 <= BATTERY_DERATING_VOLTAGE_END_X64) { return 0; }
+
+  return (uint8_t) ((((uint32_t) (ui16_voltage_x64 - BATTERY_DERATING_VOLTAGE_END_X64)) * ADC_MOTOR_CURRENT_MAX) /
+      (BATTERY_DERATING_VOLTAGE_START_X64 - BATTERY_DERATING_VOLTAGE_END_X64));
+}
+
+uint8_t ui8_battery_get_current_max (void)
+{
+  return ui8_battery_current_max;
+}
+
+// average of the last battery_controller () period, offset corrected: steps of 0.125A, negative is regen
+int16_t i16_battery_get_current_x4 (void)
+{
+  return i16_battery_current_x4_last;
+}
+
+uint16_t ui16_battery_get_resistance_mohm (void)
+{
+  return ui16_battery_resistance_mohm_x8 >> 3;
+}
+
+// linear interpolation on ui16_battery_ocv_x64_table
+uint8_t ui8_battery_get_ocv_soc (void)
+{
+  uint16_t ui16_voltage_x64 = ui16_motor_get_ADC_battery_voltage_filtered_x64 ();
+  uint8_t ui8_i;
+
+  if (ui16_voltage_x64 <= ui16_battery_ocv_x64_table [0]) { return 0; }
+
+  for (ui8_i = 1; ui8_i < 6; ui8_i++)
+  {
+    if (ui16_voltage_x64 < ui16_battery_ocv_x64_table [ui8_i])
+    {
+      return ((ui8_i - 1) * 20) + (uint8_t) ((((uint32_t) (ui16_voltage_x64 - ui16_battery_ocv_x64_table [ui8_i - 1])) * 20) /
+	  (ui16_battery_ocv_x64_table [ui8_i] - ui16_battery_ocv_x64_table [ui8_i - 1]));
+    }
+  }
+
+  return 100;
+}
+
+// 0 - 100%
+uint8_t ui8_battery_get_soc (void)
+{
+  return (uint8_t) ((((uint32_t) (BATTERY_CAPACITY_MAH - ui16_battery_used_mah)) * 100) / BATTERY_CAPACITY_MAH);
+}
+
+uint16_t ui16_battery_get_used_mah (void)
+{
+  return ui16_battery_used_mah;
+}
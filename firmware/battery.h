@@ -0,0 +1,48 @@
+/*
+ * BMSBattery S series motor controllers firmware
+ *
+ * Copyright (C) Casainho, 2017.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+#ifndef _BATTERY_H_
+#define _BATTERY_H_
+
+#include "main.h"
+
+// Battery state of charge: battery current is integrated on every PWM cycle (coulomb counting) and the
+// result is corrected with the open circuit voltage when the battery rests, with near zero current.
+// Used charge is saved on EEPROM with the statistics.
+
+// motor total current 8 bits ADC * 4, on each PWM cycle: 0.125A * 64us = 8uC; 3.6C / 8uC = 1mAh
+#define BATTERY_CURRENT_STEPS_PER_MAH		450000L
+#define BATTERY_REST_CURRENT_X4			4 // 0.5A
+#define BATTERY_REST_TIME_MS			30000 // 30 seconds, also for the voltage filter to settle
+
+// Internal resistance is measured from the voltage and current changes between 100ms periods; it is used
+// to limit the motor current so the loaded battery voltage stays over the under voltage protection.
+// Units: battery voltage 8 bits ADC * 64 = 4.25mV, current 8 bits ADC * 4 = 0.125A, so that
+// resistance (mohm) = voltage * 34 / current and current = voltage * 34 / resistance (mohm).
+#define BATTERY_RESISTANCE_K			((uint16_t) ((ADC_BATTERY_VOLTAGE_PER_ADC_STEP * 1000.0) / (64.0 * 0.125)))
+#define BATTERY_RESISTANCE_MIN_CURRENT_STEP	16 // 2A: smaller changes are noise
+#define BATTERY_RESISTANCE_MIN_MOHM		20
+#define BATTERY_RESISTANCE_MAX_MOHM		1000
+#define BATTERY_SAG_VOLTAGE_MIN_X64		((((uint16_t) ((uint8_t) ADC_BATTERY_VOLTAGE_MIN)) + 1) * 64) // 1 step over the cut off
+
+// Low voltage derating, on the 100ms average battery voltage: motor max current goes linearly from
+// ADC_MOTOR_CURRENT_MAX at ADC_BATTERY_VOLTAGE_DERATING down to 0 at ADC_BATTERY_VOLTAGE_MIN. It is reduced
+// at once but increases only 1 step each 100ms and only while the voltage is over the curve by the hysteresis.
+#define BATTERY_DERATING_VOLTAGE_START_X64	((uint16_t) (ADC_BATTERY_VOLTAGE_DERATING * 64))
+#define BATTERY_DERATING_VOLTAGE_END_X64	((uint16_t) (ADC_BATTERY_VOLTAGE_MIN * 64))
+#define BATTERY_DERATING_HYSTERESIS_X64		((uint16_t) ((BATTERY_LI_ION_CELLS_NUMBER * LI_ION_CELL_VOLTS_DERATING_HYSTERESIS * 64) / ADC_BATTERY_VOLTAGE_PER_ADC_STEP))
+
+void battery_init (void);
+void battery_controller (void);
+uint8_t ui8_battery_get_soc (void);
+uint16_t ui16_battery_get_used_mah (void);
+uint16_t ui16_battery_get_resistance_mohm (void);
+int16_t i16_battery_get_current_x4 (void); // steps of 0.125A each step, negative is regen
+uint8_t ui8_battery_get_current_max (void); // steps of 0.5A each step
+
+#endif /* _BATTERY_H_ */
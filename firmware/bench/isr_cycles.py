@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+#
+# BMSBattery S series motor controllers firmware
+#
+# Copyright (C) Casainho, 2017.
+#
+# Released under the GPL License, Version 3
+#
+
+# Cycle count of the PWM interrupt (TIM1_UPD_OVF_TRG_BRK_IRQHandler) on each of its code paths.
+# The firmware image runs on sstm8 (ucsim); on every measured interrupt entry the stimuli of the path
+# (hall sensors, ADC data registers, motor state variables) are written to memory and the CPU clocks
+# are counted from the first instruction of the handler to the end of its iret.
+
+import argparse
+import os
+import sys
+import ucsim
+
+HANDLER = "_TIM1_UPD_OVF_TRG_BRK_IRQHandler"
+HANDLER_MODULE = "motor"
+HEADERS = ["main.h", "config.h", "motor.h", "gpio.h"]
+WARMUP = 8 # PWM interrupts to let the firmware initialize (watchdog_init () on first run, etc)
+SAMPLES = 4
+
+def main ():
+  parser = argparse.ArgumentParser (description = "PWM interrupt cycles per code path")
+  parser.add_argument ("--ucsim", default = "sstm8")
+  parser.add_argument ("--type", default = "STM8S105")
+  parser.add_argument ("--clock", default = "16M")
+  parser.add_argument ("--image", default = "main.ihx")
+  parser.add_argument ("--map", default = "main.map")
+  parser.add_argument ("--stimuli", default = os.path.join (os.path.dirname (__file__), "isr_paths.txt"))
+  parser.add_argument ("--baseline", default = os.path.join (os.path.dirname (__file__), "isr_cycles_baseline.txt"))
+  parser.add_argument ("--threshold", type = float, default = 0.0, help = "allowed slow down over baseline, %%")
+  parser.add_argument ("--update-baseline", action = "store_true")
+  args = parser.parse_args ()
+
+  # without a baseline there is nothing to compare with: fail, a run that passes must mean a measured comparison
+  baseline = ucsim.load_baseline (args.baseline)
+  if not (baseline or args.update_baseline):
+    raise SystemExit ("%s has no measurements: run \"make -f Makefile_linux bench-isr-baseline\" on the commit "
+                      "before the change and commit the result, see bench/README.md" % args.baseline)
+
+  symbols = ucsim.load_map (args.map)
+  defines = ucsim.Defines (HEADERS)
+  ucsim.add_struct_members (symbols, "motor.h", "struc_motor_pwm_cycle", "_motor_pwm_cycle",
+                            defines["MOTOR_PWM_CYCLE_ADDRESS"])
+  entry = symbols[HANDLER]
+  returns = ucsim.find_returns (HANDLER_MODULE + ".rst", HANDLER)
+  paths = ucsim.load_stimuli (args.stimuli)
+
+  commands = ["break 0x%04x" % entry] + ["run"] * WARMUP
+  commands += ["break 0x%04x" % address for address in returns]
+  for name, assignments in paths:
+    for sample in range (SAMPLES):
+      commands += ["run"] # stops at handler entry
+      commands += ucsim.stimulus_commands (assignments, symbols, defines)
+      commands += ["state", "run", "step", "state"] # stops at iret, execute it
+
+  output = ucsim.run (args.ucsim, args.type, args.clock, args.image, commands)
+  clocks = ucsim.state_clocks (output)
+  if len (clocks) != 2 * SAMPLES * len (paths):
+    sys.stderr.write (output)
+    raise SystemExit ("ucsim stopped before all samples were taken")
+
+  results = []
+  for index, (name, assignments) in enumerate (paths):
+    samples = [clocks[i + 1] - clocks[i] for i in range (2 * SAMPLES * index, 2 * SAMPLES * (index + 1), 2)]
+    if min (samples) != max (samples):
+      print ("%s: samples differ %s, stimuli don't fully define the path" % (name, samples))
+    results.append ((name, max (samples)))
+
+  failed = ucsim.report (results, baseline, args.threshold)
+  missing = [name for name, cycles in results if name not in baseline]
+  if missing and not args.update_baseline:
+    print ("no baseline for %s: measure it on the commit before the change" % " ".join (missing))
+    failed = True
+
+  if args.update_baseline:
+    ucsim.write_results (args.baseline,
+                         "# CPU cycles of TIM1_UPD_OVF_TRG_BRK_IRQHandler per path, see bench/README.md\n"
+                         "# at 16MHz: 64us PWM period = 1024 cycles\n", results)
+  elif failed:
+    sys.exit (1)
+
+if __name__ == "__main__":
+  main ()
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+#
+# BMSBattery S series motor controllers firmware
+#
+# Copyright (C) Casainho, 2017.
+#
+# Released under the GPL License, Version 3
+#
+
+# Cycles per call of the main slow loop functions (100ms loop: motor_controller () and
+# ebike_app_controller () with everything they call) and flash bytes of the SDCC float library.
+# Each measurement runs the image on sstm8 with breakpoints on the entry and the returns of one
+# function; the inputs of the measurement (slow_loop_inputs.txt) are written on every entry.
+# With --record, results are appended to slow_loop_history.csv with the git commit they were taken on.
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+import ucsim
+
+HEADERS = ["main.h", "config.h", "motor.h", "ebike_app.h", "gpio.h"]
+SAMPLES = 4
+FLOAT_LIBRARY_RE = re.compile (r'^___(fs\w+|\w+2fs)$') # ___fsmul, ___fs2ulong, ___ulong2fs, ...
+FLASH_AREAS = ["HOME", "GSINIT", "GSFINAL", "CONST", "INITIALIZER", "CODE", "_CODE"]
+
+def find_module (function):
+  for source in sorted (os.listdir (".")):
+    if source.endswith (".c"):
+      with open (source, errors = 'replace') as f:
+        if re.search (r'^\w[\w\s\*]*\b%s\s*\([^;]*$' % function, f.read (), re.MULTILINE):
+          return source[:-2]
+  raise SystemExit ("can't find the source file of %s" % function)
+
+def measure (args, symbols, defines, function, assignments):
+  entry = symbols["_" + function]
+  returns = ucsim.find_returns (find_module (function) + ".rst", "_" + function)
+  commands = ["break 0x%04x" % entry] + ["break 0x%04x" % address for address in returns]
+  for sample in range (SAMPLES):
+    commands += ["run"] # stops at function entry
+    commands += ucsim.stimulus_commands (assignments, symbols, defines)
+    commands += ["state", "run", "step", "state"] # stops at ret, execute it
+
+  output = ucsim.run (args.ucsim, args.type, args.clock, args.image, commands)
+  clocks = ucsim.state_clocks (output)
+  if len (clocks) != 2 * SAMPLES:
+    sys.stderr.write (output)
+    raise SystemExit ("ucsim stopped before all samples of %s were taken" % function)
+  return max (clocks[i + 1] - clocks[i] for i in range (0, 2 * SAMPLES, 2))
+
+def git_commit ():
+  try:
+    commit = subprocess.check_output (["git", "rev-parse", "--short", "HEAD"], stderr = subprocess.DEVNULL, universal_newlines = True).strip ()
+    if subprocess.call (["git", "diff", "--quiet", "HEAD", "--", "."]) != 0: commit += "-dirty"
+    return commit
+  except (OSError, subprocess.CalledProcessError):
+    return "unknown"
+
+# last recorded value and commit of each measurement
+def load_history (path):
+  last = {}
+  try:
+    with open (path) as f:
+      for line in f:
+        fields = line.strip ().split (',')
+        if (len (fields) == 3) and (fields[0] != "commit"): last[fields[1]] = (int (fields[2]), fields[0])
+  except FileNotFoundError:
+    pass
+  return last
+
+def main ():
+  parser = argparse.ArgumentParser (description = "slow loop cycles per call and float library flash usage")
+  parser.add_argument ("--ucsim", default = "sstm8")
+  parser.add_argument ("--type", default = "STM8S105")
+  parser.add_argument ("--clock", default = "16M")
+  parser.add_argument ("--image", default = "main.ihx")
+  parser.add_argument ("--map", default = "main.map")
+  parser.add_argument ("--inputs", default = os.path.join (os.path.dirname (__file__), "slow_loop_inputs.txt"))
+  parser.add_argument ("--history", default = os.path.join (os.path.dirname (__file__), "slow_loop_history.csv"))
+  parser.add_argument ("--record", action = "store_true", help = "append the results to the history")
+  args = parser.parse_args ()
+
+  symbols = ucsim.load_map (args.map)
+  defines = ucsim.Defines (HEADERS)
+  ucsim.add_struct_members (symbols, "motor.h", "struc_motor_pwm_cycle", "_motor_pwm_cycle",
+                            defines["MOTOR_PWM_CYCLE_ADDRESS"])
+  ucsim.add_struct_members (symbols, "motor.h", "struc_motor_snapshot", "_motor_snapshot")
+
+  results = []
+  for name, assignments in ucsim.load_stimuli (args.inputs):
+    # "call = function" selects the function when the measurement name is not the function name
+    function = dict (assignments).get ("call", name)
+    assignments = [(target, expression) for target, expression in assignments if target != "call"]
+    results.append ((name, measure (args, symbols, defines, function, assignments)))
+
+  sizes = ucsim.symbol_sizes (symbols)
+  float_symbols = sorted (name for name in sizes if FLOAT_LIBRARY_RE.match (name))
+  float_bytes = sum (sizes[name] for name in float_symbols)
+  areas = ucsim.load_map_areas (args.map)
+  flash_bytes = sum (areas.get (area, 0) for area in FLASH_AREAS)
+
+  history = load_history (args.history)
+  last = lambda measurement: "%d (%s)" % history[measurement] if measurement in history else "-"
+
+  print ("%-40s %10s %8s  %s" % ("", "cycles", "us@16MHz", "last recorded"))
+  for name, cycles in results:
+    print ("%-40s %10d %8.1f  %s" % (name, cycles, cycles / 16.0, last (name + "_cycles")))
+  print ("")
+  print ("float library: %d bytes (%s), last recorded %s" % (float_bytes, " ".join (name[3:] for name in float_symbols),
+                                                          last ("float_library_bytes")))
+  print ("flash total: %d bytes, last recorded %s" % (flash_bytes, last ("flash_bytes")))
+
+  if args.record:
+    commit = git_commit ()
+    new_file = not os.path.exists (args.history)
+    with open (args.history, "a") as f:
+      if new_file: f.write ("commit,measurement,value\n")
+      for name, cycles in results:
+        f.write ("%s,%s_cycles,%d\n" % (commit, name, cycles))
+      f.write ("%s,float_library_bytes,%d\n" % (commit, float_bytes))
+      f.write ("%s,flash_bytes,%d\n" % (commit, flash_bytes))
+  elif not history:
+    # numbers without a history to compare with go unnoticed
+    raise SystemExit ("%s has no measurements: record them with \"make -f Makefile_linux bench-slow-loop-record\", "
+                      "see bench/README.md" % args.history)
+
+if __name__ == "__main__":
+  main ()
@@ -0,0 +1,204 @@
+#
+# BMSBattery S series motor controllers firmware
+#
+# Copyright (C) Casainho, 2017.
+#
+# Released under the GPL License, Version 3
+#
+
+# Helpers to run the SDCC built firmware image on the ucsim STM8 simulator (sstm8) and to measure
+# CPU cycles between two breakpoints. Symbols come from the linker map file and the end of a function
+# (ret/iret) from the relocated listing (.rst) of its module.
+
+import re
+import subprocess
+
+MAP_SYMBOL_RE = re.compile(r'^\s*([0-9A-Fa-f]{4,8})\s+(_\w+)')
+RST_LABEL_RE = re.compile(r'^\s*(?:[0-9A-Fa-f]{4,8}\s+)?\d+\s+(_\w+)::?')
+RST_INSTRUCTION_RE = re.compile(r'^\s*([0-9A-Fa-f]{4,8})\s+(?:[0-9A-Fa-f]{2}\s+)+.*?\b(ret|retf|iret)\b')
+MAP_AREA_RE = re.compile(r'^(\w+)\s+([0-9A-Fa-f]{4,8})\s+([0-9A-Fa-f]{4,8})\s+=\s+\d+\.\s+bytes')
+STATE_CLKS_RE = re.compile(r'^Total time since last reset.*\((\d+) clks\)', re.MULTILINE)
+DEFINE_RE = re.compile(r'^\s*#define\s+(\w+)\s+(.+)$')
+STRUCT_MEMBER_RE = re.compile(r'^\s*(?:volatile\s+)?u?int(8|16|32)_t\s+(\w+)\s*;')
+COMMENT_RE = re.compile(r'//.*$|/\*.*?\*/')
+CASTS = ((re.compile (r'\(\s*u?int8_t\s*\)'), '0xff & '),
+         (re.compile (r'\(\s*u?int16_t\s*\)'), '0xffff & '),
+         (re.compile (r'\(\s*(?:u?int32_t|unsigned|signed|int|long)\s*\)'), ''))
+
+def load_map (path):
+  symbols = {}
+  with open (path) as f:
+    for line in f:
+      m = MAP_SYMBOL_RE.match (line)
+      if m: symbols[m.group (2)] = int (m.group (1), 16)
+  return symbols
+
+# size of each linker area (_CODE, CONST, INITIALIZER, ...)
+def load_map_areas (path):
+  areas = {}
+  with open (path) as f:
+    for line in f:
+      m = MAP_AREA_RE.match (line)
+      if m: areas[m.group (1)] = int (m.group (3), 16)
+  return areas
+
+# flash bytes of each code symbol: distance to the next global symbol in flash
+def symbol_sizes (symbols, flash_start = 0x8000):
+  code = sorted ((address, name) for name, address in symbols.items () if address >= flash_start)
+  return {name: next_address - address for (address, name), (next_address, _) in zip (code, code[1:])}
+
+# addresses of the return instructions of a function, taken from the .rst listing of its module
+def find_returns (rst_path, function):
+  returns = []
+  inside = False
+  with open (rst_path) as f:
+    for line in f:
+      m = RST_LABEL_RE.match (line)
+      if m:
+        if inside and m.group (1) != function: break
+        inside = (m.group (1) == function)
+        continue
+      if inside:
+        m = RST_INSTRUCTION_RE.match (line)
+        if m: returns.append (int (m.group (1), 16))
+  if not returns:
+    raise SystemExit ("no return instruction found for %s in %s" % (function, rst_path))
+  return returns
+
+# members of a struct variable as "_variable.member" symbols, offsets from the typedef on the header (SDCC
+# doesn't pad structs on STM8). Variables placed with __at may not be on the map, then address is used
+def add_struct_members (symbols, header, type_name, variable, address = None):
+  members = []
+  with open (header, errors = 'replace') as f:
+    for line in f:
+      if line.startswith ("typedef struct"): members = []
+      elif line.startswith ("}") and type_name in line: break
+      m = STRUCT_MEMBER_RE.match (line)
+      if m: members.append ((m.group (2), int (m.group (1)) // 8))
+    else:
+      raise SystemExit ("struct %s not found on %s" % (type_name, header))
+  offset = symbols.get (variable, address)
+  for name, size in members:
+    symbols[variable + "." + name] = offset
+    offset += size
+
+# integer #defines of the firmware headers, so stimuli can use ANGLE_180, BLOCK_COMMUTATION, etc
+class Defines (dict):
+  def __init__ (self, headers):
+    dict.__init__ (self)
+    self.text = {}
+    for path in headers:
+      with open (path, errors = 'replace') as f:
+        for line in f:
+          m = DEFINE_RE.match (line)
+          if m: self.text[m.group (1)] = COMMENT_RE.sub ('', m.group (2)).strip ()
+
+  def __missing__ (self, name):
+    if name not in self.text: raise NameError (name)
+    value = evaluate_number (self.text[name], self)
+    self[name] = value
+    return value
+
+# C casts to uint8_t/uint16_t are kept as masks, float #defines (ADC_BATTERY_VOLTAGE_PER_ADC_STEP)
+# stay float until the final value is truncated to an integer
+def evaluate_number (expression, defines):
+  for cast, replacement in CASTS: expression = cast.sub (replacement, expression)
+  expression = re.sub (r'\b(\d+)[uUlL]+\b', r'\1', expression)
+  return eval (expression, {'__builtins__': {}}, defines)
+
+def evaluate (expression, defines):
+  return int (evaluate_number (expression, defines))
+
+# width in bytes of a firmware variable or struct member, from its name prefix (ui8_, ui16_, i16_, ui32_, ...)
+def symbol_width (name):
+  m = re.match (r'_?u?i(8|16|32)_', name.split ('.')[-1])
+  return int (m.group (1)) // 8 if m else 1
+
+# commands to write a value on the simulator memory, STM8 is big endian
+def poke (address, value, width):
+  value &= (1 << (8 * width)) - 1
+  data = [(value >> (8 * (width - 1 - i))) & 0xff for i in range (width)]
+  return ["set memory rom 0x%04x %s" % (address + i, "0x%02x" % byte) for i, byte in enumerate (data)]
+
+# Stimuli files have one section per measurement, [common] is applied before every one of them:
+#   _symbol = expression          firmware global variable (width from the name: ui8_, ui16_, ...)
+#   _symbol.member = expression   struct member added by add_struct_members (), width from its name
+#   _symbol+offset = expression   byte of a struct
+#   0xADDR = expression           IO register byte
+def load_stimuli (path):
+  sections = {}
+  order = []
+  section = None
+  with open (path) as f:
+    for number, line in enumerate (f, 1):
+      line = line.split ('#')[0].strip ()
+      if not line: continue
+      if line.startswith ('[') and line.endswith (']'):
+        section = line[1:-1]
+        sections[section] = []
+        if section != "common": order.append (section)
+      elif '=' in line and section:
+        target, expression = [field.strip () for field in line.split ('=', 1)]
+        sections[section].append ((target, expression))
+      else:
+        raise SystemExit ("%s:%d: can't parse '%s'" % (path, number, line))
+  return [(name, sections.get ("common", []) + sections[name]) for name in order]
+
+def stimulus_commands (assignments, symbols, defines):
+  commands = []
+  for target, expression in assignments:
+    name, _, offset = target.partition ('+')
+    if name.startswith ("0x"):
+      address, width = int (name, 16), 1
+    elif name in symbols:
+      address, width = symbols[name], symbol_width (name)
+    else:
+      raise SystemExit ("unknown symbol %s, is it still a global variable?" % name)
+    if offset: # struct member, a byte
+      address, width = address + int (offset, 0), 1
+    commands += poke (address, evaluate (expression, defines), width)
+  return commands
+
+def run (ucsim, cpu_type, clock, image, commands, timeout = 600):
+  script = "\n".join (commands + ["quit"]) + "\n"
+  result = subprocess.run ([ucsim, "-t", cpu_type, "-X", clock, image],
+                           input = script, stdout = subprocess.PIPE, stderr = subprocess.STDOUT,
+                           universal_newlines = True, timeout = timeout)
+  return result.stdout
+
+# cycle counters printed by every "state" command, in order
+def state_clocks (output):
+  return [int (clks) for clks in STATE_CLKS_RE.findall (output)]
+
+def load_baseline (path):
+  baseline = {}
+  try:
+    with open (path) as f:
+      for line in f:
+        fields = line.split ('#')[0].split ()
+        if len (fields) == 2: baseline[fields[0]] = int (fields[1])
+  except FileNotFoundError:
+    pass
+  return baseline
+
+def write_results (path, header, results):
+  with open (path, "w") as f:
+    f.write (header)
+    for name, cycles in results:
+      f.write ("%-24s %d\n" % (name, cycles))
+
+def report (results, baseline, threshold):
+  failed = False
+  print ("%-24s %8s %8s %8s" % ("", "cycles", "baseline", "delta"))
+  for name, cycles in results:
+    if name in baseline:
+      delta = cycles - baseline[name]
+      percent = 100.0 * delta / baseline[name] if baseline[name] else 0.0
+      mark = ""
+      if percent > threshold:
+        mark = "  <-- slower"
+        failed = True
+      print ("%-24s %8d %8d %+7d (%+.1f%%)%s" % (name, cycles, baseline[name], delta, percent, mark))
+    else:
+      print ("%-24s %8d %8s" % (name, cycles, "-"))
+  return failed
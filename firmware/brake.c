@@ -16,21 +16,27 @@
 #include "ebike_app.h"
 #include "motor.h"
 #include "pwm.h"
+#include "events.h"
+#include "hal.h"
 
-// Brake signal
+// Brake signal: only the brake state is changed here, without function calls (not reliable from interrupts with
+// SDCC). PWM cycle regen current controller takes the motor current to the target of motor_regen_controller (),
+// do_motor_controller_mode () sets the duty_cycle target to 0 and EVENT_BRAKE_SET stops the cruise control
 void EXTI_PORTA_IRQHandler(void) __interrupt(EXTI_PORTA_IRQHANDLER)
 {
-  if (brake_is_set())
+  // state bits are changed last, with interrupts disabled up to the interrupt return: the over current interrupt
+  // has a higher priority and also changes them, see interrupts.h
+  if (!HAL_GPIO_READ_INPUT_PIN (BRAKE__PORT, BRAKE__PIN))
   {
-    motor_controller_set_state (MOTOR_CONTROLLER_STATE_BRAKE);
-    motor_set_regen_current_max (ADC_MOTOR_REGEN_CURRENT_MAX); // enable strong ebrake/regen at 15 amps
-    motor_set_pwm_duty_cycle_target (0);
-    ebike_app_cruise_control_stop ();
+    EVENTS_POST_FROM_INTERRUPT (EVENTS_SOURCE_BRAKE, EVENT_BRAKE_SET);
+    disableInterrupts ();
+    motor_pwm_cycle.ui8_motor_controller_state |= MOTOR_CONTROLLER_STATE_BRAKE;
   }
   else
   {
-    motor_controller_reset_state (MOTOR_CONTROLLER_STATE_BRAKE);
-    motor_set_regen_current_max (0); // disable ebrake/regen
+    motor_pwm_cycle.ui8_adc_target_motor_regen_current_max = motor_pwm_cycle.ui8_motor_total_current_offset; // disable ebrake/regen
+    disableInterrupts ();
+    motor_pwm_cycle.ui8_motor_controller_state &= (uint8_t) ~MOTOR_CONTROLLER_STATE_BRAKE;
   }
 }
 
@@ -48,7 +54,7 @@ void brake_init (void)
 
 BitStatus brake_is_set (void)
 {
-  if (GPIO_ReadInputPin(BRAKE__PORT, BRAKE__PIN) == 0)
+  if (HAL_GPIO_READ_INPUT_PIN (BRAKE__PORT, BRAKE__PIN) == 0)
     return 1;
   else
     return 0;
@@ -112,6 +112,15 @@
 
 // For some motors with not very well placed mosfets at 120 degrees between each of them. May be easier to keep this option disabled
 //#define DO_SINEWAVE_INTERPOLATION_360_DEGREES
+
+// Motor with a temperature sensor: 10k NTC (B = 3950) between PB3 (ADC_AIN3) and GND, with a 10k pull up to 5V.
+// Motor current is reduced when the motor gets hot and the temperature is shown on the LCD. Without it the motor
+// temperature is estimated from the motor current
+//#define MOTOR_TEMPERATURE_SENSOR
+
+// Over current comparator output (PD7) also wired to PE3 (TIM1_BKIN): TIM1 hardware turns off all the mosfets
+// on the same clock the comparator trips, without waiting for the interrupt. Enable only on boards with that wire
+//#define MOTOR_OVER_CURRENT_TIM1_BREAK
 // *************************************************************************** //
 
 #endif /* CONFIG_H_ */
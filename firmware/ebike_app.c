@@ -21,30 +21,39 @@
 #include "uart.h"
 #include "brake.h"
 #include "eeprom.h"
+#include "statistics.h"
+#include "fault_log.h"
+#include "battery.h"
+#include "thermal.h"
+#include "events.h"
+#include "timers.h"
+#include "hal.h"
 
 // cruise control variables
 uint8_t ui8_cruise_state = 0;
 uint8_t ui8_cruise_output = 0;
-uint8_t ui8_cruise_counter = 0;
+uint32_t ui32_cruise_start_ms = 0; // throttle in the same position since then
 uint8_t ui8_cruise_value = 0;
 
 // communications variables
 volatile struc_lcd_configuration_variables lcd_configuration_variables;
 uint8_t ui8_received_package_flag = 0;
-volatile float f_controller_max_current;
-float f_wheel_speed;
-float f_wheel_perimeter = 2.0625; // 26'' wheel
+uint16_t ui16_wheel_speed_x10; // km/h * 10
+uint16_t ui16_wheel_perimeter_mm = 2063; // 26'' wheel
+uint32_t ui32_wheel_perimeter_mm_x36 = 2063 * 36;
+uint8_t ui8_lcd_configuration_changed = 1; // limits that depend on the LCD configuration need to be calculated
 uint8_t ui8_tx_buffer[12];
 uint8_t ui8_i;
 uint8_t ui8_crc;
 uint16_t ui16_wheel_period_ms;
-uint16_t ui16_battery_volts;
 uint8_t ui8_battery_soc;
 uint8_t ui16_error;
 uint8_t ui8_rx_buffer[13];
 uint8_t ui8_rx_counter = 0;
 uint8_t ui8_byte_received;
 uint8_t ui8_state_machine = 0;
+volatile uint8_t ui8_uart_command = 0; // maintenance command received, 0 if none
+uint8_t ui8_uart_command_received;
 
 uint8_t ui8_adc_throttle_value;
 uint8_t ui8_adc_throttle_value_cruise_control;
@@ -53,19 +62,63 @@ uint16_t ui16_throttle_value_accumulated = 0;
 uint8_t ui8_throttle_value_filtered;
 uint8_t ui8_is_throotle_released;
 
-volatile uint16_t ui16_pas_pwm_cycles_ticks = (uint16_t) PAS_ABSOLUTE_MIN_CADENCE_PWM_CYCLE_TICKS;
-volatile uint8_t ui8_pas_direction = 0;
 uint8_t ui8_pas_cadence_rpm = 0;
 
-volatile uint16_t ui16_wheel_speed_sensor_pwm_cycles_ticks = (uint16_t) WHEEL_SPEED_SENSOR_MAX_PWM_CYCLE_TICKS;
-volatile uint8_t ui8_wheel_speed_sensor_is_disconnected;
-
 uint16_t ui16_motor_controller_max_current_10b;
 
+// wheel perimeter in mm, indexed by LCD wheel size code >> 1
+static const uint16_t ui16_wheel_perimeter_mm_table [16] =
+{
+  1267, // 0x00: 16''
+  948,  // 0x02: 12''
+  1427, // 0x04: 18''
+  1108, // 0x06: 14''
+  1576, // 0x08: 20''
+  628,  // 0x0a: 8''
+  1743, // 0x0c: 22''
+  788,  // 0x0e: 10''
+  1896, // 0x10: 24''
+  469,  // 0x12: 6''
+  2063, // 0x14: 26''
+  2063, // 0x16: not used, 26''
+  2174, // 0x18: 700c
+  2063, // 0x1a: not used, 26''
+  2194, // 0x1c: 28''
+  2250  // 0x1e: 29''
+};
+
+// controller max current for each LCD max current setting (P5 / C5)
+static const uint16_t ui16_motor_controller_max_current_10b_table [11] =
+{
+  (uint16_t) (ADC_MOTOR_CURRENT_MAX_10B * 0.1),
+  (uint16_t) (ADC_MOTOR_CURRENT_MAX_10B * 0.25),
+  (uint16_t) (ADC_MOTOR_CURRENT_MAX_10B * 0.33),
+  (uint16_t) (ADC_MOTOR_CURRENT_MAX_10B * 0.5),
+  (uint16_t) (ADC_MOTOR_CURRENT_MAX_10B * 0.667),
+  (uint16_t) (ADC_MOTOR_CURRENT_MAX_10B * 0.752),
+  (uint16_t) (ADC_MOTOR_CURRENT_MAX_10B * 0.8),
+  (uint16_t) (ADC_MOTOR_CURRENT_MAX_10B * 0.833),
+  (uint16_t) (ADC_MOTOR_CURRENT_MAX_10B * 0.87),
+  (uint16_t) (ADC_MOTOR_CURRENT_MAX_10B * 0.91),
+  (uint16_t) ADC_MOTOR_CURRENT_MAX_10B
+};
+
+// assist level factors, 8 bits fixed point: 256 = 1.0
+static const uint16_t ui16_assist_level_factor_x256_table [6] =
+{
+  (uint16_t) ((ASSIST_LEVEL_0 * 256) + 0.5),
+  (uint16_t) ((ASSIST_LEVEL_1 * 256) + 0.5),
+  (uint16_t) ((ASSIST_LEVEL_2 * 256) + 0.5),
+  (uint16_t) ((ASSIST_LEVEL_3 * 256) + 0.5),
+  (uint16_t) ((ASSIST_LEVEL_4 * 256) + 0.5),
+  (uint16_t) ((ASSIST_LEVEL_5 * 256) + 0.5)
+};
+
 // function prototypes
 void communications_controller (void);
+void uart_command_controller (void);
 uint8_t ebike_app_cruise_control (uint8_t ui8_value);
-void set_speed_erps_max_to_motor_controller (struc_lcd_configuration_variables *lcd_configuration_variables);
+void set_speed_erps_max_to_motor_controller (volatile struc_lcd_configuration_variables *lcd_configuration_variables);
 void set_motor_controller_max_current (uint8_t ui8_controller_max_current);
 void calc_wheel_speed (void);
 void ebike_throotle_type_throotle_pas (void);
@@ -73,22 +126,45 @@ void ebike_throotle_type_torque_sensor (void);
 void read_throotle (void);
 void read_pas_cadence_and_direction (void);
 uint8_t pas_is_set (void);
+uint16_t ui16_scale_with_assist_level (uint8_t ui8_value);
 
 void ebike_app_controller (void)
 {
   // calc wheel speed and save the value on global variable ui8_wheel_speed
   calc_wheel_speed ();
 
+  // save the faults on EEPROM
+  fault_log_controller ();
+
+  // battery state of charge
+  battery_controller ();
+
+  // odometer, energy and motor on time
+  statistics_controller ();
+
+  // estimated mosfets and motor temperatures
+  thermal_controller ();
+
+  // motor max current: battery voltage sag and low voltage derating, thermal derating, over current recovery
+  motor_set_current_max (ui8_min (ui8_min (ui8_battery_get_current_max (), ui8_thermal_get_current_max ()),
+				  ui8_motor_get_over_current_current_max ()));
+
   // map throttle value from 0 up to 255 to global variable: ui8_throttle_value
   // setup ui8_is_throotle_released flag
   read_throotle ();
 
+  // brake kept pressed: EVENT_BRAKE_SET only comes when it is pressed
+  if (brake_is_set ()) { ebike_app_cruise_control_stop (); }
+
   // read PAS cadence to global variable: ui8_pas_cadence_rps
   read_pas_cadence_and_direction ();
 
   // send and received information to/from the LCD as also setup the configuration variables
   communications_controller ();
 
+  // answer maintenance commands
+  uart_command_controller ();
+
   // control the motor using specific algorithm
 #if (EBIKE_THROTTLE_TYPE == EBIKE_THROTTLE_TYPE_THROTTLE_PAS)
   ebike_throotle_type_throotle_pas ();
@@ -97,6 +173,13 @@ void ebike_app_controller (void)
 #else
 #error
 #endif
+
+  // bike parked: PWM cycle interrupt at a lower rate, see MOTOR_IDLE_PWM_CYCLES
+  if (ui8_is_throotle_released && (!pas_is_set ()) && (ui16_wheel_speed_x10 == 0) &&
+      (motor_pwm_cycle.ui8_motor_state == MOTOR_STATE_STOP) && (motor_pwm_cycle.ui8_duty_cycle == 0))
+  {
+    motor_idle_enter ();
+  }
 }
 
 // cruise control will save throttle value and use it even if user releases throttle
@@ -107,7 +190,7 @@ uint8_t ebike_app_cruise_control (uint8_t ui8_value)
   if (ui8_ebike_app_get_wheel_speed () < 6)
   {
     ui8_cruise_state = 0;
-    ui8_cruise_counter = 0;
+    ui32_cruise_start_ms = ui32_system_time_get_ms ();
     return ui8_value;
   }
 
@@ -117,20 +200,18 @@ uint8_t ebike_app_cruise_control (uint8_t ui8_value)
     if ((ui8_value > CRUISE_CONTROL_MIN) &&
 	((ui8_value > (ui8_cruise_value - CRUISE_CONTROL_MIN)) || (ui8_value < (ui8_cruise_value + CRUISE_CONTROL_MIN))))
     {
-      ui8_cruise_counter++;
       ui8_cruise_output = ui8_value;
 
-      if (ui8_cruise_counter > 80) // 80 * 100ms = 8 seconds: time to lock cruise control
+      if (system_time_is_timeout (ui32_cruise_start_ms, CRUISE_CONTROL_LOCK_TIME_MS)) // time to lock cruise control
       {
 	ui8_cruise_state = 1;
 	ui8_cruise_output = ui8_value;
-	ui8_cruise_counter = 0;
 	ui8_cruise_value = 0;
       }
     }
     else
     {
-      ui8_cruise_counter = 0;
+      ui32_cruise_start_ms = ui32_system_time_get_ms ();
       ui8_cruise_value = ui8_value;
       ui8_cruise_output = ui8_cruise_value;
     }
@@ -162,6 +243,27 @@ void ebike_app_cruise_control_stop (void)
   ui8_cruise_state = 0;
 }
 
+// events posted by the interrupts, see events.h; call on every main loop iteration
+void ebike_app_events_controller (void)
+{
+  uint8_t ui8_event;
+
+  while ((ui8_event = events_get ()) != EVENT_NONE)
+  {
+    switch (ui8_event)
+    {
+      case EVENT_OVER_CURRENT: // motor is stopped until the over current recovery
+      case EVENT_BRAKE_SET:
+      case EVENT_MOTOR_STOPPED:
+      ebike_app_cruise_control_stop ();
+      break;
+
+      default: // EVENT_HALL_SENSORS_ERROR: only counted by events_get ()
+      break;
+    }
+  }
+}
+
 uint8_t throttle_is_set (void)
 {
   return (ui8_adc_throttle_value > ADC_THROTTLE_MIN_VALUE) ? 1: 0;
@@ -170,22 +272,26 @@ uint8_t throttle_is_set (void)
 void communications_controller (void)
 {
   uint8_t ui8_moving_indication = 0;
+  uint8_t ui8_soc;
   int8_t i8_motor_current_filtered_10b = 0;
+  uint32_t ui32_temp;
+  struc_lcd_configuration_variables lcd_configuration_variables_received;
 
   /********************************************************************************************/
   // Prepare and send packate to LCD
   //
 
-  // calc wheel period in ms
-  if (f_wheel_speed < 1) { ui16_wheel_period_ms = 36000.0 * f_wheel_perimeter; } // this is needed to get LCD showing 0 km/h
-  else { ui16_wheel_period_ms = (3600.0 * f_wheel_perimeter) / f_wheel_speed; }
-
-  // calc battery pack state of charge (SOC)
-  ui16_battery_volts = ((uint16_t) motor_get_ADC_battery_voltage_filtered ()) * ((uint16_t) ADC_BATTERY_VOLTAGE_K);
-  if (ui16_battery_volts > ((uint16_t) BATTERY_PACK_VOLTS_80)) { ui8_battery_soc = 16; } // 4 bars | full
-  else if (ui16_battery_volts > ((uint16_t) BATTERY_PACK_VOLTS_60)) { ui8_battery_soc = 12; } // 3 bars
-  else if (ui16_battery_volts > ((uint16_t) BATTERY_PACK_VOLTS_40)) { ui8_battery_soc = 8; } // 2 bars
-  else if (ui16_battery_volts > ((uint16_t) BATTERY_PACK_VOLTS_20)) { ui8_battery_soc = 4; } // 1 bar
+  // calc wheel period in ms: 3600 * perimeter (m) / speed (km/h) = 36 * perimeter (mm) / (speed (km/h) * 10)
+  // under 1 km/h use 0.1 km/h, this is needed to get LCD showing 0 km/h
+  ui32_temp = ui32_wheel_perimeter_mm_x36 / ((ui16_wheel_speed_x10 < 10) ? 1 : ui16_wheel_speed_x10);
+  ui16_wheel_period_ms = (ui32_temp > 0xffff) ? 0xffff : (uint16_t) ui32_temp;
+
+  // battery bars from the battery pack state of charge (SOC)
+  ui8_soc = ui8_battery_get_soc ();
+  if (ui8_soc > 80) { ui8_battery_soc = 16; } // 4 bars | full
+  else if (ui8_soc > 60) { ui8_battery_soc = 12; } // 3 bars
+  else if (ui8_soc > 40) { ui8_battery_soc = 8; } // 2 bars
+  else if (ui8_soc > 20) { ui8_battery_soc = 4; } // 1 bar
   else { ui8_battery_soc = 3; } // empty
 
   // prepare error
@@ -232,8 +338,8 @@ void communications_controller (void)
   i8_motor_current_filtered_10b -= 1; // try to avoid LCD display about 25W when motor is not running
   if (i8_motor_current_filtered_10b < 0) { i8_motor_current_filtered_10b = 0; } // limit to be only positive value, LCD don't accept regen current value
   ui8_tx_buffer [8] = (uint8_t) (i8_motor_current_filtered_10b);
-  // B9: motor temperature
-  ui8_tx_buffer [9] = 0;
+  // B9: motor temperature, estimated
+  ui8_tx_buffer [9] = ui8_thermal_get_motor_temperature ();
   // B10 and B11: 0
   ui8_tx_buffer [10] = 0;
   ui8_tx_buffer [11] = 0;
@@ -275,23 +381,78 @@ void communications_controller (void)
 	((ui8_crc ^ 9) == ui8_rx_buffer [7]) 	|| // CRC LCD5
 	((ui8_crc ^ 2) == ui8_rx_buffer [7])) 	   // CRC LCD3
     {
-      lcd_configuration_variables.ui8_assist_level = ui8_rx_buffer [3] & 7;
-      lcd_configuration_variables.ui8_motor_characteristic = ui8_rx_buffer [5];
-      lcd_configuration_variables.ui8_wheel_size = ((ui8_rx_buffer [6] & 192) >> 6) | ((ui8_rx_buffer [4] & 7) << 2);
-      lcd_configuration_variables.ui8_max_speed = 10 + ((ui8_rx_buffer [4] & 248) >> 3) | (ui8_rx_buffer [6] & 32);
-      lcd_configuration_variables.ui8_power_assist_control_mode = ui8_rx_buffer [6] & 8;
-      lcd_configuration_variables.ui8_controller_max_current = (ui8_rx_buffer [9] & 15);
-
-      // now write values to EEPROM, but only if one of them changed
-      eeprom_write_if_values_changed ();
+      lcd_configuration_variables_received.ui8_assist_level = ui8_rx_buffer [3] & 7;
+      lcd_configuration_variables_received.ui8_motor_characteristic = ui8_rx_buffer [5];
+      lcd_configuration_variables_received.ui8_wheel_size = ((ui8_rx_buffer [6] & 192) >> 6) | ((ui8_rx_buffer [4] & 7) << 2);
+      lcd_configuration_variables_received.ui8_max_speed = 10 + (((ui8_rx_buffer [4] & 248) >> 3) | (ui8_rx_buffer [6] & 32));
+      lcd_configuration_variables_received.ui8_power_assist_control_mode = ui8_rx_buffer [6] & 8;
+      lcd_configuration_variables_received.ui8_controller_max_current = (ui8_rx_buffer [9] & 15);
+
+      // LCD sends the same configuration on every package: only when something changed, save it and
+      // calc again the limits that depend on it
+      if ((lcd_configuration_variables_received.ui8_assist_level != lcd_configuration_variables.ui8_assist_level) ||
+	  (lcd_configuration_variables_received.ui8_motor_characteristic != lcd_configuration_variables.ui8_motor_characteristic) ||
+	  (lcd_configuration_variables_received.ui8_wheel_size != lcd_configuration_variables.ui8_wheel_size) ||
+	  (lcd_configuration_variables_received.ui8_max_speed != lcd_configuration_variables.ui8_max_speed) ||
+	  (lcd_configuration_variables_received.ui8_power_assist_control_mode != lcd_configuration_variables.ui8_power_assist_control_mode) ||
+	  (lcd_configuration_variables_received.ui8_controller_max_current != lcd_configuration_variables.ui8_controller_max_current))
+      {
+	lcd_configuration_variables = lcd_configuration_variables_received;
+
+	// now write values to EEPROM, but only if one of them changed
+	eeprom_write_if_values_changed ();
+	ui8_lcd_configuration_changed = 1;
+      }
     }
 
-    UART2->CR2 |= (1 << 5); // enable UART2 receive interrupt as we are now ready to receive a new package
+    ui8_received_package_flag = 0;
+    HAL_UART2_RX_INTERRUPT_ENABLE (); // enable UART2 receive interrupt as we are now ready to receive a new package
+  }
+
+  // limits that depend only on the LCD configuration
+  if (ui8_lcd_configuration_changed)
+  {
+    ui8_lcd_configuration_changed = 0;
+    set_motor_controller_max_current (lcd_configuration_variables.ui8_controller_max_current);
+    set_speed_erps_max_to_motor_controller (&lcd_configuration_variables);
+  }
+}
+
+void uart_command_controller (void)
+{
+  switch (ui8_uart_command)
+  {
+    case 0:
+    return;
+
+    case UART_COMMAND_READ_STATISTICS:
+    statistics_send ();
+    break;
+
+    case UART_COMMAND_READ_FAULT_LOG:
+    if (eeprom_is_busy ()) { return; } // try again next time
+    if (!fault_log_send ()) { return; } // next package next time
+    break;
+
+    case UART_COMMAND_READ_TEMPERATURES:
+    thermal_send ();
+    break;
+
+    case UART_COMMAND_READ_EVENTS:
+    events_send ();
+    break;
+
+    default:
+    break;
   }
 
-  // do here some tasks that must be done even if we don't receive a package from the LCD
-  set_motor_controller_max_current (lcd_configuration_variables.ui8_controller_max_current);
-  set_speed_erps_max_to_motor_controller (&lcd_configuration_variables);
+  ui8_uart_command = 0;
+}
+
+// LCD configuration variables were changed (read from EEPROM): calc again the limits that depend on them
+void ebike_app_lcd_configuration_changed (void)
+{
+  ui8_lcd_configuration_changed = 1;
 }
 
 // This is the interrupt that happesn when UART2 receives data. We need it to be the fastest possible and so
@@ -299,9 +460,9 @@ void communications_controller (void)
 // and disable the interrupt. The interrupt should be enable again on main loop, after the package being processed
 void UART2_IRQHandler(void) __interrupt(UART2_IRQHANDLER)
 {
-  if(UART2_GetFlagStatus(UART2_FLAG_RXNE) == SET)
+  if (HAL_UART2_RX_NOT_EMPTY ())
   {
-    ui8_byte_received = UART2_ReceiveData8 ();
+    ui8_byte_received = HAL_UART2_RECEIVE_DATA8 ();
 
     switch (ui8_state_machine)
     {
@@ -311,6 +472,11 @@ void UART2_IRQHandler(void) __interrupt(UART2_IRQHANDLER)
 	ui8_rx_buffer[ui8_rx_counter++] = ui8_byte_received;
 	ui8_state_machine = 1;
       }
+      else if (ui8_byte_received == UART_COMMAND_START) // maintenance command
+      {
+	ui8_rx_counter = 0;
+	ui8_state_machine = 3;
+      }
       else
       {
 	ui8_rx_counter = 0;
@@ -340,151 +506,53 @@ void UART2_IRQHandler(void) __interrupt(UART2_IRQHANDLER)
 	ui8_rx_counter = 0;
 	ui8_state_machine = 0;
 	ui8_received_package_flag = 1; // signal that we have a full package to be processed
-	UART2->CR2 &= ~(1 << 5); // disable UART2 receive interrupt
+	HAL_UART2_RX_INTERRUPT_DISABLE (); // disable UART2 receive interrupt
       }
       break;
 
+      case 3:
+      ui8_uart_command_received = ui8_byte_received;
+      ui8_state_machine = 4;
+      break;
+
+      case 4:
+      // command is valid if this byte is the command xor 0xff; it is lost if the previous one is still being
+      // answered, the fault log takes some packages
+      if ((ui8_byte_received == (ui8_uart_command_received ^ 0xff)) && (!ui8_uart_command)) { ui8_uart_command = ui8_uart_command_received; }
+      ui8_state_machine = 0;
+      break;
+
       default:
       break;
     }
   }
 }
 
-void set_speed_erps_max_to_motor_controller (struc_lcd_configuration_variables *lcd_configuration_variables)
+void set_speed_erps_max_to_motor_controller (volatile struc_lcd_configuration_variables *lcd_configuration_variables)
 {
   uint32_t ui32_temp;
-  float f_temp;
+  uint8_t ui8_wheel_size = lcd_configuration_variables->ui8_wheel_size;
 
-  switch (lcd_configuration_variables->ui8_wheel_size)
-  {
-    case 0x12: // 6''
-    f_wheel_perimeter = 0.46875;
-    break;
-
-    case 0x0a: // 8''
-    f_wheel_perimeter = 0.62847;
-    break;
-
-    case 0x0e: // 10''
-    f_wheel_perimeter = 0.78819;
-    break;
-
-    case 0x02: // 12''
-    f_wheel_perimeter = 0.94791;
-    break;
-
-    case 0x06: // 14''
-    f_wheel_perimeter = 1.10764;
-    break;
+  // wheel sizes are even codes from 0x00 to 0x1e; anything else is a 26'' wheel
+  if ((ui8_wheel_size & 0xe1) == 0) { ui16_wheel_perimeter_mm = ui16_wheel_perimeter_mm_table [ui8_wheel_size >> 1]; }
+  else { ui16_wheel_perimeter_mm = ui16_wheel_perimeter_mm_table [0x14 >> 1]; }
+  ui32_wheel_perimeter_mm_x36 = ((uint32_t) ui16_wheel_perimeter_mm) * 36;
 
-    case 0x00: // 16''
-    f_wheel_perimeter = 1.26736;
-    break;
-
-    case 0x04: // 18''
-    f_wheel_perimeter = 1.42708;
-    break;
-
-    case 0x08: // 20''
-    f_wheel_perimeter = 1.57639;
-    break;
-
-    case 0x0c: // 22''
-    f_wheel_perimeter = 1.74305;
-    break;
-
-    case 0x10: // 24''
-    f_wheel_perimeter = 1.89583;
-    break;
-
-    case 0x14: // 26''
-    f_wheel_perimeter = 2.0625;
-    break;
-
-    case 0x18: // 700c
-    f_wheel_perimeter = 2.17361;
-    break;
-
-    case 0x1c: // 28''
-    f_wheel_perimeter = 2.19444;
-    break;
-
-    case 0x1e: // 29''
-    f_wheel_perimeter = 2.25;
-    break;
-
-    default: // 26''
-    f_wheel_perimeter = 2.0625;
-    break;
-  }
-
-  // (ui8_max_speed * 1000 * (ui8_motor_characteristic / 2)) / (3600 * f_wheel_size)
-  ui32_temp = ((uint32_t) lcd_configuration_variables->ui8_max_speed) * 1000; // in meters/hour
+  // (ui8_max_speed * 1000 * (ui8_motor_characteristic / 2)) / (3600 * wheel perimeter (m))
+  // = (ui8_max_speed * (ui8_motor_characteristic / 2) * 10000) / (36 * wheel perimeter (mm))
+  ui32_temp = ((uint32_t) lcd_configuration_variables->ui8_max_speed) * 10000; // in meters/hour * 10
   ui32_temp *= ((uint32_t) (lcd_configuration_variables->ui8_motor_characteristic >> 1));
-  f_temp = 3600.0 * f_wheel_perimeter;
-  f_temp = ((float) ui32_temp) / f_temp;
-  motor_controller_set_speed_erps_max ((uint16_t) f_temp);
+  ui32_temp /= ui32_wheel_perimeter_mm_x36;
+  motor_controller_set_speed_erps_max ((uint16_t) ui32_temp);
 }
 
 void set_motor_controller_max_current (uint8_t ui8_controller_max_current)
 {
-  float f_controller_max_current;
-
-  switch (ui8_controller_max_current)
-  {
-    case 0:
-    f_controller_max_current = 0.1;
-    break;
-
-    case 1:
-    f_controller_max_current = 0.25;
-    break;
-
-    case 2:
-    f_controller_max_current = 0.33;
-    break;
-
-    case 3:
-    f_controller_max_current = 0.5;
-    break;
-
-    case 4:
-    f_controller_max_current = 0.667;
-    break;
-
-    case 5:
-    f_controller_max_current = 0.752;
-    break;
-
-    case 6:
-    f_controller_max_current = 0.8;
-    break;
-
-    case 7:
-    f_controller_max_current = 0.833;
-    break;
-
-    case 8:
-    f_controller_max_current = 0.87;
-    break;
-
-    case 9:
-    f_controller_max_current = 0.91;
-    break;
-
-    case 10:
-    f_controller_max_current = 1.0;
-    break;
-
-    default:
-    f_controller_max_current = 1.0;
-    break;
-  }
-
-  ui16_motor_controller_max_current_10b = (uint16_t) (((float) ADC_MOTOR_CURRENT_MAX_10B) * f_controller_max_current);
+  if (ui8_controller_max_current > 10) { ui8_controller_max_current = 10; }
+  ui16_motor_controller_max_current_10b = ui16_motor_controller_max_current_10b_table [ui8_controller_max_current];
 }
 
-struc_lcd_configuration_variables *ebike_app_get_lcd_configuration_variables (void)
+volatile struc_lcd_configuration_variables *ebike_app_get_lcd_configuration_variables (void)
 {
   return &lcd_configuration_variables;
 }
@@ -501,38 +569,54 @@ uint8_t ebike_app_is_throttle_released (void)
 
 uint8_t ui8_ebike_app_get_wheel_speed (void)
 {
-  return f_wheel_speed;
+  uint16_t ui16_temp = ui16_wheel_speed_x10 / 10;
+  return (ui16_temp > 255) ? 255 : (uint8_t) ui16_temp;
+}
+
+uint16_t ui16_ebike_app_get_wheel_speed_x10 (void)
+{
+  return ui16_wheel_speed_x10;
 }
 
 void calc_wheel_speed (void)
 {
   uint32_t ui32_temp;
   uint32_t ui32_temp1;
+  struc_motor_snapshot snapshot;
 
-  if (ui8_wheel_speed_sensor_is_disconnected)
+  motor_snapshot_read (&snapshot);
+
+  // until the first wheel speed sensor pulse, wheel speed comes from the motor hall sensors
+  if (snapshot.ui8_wheel_speed_sensor_is_disconnected)
   {
     // calc wheel speed in km/h, from motor hall sensors signals
+    // (erps * 3600 * wheel perimeter (m)) / ((ui8_motor_characteristic / 2) * 1000), * 10
     ui32_temp = ((uint32_t) (lcd_configuration_variables.ui8_motor_characteristic >> 1)) * 1000;
-    ui32_temp1 = ((uint32_t) ui16_motor_get_motor_speed_erps ()) * 3600;
-    f_wheel_speed = ((float) ui32_temp1) * f_wheel_perimeter;
-    f_wheel_speed /= (float) ui32_temp;
+    ui32_temp1 = ((uint32_t) snapshot.ui16_motor_speed_erps) * 36;
+    ui32_temp1 *= (uint32_t) ui16_wheel_perimeter_mm;
+    ui16_wheel_speed_x10 = ui32_temp ? (uint16_t) (ui32_temp1 / ui32_temp) : 0;
   }
   else
   {
     // calc wheel speed in km/h, from external wheel speed sensor
-    f_wheel_speed = ((float) PWM_CYCLES_SECOND) / ((float) ui16_wheel_speed_sensor_pwm_cycles_ticks); // rps
-    f_wheel_speed *= f_wheel_perimeter; // meters per second
-    f_wheel_speed *= 3.6; // kms per hour
+    // PWM_CYCLES_SECOND / ticks * wheel perimeter (m) * 3.6, * 10 = 562.5 * wheel perimeter (mm) / ticks
+    ui32_temp = ((uint32_t) ui16_wheel_perimeter_mm) * 1125;
+    ui16_wheel_speed_x10 = (uint16_t) (ui32_temp / (((uint32_t) snapshot.ui16_wheel_speed_sensor_pwm_cycles_ticks) << 1));
   }
 }
 
 void read_pas_cadence_and_direction (void)
 {
+  struc_motor_snapshot snapshot;
+
+  motor_snapshot_read (&snapshot);
+
   // cadence in RPM =  60 / (ui16_pas_timer2_ticks * PAS_NUMBER_MAGNETS * 0.000064)
-  if (ui16_pas_pwm_cycles_ticks >= ((uint16_t) PAS_ABSOLUTE_MIN_CADENCE_PWM_CYCLE_TICKS)) { ui8_pas_cadence_rpm = 0; }
+  // ui16_pas_pwm_cycles_ticks is at least PAS_ABSOLUTE_MAX_CADENCE_PWM_CYCLE_TICKS: 150 RPM max
+  if (snapshot.ui16_pas_pwm_cycles_ticks >= ((uint16_t) PAS_ABSOLUTE_MIN_CADENCE_PWM_CYCLE_TICKS)) { ui8_pas_cadence_rpm = 0; }
   else
   {
-    ui8_pas_cadence_rpm = (uint8_t) (60 / (((float) ui16_pas_pwm_cycles_ticks) * ((float) PAS_NUMBER_MAGNETS) * 0.000064));
+    ui8_pas_cadence_rpm = (uint8_t) (((uint32_t) PAS_CADENCE_RPM_TICKS) / snapshot.ui16_pas_pwm_cycles_ticks);
 
     if (ui8_pas_cadence_rpm > ((uint8_t) PAS_MAX_CADENCE_RPM))
     {
@@ -540,7 +624,7 @@ void read_pas_cadence_and_direction (void)
     }
   }
 
-  if (ui8_pas_direction) { ui8_pas_cadence_rpm = 0; }
+  if (snapshot.ui8_pas_direction) { ui8_pas_cadence_rpm = 0; }
 }
 
 uint8_t pas_is_set (void)
@@ -552,46 +636,15 @@ void ebike_throotle_type_throotle_pas (void)
 {
 #if defined (EBIKE_THROTTLE_TYPE_THROTTLE_PAS_PWM_DUTY_CYCLE)
   uint8_t ui8_temp;
-  float f_temp;
+  uint16_t ui16_temp;
 
   // set target motor speed to the value defined on the LCD
   // (due to motor configurations on the motor controller, this will only put a limit to the max permited speed!)
   motor_controller_set_target_speed_erps (motor_controller_get_target_speed_erps_max ());
 
   // scale with assist level value
-  switch (lcd_configuration_variables.ui8_assist_level)
-  {
-    case 0:
-    f_temp = ASSIST_LEVEL_0;
-    break;
-
-    case 1:
-    f_temp = ASSIST_LEVEL_1;
-    break;
-
-    case 2:
-    f_temp = ASSIST_LEVEL_2;
-    break;
-
-    case 3:
-    f_temp = ASSIST_LEVEL_3;
-    break;
-
-    case 4:
-    f_temp = ASSIST_LEVEL_4;
-    break;
-
-    case 5:
-    f_temp = ASSIST_LEVEL_5;
-    break;
-
-    default:
-    f_temp = ASSIST_LEVEL_5;
-    break;
-  }
-
-  f_temp = (float) (((float) ui8_throttle_value_filtered) * f_temp);
-  ui8_temp = (uint8_t) (map ((uint32_t) f_temp,
+  ui16_temp = ui16_scale_with_assist_level (ui8_throttle_value_filtered);
+  ui8_temp = (uint8_t) (map ((uint32_t) ui16_temp,
   			 (uint32_t) 0,
   			 (uint32_t) 255,
   			 (uint32_t) 0,
@@ -601,7 +654,6 @@ void ebike_throotle_type_throotle_pas (void)
 #elif defined (EBIKE_THROTTLE_TYPE_THROTTLE_PAS_CURRENT_SPEED)
   uint8_t ui8_temp;
   uint16_t ui16_temp;
-  float f_temp;
   uint16_t ui16_target_speed_erps;
 
   // map ui8_pas_cadence_rpm to 0 - 255
@@ -616,43 +668,13 @@ void ebike_throotle_type_throotle_pas (void)
 #endif
 
   // scale with assist level value
-  switch (lcd_configuration_variables.ui8_assist_level)
-  {
-    case 0:
-    f_temp = ASSIST_LEVEL_0;
-    break;
-
-    case 1:
-    f_temp = ASSIST_LEVEL_1;
-    break;
-
-    case 2:
-    f_temp = ASSIST_LEVEL_2;
-    break;
-
-    case 3:
-    f_temp = ASSIST_LEVEL_3;
-    break;
-
-    case 4:
-    f_temp = ASSIST_LEVEL_4;
-    break;
-
-    case 5:
-    f_temp = ASSIST_LEVEL_5;
-    break;
-
-    default:
-    f_temp = ASSIST_LEVEL_5;
-    break;
-  }
-
-  f_temp = (float) (((float) ui8_temp) * f_temp);
+  ui16_temp = ui16_scale_with_assist_level (ui8_temp);
+  if (ui16_temp > 255) { ui16_temp = 255; }
 
 #if !defined(EBIKE_THROTTLE_TYPE_THROTTLE_PAS_ASSIST_LEVEL_PAS_ONLY)
-  ui8_temp = (uint8_t) f_temp;
+  ui8_temp = (uint8_t) ui16_temp;
 #else
-  ui8_temp = ui8_max (ui8_throttle_value_filtered, (uint8_t) f_temp); // use the max value from throotle or (pas cadence * assist level)
+  ui8_temp = ui8_max (ui8_throttle_value_filtered, (uint8_t) ui16_temp); // use the max value from throotle or (pas cadence * assist level)
 #endif
 
   // map to motor controller current
@@ -688,47 +710,14 @@ void ebike_throotle_type_torque_sensor (void)
 {
   uint16_t ui16_target_current_10b;
   uint16_t ui16_temp;
-  float f_temp;
   uint16_t ui16_target_speed_erps;
 
-  switch (lcd_configuration_variables.ui8_assist_level)
-  {
-    case 0:
-    f_temp = ASSIST_LEVEL_0;
-    break;
-
-    case 1:
-    f_temp = ASSIST_LEVEL_1;
-    break;
-
-    case 2:
-    f_temp = ASSIST_LEVEL_2;
-    break;
-
-    case 3:
-    f_temp = ASSIST_LEVEL_3;
-    break;
-
-    case 4:
-    f_temp = ASSIST_LEVEL_4;
-    break;
-
-    case 5:
-    f_temp = ASSIST_LEVEL_5;
-    break;
-
-    default:
-    f_temp = ASSIST_LEVEL_5;
-    break;
-  }
-
-  f_temp = (float) (((float) (ui8_throttle_value_filtered >> 1)) * f_temp);
+  // scale with assist level value
+  ui16_temp = ui16_scale_with_assist_level (ui8_throttle_value_filtered >> 1);
 
 #if defined (EBIKE_THROTTLE_TYPE_TORQUE_SENSOR_HUMAN_POWER)
   // calc humam power on the crank using as input the pedal torque sensor value and pedal cadence
-  ui16_temp = (uint16_t) (f_temp * ((float) ((float) ui8_pas_cadence_rpm / ((float) PAS_MAX_CADENCE_RPM))));
-#else
-  ui16_temp = (uint16_t) f_temp;
+  ui16_temp = (uint16_t) ((((uint32_t) ui16_temp) * ui8_pas_cadence_rpm) / ((uint8_t) PAS_MAX_CADENCE_RPM));
 #endif
 
   ui16_target_current_10b = (uint16_t) (map ((uint32_t) ui16_temp, // human power value
@@ -758,6 +747,15 @@ void ebike_throotle_type_torque_sensor (void)
   }
 }
 
+// ui8_value * assist level, rounded
+uint16_t ui16_scale_with_assist_level (uint8_t ui8_value)
+{
+  uint8_t ui8_assist_level = lcd_configuration_variables.ui8_assist_level;
+
+  if (ui8_assist_level > 5) { ui8_assist_level = 5; }
+  return (uint16_t) (((((uint32_t) ui8_value) * ui16_assist_level_factor_x256_table [ui8_assist_level]) + 128) >> 8);
+}
+
 void read_throotle (void)
 {
   // read torque sensor signal
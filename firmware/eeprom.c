@@ -11,87 +11,287 @@
 #include "stm8s_flash.h"
 #include "eeprom.h"
 #include "ebike_app.h"
+#include "hal.h"
+
+// RAM copies of the newest records: the firmware only reads and writes these arrays. When one changes,
+// a new record is programmed in background by eeprom_controller () on the next slot of its area.
+uint8_t ui8_eeprom_configuration_record [EEPROM_CONFIGURATION_RECORD_SIZE];
+uint8_t ui8_eeprom_statistics_record [EEPROM_STATISTICS_RECORD_SIZE];
+uint8_t ui8_eeprom_fault_log_record [EEPROM_FAULT_LOG_RECORD_SIZE];
+
+struc_eeprom_area eeprom_areas [EEPROM_AREAS_NUMBER] =
+{
+  { EEPROM_CONFIGURATION_ADDRESS, EEPROM_CONFIGURATION_RECORDS_NUMBER, EEPROM_CONFIGURATION_RECORD_SIZE,
+    EEPROM_CONFIGURATION_VERSION, ui8_eeprom_configuration_record, EEPROM_NO_SLOT, 0 },
+  { EEPROM_STATISTICS_ADDRESS, EEPROM_STATISTICS_RECORDS_NUMBER, EEPROM_STATISTICS_RECORD_SIZE,
+    EEPROM_STATISTICS_VERSION, ui8_eeprom_statistics_record, EEPROM_NO_SLOT, 0 },
+  { EEPROM_FAULT_LOG_ADDRESS, EEPROM_FAULT_LOG_RECORDS_NUMBER, EEPROM_FAULT_LOG_RECORD_SIZE,
+    EEPROM_FAULT_LOG_VERSION, ui8_eeprom_fault_log_record, EEPROM_NO_SLOT, 0 }
+};
+
+uint8_t ui8_eeprom_state = EEPROM_STATE_IDLE;
+uint8_t ui8_eeprom_programming_record [EEPROM_RECORD_SIZE_MAX]; // record being programmed, also used to scan at boot
+struc_eeprom_area *p_eeprom_programming_area;
+uint8_t ui8_eeprom_programming_word;
 
 void eeprom_read_values_to_variables (void);
-void eeprom_read_values_to_variables (void);
-void eeprom_write_array (uint8_t *array_values);
+void eeprom_find_newest_record (uint8_t ui8_area);
+uint8_t eeprom_record_crc (uint8_t *p_record, uint8_t ui8_size);
+uint16_t eeprom_slot_address (struc_eeprom_area *p_area, uint8_t ui8_slot);
+void eeprom_write_record_value (uint8_t ui8_index, uint8_t ui8_value);
 
 void eeprom_init (void)
 {
-  uint8_t array_default_values [7] = {
-	KEY,
-	DEFAULT_VALUE_ASSIST_LEVEL,
-	DEFAULT_VALUE_MOTOR_CHARACTARISTIC,
-	DEFAULT_VALUE_WHEEL_SIZE,
-	DEFAULT_VALUE_MAX_SPEED,
-	DEFAULT_VALUE_POWER_ASSIST_CONTROL_MODE,
-	DEFAULT_VALUE_CONTROLLER_MAX_CURRENT
-  };
-  uint8_t ui8_data;
-
-  // start by reading address 0 and see if value is different from our key,
-  // if so mean that eeprom memory is clean and we need to populate: should happen after erasing the microcontroller
-  ui8_data = FLASH_ReadByte (ADDRESS_KEY);
-  if (ui8_data != KEY) // verify if our key exist
+  uint8_t ui8_area;
+  uint8_t *p_record = ui8_eeprom_configuration_record;
+
+  FLASH_SetProgrammingTime (FLASH_PROGRAMTIME_STANDARD);
+
+  for (ui8_area = 0; ui8_area < EEPROM_AREAS_NUMBER; ui8_area++)
+  {
+    eeprom_find_newest_record (ui8_area);
+  }
+
+  if (!eeprom_record_is_saved (EEPROM_AREA_CONFIGURATION))
+  {
+    // no valid record: EEPROM is clean (after erasing the microcontroller) or has the old format
+    if (HAL_FLASH_READ_BYTE (ADDRESS_KEY) == KEY)
+    {
+      p_record [RECORD_ASSIST_LEVEL] = HAL_FLASH_READ_BYTE (ADDRESS_ASSIST_LEVEL);
+      p_record [RECORD_MOTOR_CHARACTARISTIC] = HAL_FLASH_READ_BYTE (ADDRESS_MOTOR_CHARACTARISTIC);
+      p_record [RECORD_WHEEL_SIZE] = HAL_FLASH_READ_BYTE (ADDRESS_WHEEL_SIZE);
+      p_record [RECORD_MAX_SPEED] = HAL_FLASH_READ_BYTE (ADDRESS_MAX_SPEED);
+      p_record [RECORD_POWER_ASSIST_CONTROL_MODE] = HAL_FLASH_READ_BYTE (ADDRESS_POWER_ASSIST_CONTROL_MODE);
+      p_record [RECORD_CONTROLLER_MAX_CURRENT] = HAL_FLASH_READ_BYTE (ADDRESS_CONTROLLER_MAX_CURRENT);
+
+      // slot 0 has the old format bytes: the migrated record goes to slot 1. If power is lost before it is
+      // complete, the old format is still there and is migrated again on the next boot
+      eeprom_areas [EEPROM_AREA_CONFIGURATION].ui8_slot = 0;
+    }
+    else
+    {
+      p_record [RECORD_ASSIST_LEVEL] = DEFAULT_VALUE_ASSIST_LEVEL;
+      p_record [RECORD_MOTOR_CHARACTARISTIC] = DEFAULT_VALUE_MOTOR_CHARACTARISTIC;
+      p_record [RECORD_WHEEL_SIZE] = DEFAULT_VALUE_WHEEL_SIZE;
+      p_record [RECORD_MAX_SPEED] = DEFAULT_VALUE_MAX_SPEED;
+      p_record [RECORD_POWER_ASSIST_CONTROL_MODE] = DEFAULT_VALUE_POWER_ASSIST_CONTROL_MODE;
+      p_record [RECORD_CONTROLLER_MAX_CURRENT] = DEFAULT_VALUE_CONTROLLER_MAX_CURRENT;
+    }
+
+    eeprom_write_record (EEPROM_AREA_CONFIGURATION);
+  }
+
+  eeprom_read_values_to_variables ();
+}
+
+// Scan all slots of the area for the valid record with the highest sequence number. Sequence numbers of
+// the valid records are all within the last records number saves, so they compare with 8 bits wrap around.
+// The CRC is only calculated for records newer than the best found so far. If there is no valid record,
+// the RAM copy starts with zeros and the first saved record will be number 0, on slot 0.
+void eeprom_find_newest_record (uint8_t ui8_area)
+{
+  struc_eeprom_area *p_area = &eeprom_areas [ui8_area];
+  uint8_t ui8_slot;
+  uint8_t ui8_i;
+  uint8_t ui8_sequence;
+
+  for (ui8_i = 0; ui8_i < p_area->ui8_record_size; ui8_i++) { p_area->p_record [ui8_i] = 0; }
+  p_area->p_record [RECORD_VERSION] = p_area->ui8_version;
+  p_area->p_record [RECORD_SEQUENCE] = 0xff;
+  p_area->ui8_slot = EEPROM_NO_SLOT;
+
+  for (ui8_slot = 0; ui8_slot < p_area->ui8_records_number; ui8_slot++)
   {
-    eeprom_write_array (array_default_values);
-    eeprom_read_values_to_variables ();
+    ui8_sequence = HAL_FLASH_READ_BYTE (eeprom_slot_address (p_area, ui8_slot) + RECORD_SEQUENCE);
+    if ((p_area->ui8_slot != EEPROM_NO_SLOT) &&
+	(((int8_t) (ui8_sequence - p_area->p_record [RECORD_SEQUENCE])) <= 0)) { continue; }
+
+    if (!eeprom_read_slot (ui8_area, ui8_slot, ui8_eeprom_programming_record)) { continue; }
+
+    for (ui8_i = 0; ui8_i < p_area->ui8_record_size; ui8_i++)
+    {
+      p_area->p_record [ui8_i] = ui8_eeprom_programming_record [ui8_i];
+    }
+    p_area->ui8_slot = ui8_slot;
   }
-  else // values on eeprom memory should be ok, now use them
+}
+
+// Read the record on a slot of the area, returns 1 if it is valid (version and CRC). Must not be called
+// while a record is being programmed (eeprom_is_busy ()).
+uint8_t eeprom_read_slot (uint8_t ui8_area, uint8_t ui8_slot, uint8_t *p_record)
+{
+  struc_eeprom_area *p_area = &eeprom_areas [ui8_area];
+  uint16_t ui16_address = eeprom_slot_address (p_area, ui8_slot);
+  uint8_t ui8_i;
+
+  if (HAL_FLASH_READ_BYTE (ui16_address + RECORD_VERSION) != p_area->ui8_version) { return 0; }
+
+  for (ui8_i = 0; ui8_i < p_area->ui8_record_size; ui8_i++)
   {
-    eeprom_read_values_to_variables ();
+    p_record [ui8_i] = HAL_FLASH_READ_BYTE (ui16_address + ui8_i);
   }
+
+  return (eeprom_record_crc (p_record, p_area->ui8_record_size) == p_record [p_area->ui8_record_size - 1]) ? 1: 0;
+}
+
+uint16_t eeprom_slot_address (struc_eeprom_area *p_area, uint8_t ui8_slot)
+{
+  return p_area->ui16_address + (((uint16_t) ui8_slot) * p_area->ui8_record_size);
+}
+
+// CRC-8, polynomial x^8 + x^2 + x + 1, of all the record bytes but the last one, the CRC
+uint8_t eeprom_record_crc (uint8_t *p_record, uint8_t ui8_size)
+{
+  uint8_t ui8_crc = 0;
+  uint8_t ui8_i;
+  uint8_t ui8_bit;
+
+  for (ui8_i = 0; ui8_i < (ui8_size - 1); ui8_i++)
+  {
+    ui8_crc ^= p_record [ui8_i];
+    for (ui8_bit = 0; ui8_bit < 8; ui8_bit++)
+    {
+      if (ui8_crc & 0x80) { ui8_crc = (ui8_crc << 1) ^ 0x07; }
+      else { ui8_crc <<= 1; }
+    }
+  }
+
+  return ui8_crc;
+}
+
+uint8_t *eeprom_get_record (uint8_t ui8_area)
+{
+  return eeprom_areas [ui8_area].p_record;
+}
+
+uint8_t eeprom_record_is_saved (uint8_t ui8_area)
+{
+  return (eeprom_areas [ui8_area].ui8_slot != EEPROM_NO_SLOT) ? 1: 0;
+}
+
+// RAM copy of the record was changed: program a new record
+void eeprom_write_record (uint8_t ui8_area)
+{
+  eeprom_areas [ui8_area].ui8_write_request = 1;
+}
+
+// RAM copy of the record can be changed again only after its programming started
+uint8_t eeprom_record_write_is_pending (uint8_t ui8_area)
+{
+  return eeprom_areas [ui8_area].ui8_write_request;
+}
+
+uint8_t eeprom_is_busy (void)
+{
+  return (ui8_eeprom_state != EEPROM_STATE_IDLE) ? 1: 0;
 }
 
 void eeprom_read_values_to_variables (void)
 {
-  struc_lcd_configuration_variables *p_lcd_configuration_variables = ebike_app_get_lcd_configuration_variables ();
-
-  p_lcd_configuration_variables->ui8_assist_level = FLASH_ReadByte (ADDRESS_ASSIST_LEVEL);
-  p_lcd_configuration_variables->ui8_motor_characteristic = FLASH_ReadByte (ADDRESS_MOTOR_CHARACTARISTIC);
-  p_lcd_configuration_variables->ui8_wheel_size = FLASH_ReadByte (ADDRESS_WHEEL_SIZE);
-  p_lcd_configuration_variables->ui8_max_speed = FLASH_ReadByte (ADDRESS_MAX_SPEED);
-  p_lcd_configuration_variables->ui8_power_assist_control_mode = FLASH_ReadByte (ADDRESS_POWER_ASSIST_CONTROL_MODE);
-  p_lcd_configuration_variables->ui8_controller_max_current = FLASH_ReadByte (ADDRESS_CONTROLLER_MAX_CURRENT);
+  volatile struc_lcd_configuration_variables *p_lcd_configuration_variables = ebike_app_get_lcd_configuration_variables ();
+  uint8_t *p_record = ui8_eeprom_configuration_record;
+
+  p_lcd_configuration_variables->ui8_assist_level = p_record [RECORD_ASSIST_LEVEL];
+  p_lcd_configuration_variables->ui8_motor_characteristic = p_record [RECORD_MOTOR_CHARACTARISTIC];
+  p_lcd_configuration_variables->ui8_wheel_size = p_record [RECORD_WHEEL_SIZE];
+  p_lcd_configuration_variables->ui8_max_speed = p_record [RECORD_MAX_SPEED];
+  p_lcd_configuration_variables->ui8_power_assist_control_mode = p_record [RECORD_POWER_ASSIST_CONTROL_MODE];
+  p_lcd_configuration_variables->ui8_controller_max_current = p_record [RECORD_CONTROLLER_MAX_CURRENT];
+
+  ebike_app_lcd_configuration_changed ();
 }
 
 void eeprom_write_if_values_changed (void)
 {
-  struc_lcd_configuration_variables *p_lcd_configuration_variables = ebike_app_get_lcd_configuration_variables ();
-  static uint8_t array_values [7];
-
-  // see if the values differ from the ones on EEPROM and if so, write all of them to EEPROM
-  if ((p_lcd_configuration_variables->ui8_assist_level != FLASH_ReadByte (ADDRESS_ASSIST_LEVEL)) ||
-      (p_lcd_configuration_variables->ui8_motor_characteristic != FLASH_ReadByte (ADDRESS_MOTOR_CHARACTARISTIC)) ||
-      (p_lcd_configuration_variables->ui8_wheel_size != FLASH_ReadByte (ADDRESS_WHEEL_SIZE)) ||
-      (p_lcd_configuration_variables->ui8_max_speed != FLASH_ReadByte (ADDRESS_MAX_SPEED)) ||
-      (p_lcd_configuration_variables->ui8_power_assist_control_mode != FLASH_ReadByte (ADDRESS_POWER_ASSIST_CONTROL_MODE)) ||
-      (p_lcd_configuration_variables->ui8_controller_max_current != FLASH_ReadByte (ADDRESS_CONTROLLER_MAX_CURRENT)))
+  volatile struc_lcd_configuration_variables *p_lcd_configuration_variables = ebike_app_get_lcd_configuration_variables ();
+
+  // a new record will be programmed only if one of the values differ from the ones on EEPROM
+  eeprom_write_record_value (RECORD_ASSIST_LEVEL, p_lcd_configuration_variables->ui8_assist_level);
+  eeprom_write_record_value (RECORD_MOTOR_CHARACTARISTIC, p_lcd_configuration_variables->ui8_motor_characteristic);
+  eeprom_write_record_value (RECORD_WHEEL_SIZE, p_lcd_configuration_variables->ui8_wheel_size);
+  eeprom_write_record_value (RECORD_MAX_SPEED, p_lcd_configuration_variables->ui8_max_speed);
+  eeprom_write_record_value (RECORD_POWER_ASSIST_CONTROL_MODE, p_lcd_configuration_variables->ui8_power_assist_control_mode);
+  eeprom_write_record_value (RECORD_CONTROLLER_MAX_CURRENT, p_lcd_configuration_variables->ui8_controller_max_current);
+}
+
+void eeprom_write_record_value (uint8_t ui8_index, uint8_t ui8_value)
+{
+  if (ui8_eeprom_configuration_record [ui8_index] != ui8_value)
   {
-    array_values [0] = KEY;
-    array_values [1] = p_lcd_configuration_variables->ui8_assist_level;
-    array_values [2] = p_lcd_configuration_variables->ui8_motor_characteristic;
-    array_values [3] = p_lcd_configuration_variables->ui8_wheel_size;
-    array_values [4] = p_lcd_configuration_variables->ui8_max_speed;
-    array_values [5] = p_lcd_configuration_variables->ui8_power_assist_control_mode;
-    array_values [6] = p_lcd_configuration_variables->ui8_controller_max_current;
-
-    eeprom_write_array (array_values);
+    ui8_eeprom_configuration_record [ui8_index] = ui8_value;
+    eeprom_write_record (EEPROM_AREA_CONFIGURATION);
   }
 }
 
-void eeprom_write_array (uint8_t *array_values)
+// Called on every main loop pass, never waits: each call does at most one step of the programming.
+// Word programming (4 bytes) takes ~6ms during which the CPU keeps running from flash (read while write).
+// The first word, with version and sequence number, is programmed last: if power is lost before the
+// record is complete, the slot still has the old sequence number and a wrong CRC and is not used.
+void eeprom_controller (void)
 {
   uint8_t ui8_i;
+  uint8_t *p_word;
+  struc_eeprom_area *p_area;
 
-  FLASH_SetProgrammingTime (FLASH_PROGRAMTIME_STANDARD);
-  FLASH_Unlock (FLASH_MEMTYPE_DATA);
-  while (!FLASH_GetFlagStatus (FLASH_FLAG_DUL)) ;
-
-  for (ui8_i = 0; ui8_i < 7; ui8_i++)
+  switch (ui8_eeprom_state)
   {
-    FLASH_ProgramByte (EEPROM_BASE_ADDRESS + ui8_i, *array_values++);
-    while (!FLASH_GetFlagStatus (FLASH_FLAG_EOP)) ;
+    case EEPROM_STATE_IDLE:
+    for (ui8_i = 0; ui8_i < EEPROM_AREAS_NUMBER; ui8_i++)
+    {
+      if (eeprom_areas [ui8_i].ui8_write_request) { break; }
+    }
+    if (ui8_i < EEPROM_AREAS_NUMBER)
+    {
+      p_area = &eeprom_areas [ui8_i];
+      p_area->ui8_write_request = 0;
+
+      // new record on the next slot; RAM copy can change while it is being programmed
+      p_area->p_record [RECORD_SEQUENCE]++;
+      p_area->p_record [p_area->ui8_record_size - 1] = eeprom_record_crc (p_area->p_record, p_area->ui8_record_size);
+      for (ui8_i = 0; ui8_i < p_area->ui8_record_size; ui8_i++)
+      {
+	ui8_eeprom_programming_record [ui8_i] = p_area->p_record [ui8_i];
+      }
+      p_area->ui8_slot++; // EEPROM_NO_SLOT + 1 = slot 0
+      if (p_area->ui8_slot >= p_area->ui8_records_number) { p_area->ui8_slot = 0; }
+      p_eeprom_programming_area = p_area;
+      ui8_eeprom_programming_word = (p_area->ui8_record_size >> 2) - 1;
+
+      FLASH_Unlock (FLASH_MEMTYPE_DATA);
+      ui8_eeprom_state = EEPROM_STATE_UNLOCK;
+    }
+    break;
+
+    case EEPROM_STATE_UNLOCK:
+    if (HAL_FLASH_DATA_UNLOCKED ()) { ui8_eeprom_state = EEPROM_STATE_PROGRAM; }
+    break;
+
+    case EEPROM_STATE_PROGRAM:
+    p_word = &ui8_eeprom_programming_record [ui8_eeprom_programming_word << 2];
+    FLASH_ProgramWord (eeprom_slot_address (p_eeprom_programming_area, p_eeprom_programming_area->ui8_slot) +
+	(ui8_eeprom_programming_word << 2),
+	(((uint32_t) p_word [0]) << 24) | (((uint32_t) p_word [1]) << 16) | (((uint32_t) p_word [2]) << 8) | ((uint32_t) p_word [3]));
+    ui8_eeprom_state = EEPROM_STATE_WAIT_END_OF_PROGRAMMING;
+    break;
+
+    case EEPROM_STATE_WAIT_END_OF_PROGRAMMING:
+    if (HAL_FLASH_END_OF_PROGRAMMING ())
+    {
+      if (ui8_eeprom_programming_word)
+      {
+	ui8_eeprom_programming_word--;
+	ui8_eeprom_state = EEPROM_STATE_PROGRAM;
+      }
+      else
+      {
+	FLASH_Lock (FLASH_MEMTYPE_DATA);
+	ui8_eeprom_state = EEPROM_STATE_IDLE;
+      }
+    }
+    break;
+
+    default:
+    ui8_eeprom_state = EEPROM_STATE_IDLE;
+    break;
   }
-  FLASH_Lock (FLASH_MEMTYPE_DATA);
 }
@@ -11,9 +11,72 @@
 
 #include "main.h"
 
-#define KEY 0xca
-
 #define EEPROM_BASE_ADDRESS 			0x4000
+#define EEPROM_SIZE				1024
+
+// Data EEPROM is split in areas of records. A record has version, sequence number, data and CRC; each save
+// goes to the next slot of the area, so writes are spread over all the area, and at boot the newest valid
+// record of each area is used.
+#define EEPROM_AREA_CONFIGURATION		0
+#define EEPROM_AREA_STATISTICS			1
+#define EEPROM_AREA_FAULT_LOG			2
+#define EEPROM_AREAS_NUMBER			3
+
+#define EEPROM_CONFIGURATION_ADDRESS		EEPROM_BASE_ADDRESS // 0x4000 - 0x41ff
+#define EEPROM_CONFIGURATION_RECORD_SIZE	16 // bytes, multiple of 4 (word)
+#define EEPROM_CONFIGURATION_RECORDS_NUMBER	32
+#define EEPROM_CONFIGURATION_VERSION		1
+
+#define EEPROM_STATISTICS_ADDRESS		(EEPROM_BASE_ADDRESS + 0x200) // 0x4200 - 0x42ff
+#define EEPROM_STATISTICS_RECORD_SIZE		32
+#define EEPROM_STATISTICS_RECORDS_NUMBER	8
+#define EEPROM_STATISTICS_VERSION		2
+
+// every fault is a new record: the area is a ring with the last 16 faults
+#define EEPROM_FAULT_LOG_ADDRESS		(EEPROM_BASE_ADDRESS + 0x300) // 0x4300 - 0x43ff
+#define EEPROM_FAULT_LOG_RECORD_SIZE		16
+#define EEPROM_FAULT_LOG_RECORDS_NUMBER		16
+#define EEPROM_FAULT_LOG_VERSION		3
+
+#define EEPROM_RECORD_SIZE_MAX			32
+
+// record bytes, CRC is the last byte
+#define RECORD_VERSION				0
+#define RECORD_SEQUENCE				1
+#define RECORD_DATA				2
+
+// configuration record data
+#define RECORD_ASSIST_LEVEL			2
+#define RECORD_MOTOR_CHARACTARISTIC		3
+#define RECORD_WHEEL_SIZE			4
+#define RECORD_MAX_SPEED			5
+#define RECORD_POWER_ASSIST_CONTROL_MODE	6
+#define RECORD_CONTROLLER_MAX_CURRENT		7
+
+// statistics record data, big endian
+#define RECORD_STATISTICS_DISTANCE		2 // meters, 4 bytes
+#define RECORD_STATISTICS_ENERGY_OUT		6 // mWh from the battery, 4 bytes
+#define RECORD_STATISTICS_ENERGY_IN		10 // mWh back to the battery (regen), 4 bytes
+#define RECORD_STATISTICS_CHARGE_OUT		14 // mAh from the battery, 4 bytes
+#define RECORD_STATISTICS_MOTOR_ON_TIME		18 // seconds, 4 bytes
+#define RECORD_STATISTICS_MAX_SPEED		22 // km/h * 10, 2 bytes
+#define RECORD_STATISTICS_BATTERY_USED		24 // mAh used since the battery was full, 2 bytes
+#define RECORD_STATISTICS_DATA_SIZE		24 // bytes, from RECORD_STATISTICS_DISTANCE
+
+// fault log record data, big endian, values at the moment of the fault
+#define RECORD_FAULT_CODE			2 // FAULT_LOG_*
+#define RECORD_FAULT_UPTIME			3 // 100ms since power on, 4 bytes
+#define RECORD_FAULT_MOTOR_SPEED_ERPS		7 // 2 bytes
+#define RECORD_FAULT_DUTY_CYCLE			9
+#define RECORD_FAULT_MOTOR_CURRENT		10 // motor total current 8 bits ADC minus offset, signed, 0.5A per step
+#define RECORD_FAULT_BATTERY_VOLTAGE		11 // 8 bits ADC
+#define RECORD_FAULT_COMMUTATION_TYPE		12
+#define RECORD_FAULT_MOTOR_STATE		13
+#define RECORD_FAULT_CONTROLLER_STATE		14
+#define RECORD_FAULT_DATA_SIZE			13 // bytes, from RECORD_FAULT_CODE
+
+// old format, 7 bytes at EEPROM_BASE_ADDRESS: migrated to a configuration record at first boot
+#define KEY 0xca
 #define ADDRESS_KEY 				EEPROM_BASE_ADDRESS
 #define ADDRESS_ASSIST_LEVEL 			1 + EEPROM_BASE_ADDRESS
 #define ADDRESS_MOTOR_CHARACTARISTIC 		2 + EEPROM_BASE_ADDRESS
@@ -22,7 +85,32 @@
 #define ADDRESS_POWER_ASSIST_CONTROL_MODE 	5 + EEPROM_BASE_ADDRESS
 #define ADDRESS_CONTROLLER_MAX_CURRENT		6 + EEPROM_BASE_ADDRESS
 
+#define EEPROM_STATE_IDLE			0
+#define EEPROM_STATE_UNLOCK			1
+#define EEPROM_STATE_PROGRAM			2
+#define EEPROM_STATE_WAIT_END_OF_PROGRAMMING	3
+
+#define EEPROM_NO_SLOT				0xff
+
+typedef struct _eeprom_area
+{
+  uint16_t ui16_address; // first slot
+  uint8_t ui8_records_number;
+  uint8_t ui8_record_size;
+  uint8_t ui8_version;
+  uint8_t *p_record; // RAM copy of the newest record
+  uint8_t ui8_slot; // slot of the newest record, EEPROM_NO_SLOT if none was saved yet
+  uint8_t ui8_write_request;
+} struc_eeprom_area;
+
 void eeprom_init (void);
 void eeprom_write_if_values_changed (void);
+void eeprom_controller (void);
+uint8_t *eeprom_get_record (uint8_t ui8_area);
+uint8_t eeprom_record_is_saved (uint8_t ui8_area);
+void eeprom_write_record (uint8_t ui8_area);
+uint8_t eeprom_record_write_is_pending (uint8_t ui8_area);
+uint8_t eeprom_is_busy (void);
+uint8_t eeprom_read_slot (uint8_t ui8_area, uint8_t ui8_slot, uint8_t *p_record);
 
 #endif /* _EEPROM_H_ */
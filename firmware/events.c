@@ -0,0 +1,53 @@
+/*
+ * BMSBattery S series motor controllers firmware
+ *
+ * Copyright (C) Casainho, 2017.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+#include <stdint.h>
+#include "stm8s.h"
+#include "events.h"
+#include "uart.h"
+
+struc_events_queue events_queue [EVENTS_SOURCES_NUMBER];
+
+uint8_t ui8_events_counter [EVENTS_NUMBER]; // events read by the main loop, for each event
+
+uint8_t events_get (void)
+{
+  struc_events_queue *p_queue;
+  uint8_t ui8_source;
+  uint8_t ui8_event;
+
+  for (ui8_source = 0; ui8_source < EVENTS_SOURCES_NUMBER; ui8_source++)
+  {
+    p_queue = &events_queue [ui8_source];
+    if (p_queue->ui8_tail != p_queue->ui8_head)
+    {
+      ui8_event = p_queue->ui8_event [p_queue->ui8_tail & (EVENTS_QUEUE_SIZE - 1)];
+      p_queue->ui8_tail++; // only after the event is read: the interrupt can write this position again
+
+      if ((ui8_event < EVENTS_NUMBER) && (ui8_events_counter [ui8_event] < 255)) { ui8_events_counter [ui8_event]++; }
+      return ui8_event;
+    }
+  }
+
+  return EVENT_NONE;
+}
+
+// answer to UART_COMMAND_READ_EVENTS: events read by the main loop, for each event from EVENT_OVER_CURRENT,
+// then the events lost because the queue was full, for each source
+void events_send (void)
+{
+  uint8_t ui8_data [(EVENTS_NUMBER - 1) + EVENTS_SOURCES_NUMBER];
+  uint8_t ui8_i;
+
+  for (ui8_i = 1; ui8_i < EVENTS_NUMBER; ui8_i++) { ui8_data [ui8_i - 1] = ui8_events_counter [ui8_i]; }
+  for (ui8_i = 0; ui8_i < EVENTS_SOURCES_NUMBER; ui8_i++)
+  {
+    ui8_data [(EVENTS_NUMBER - 1) + ui8_i] = events_queue [ui8_i].ui8_overflows;
+  }
+  uart_send_package (UART_COMMAND_READ_EVENTS, ui8_data, sizeof (ui8_data));
+}
@@ -0,0 +1,60 @@
+/*
+ * BMSBattery S series motor controllers firmware
+ *
+ * Copyright (C) Casainho, 2017.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+#ifndef _EVENTS_H_
+#define _EVENTS_H_
+
+#include "main.h"
+
+// Events detected by the interrupts, handled by the main loop (ebike_app_events_controller ()). Each interrupt
+// has its own queue: only that interrupt writes ui8_head and only the main loop writes ui8_tail, so the queues
+// need no interrupts disabling, even if an interrupt preempts another one. Queues are read by source order:
+// the first source has the higher priority.
+#define EVENTS_SOURCE_OVER_CURRENT		0 // EXTI_PORTD_IRQHandler ()
+#define EVENTS_SOURCE_BRAKE			1 // EXTI_PORTA_IRQHandler ()
+#define EVENTS_SOURCE_PWM_CYCLE			2 // TIM1_UPD_OVF_TRG_BRK_IRQHandler ()
+#define EVENTS_SOURCES_NUMBER			3
+
+#define EVENT_NONE				0
+#define EVENT_OVER_CURRENT			1
+#define EVENT_BRAKE_SET				2
+#define EVENT_HALL_SENSORS_ERROR		3 // hall sensors state 0 or 7
+#define EVENT_MOTOR_STOPPED			4 // no hall sensors transitions for PWM_CYCLES_COUNTER_MAX
+#define EVENTS_NUMBER				5
+
+#define EVENTS_QUEUE_SIZE			4 // must be a power of 2
+
+typedef struct _events_queue
+{
+  volatile uint8_t ui8_head; // events written, only the interrupt changes it
+  volatile uint8_t ui8_tail; // events read, only the main loop changes it
+  volatile uint8_t ui8_overflows; // events lost because the queue was full
+  volatile uint8_t ui8_event [EVENTS_QUEUE_SIZE];
+} struc_events_queue;
+
+extern struc_events_queue events_queue [EVENTS_SOURCES_NUMBER];
+
+// Post an event from an interrupt: inline code, as function calls from interrupts are not reliable with SDCC.
+// The event is written before ui8_head is incremented, so the main loop never reads a position not yet written
+#define EVENTS_POST_FROM_INTERRUPT(source, event) \
+{ \
+  if (((uint8_t) (events_queue [source].ui8_head - events_queue [source].ui8_tail)) >= EVENTS_QUEUE_SIZE) \
+  { \
+    if (events_queue [source].ui8_overflows < 255) { events_queue [source].ui8_overflows++; } \
+  } \
+  else \
+  { \
+    events_queue [source].ui8_event [events_queue [source].ui8_head & (EVENTS_QUEUE_SIZE - 1)] = (event); \
+    events_queue [source].ui8_head++; \
+  } \
+}
+
+uint8_t events_get (void); // call only from the main loop, EVENT_NONE when all queues are empty
+void events_send (void);
+
+#endif /* _EVENTS_H_ */
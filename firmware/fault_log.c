@@ -0,0 +1,132 @@
+/*
+ * BMSBattery S series motor controllers firmware
+ *
+ * Copyright (C) Casainho, 2017.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+#include <stdint.h>
+#include "stm8s.h"
+#include "fault_log.h"
+#include "eeprom.h"
+#include "motor.h"
+#include "adc.h"
+#include "uart.h"
+#include "utils.h"
+#include "timers.h"
+
+uint32_t ui32_fault_log_uptime_100ms = 0;
+
+// faults are saved on EEPROM from the main loop, one at a time: they wait here
+uint8_t ui8_fault_log_queue [FAULT_LOG_QUEUE_SIZE][RECORD_FAULT_DATA_SIZE];
+uint8_t ui8_fault_log_queue_head = 0;
+uint8_t ui8_fault_log_queue_tail = 0;
+
+// fault from an interrupt, FAULT_LOG_ADD_FROM_INTERRUPT (): has its own entry, moved to the queue by
+// fault_log_controller ()
+uint8_t ui8_fault_log_interrupt_entry [RECORD_FAULT_DATA_SIZE];
+volatile uint8_t ui8_fault_log_interrupt_entry_full = 0;
+
+uint8_t ui8_fault_log_lost = 0; // faults not saved because the queue was full
+uint8_t ui8_fault_log_send_slot = 0; // next slot to send, see fault_log_send ()
+
+void fault_log_capture (uint8_t ui8_code, uint8_t *p_entry);
+void fault_log_queue_put (uint8_t *p_entry);
+
+// save the motor controller state at the moment of the fault; call only from the main loop
+void fault_log_add (uint8_t ui8_code)
+{
+  uint8_t ui8_entry [RECORD_FAULT_DATA_SIZE];
+
+  fault_log_capture (ui8_code, ui8_entry);
+  fault_log_queue_put (ui8_entry);
+}
+
+void fault_log_capture (uint8_t ui8_code, uint8_t *p_entry)
+{
+  p_entry [RECORD_FAULT_CODE - RECORD_FAULT_CODE] = ui8_code;
+  ui32_to_bytes (ui32_fault_log_uptime_100ms, &p_entry [RECORD_FAULT_UPTIME - RECORD_FAULT_CODE]);
+  ui16_to_bytes (ui16_motor_get_motor_speed_erps (), &p_entry [RECORD_FAULT_MOTOR_SPEED_ERPS - RECORD_FAULT_CODE]);
+  p_entry [RECORD_FAULT_DUTY_CYCLE - RECORD_FAULT_CODE] = motor_pwm_cycle.ui8_duty_cycle;
+  p_entry [RECORD_FAULT_MOTOR_CURRENT - RECORD_FAULT_CODE] = (uint8_t) (UI8_ADC_MOTOR_TOTAL_CURRENT - motor_pwm_cycle.ui8_motor_total_current_offset);
+  p_entry [RECORD_FAULT_BATTERY_VOLTAGE - RECORD_FAULT_CODE] = UI8_ADC_BATTERY_VOLTAGE;
+  p_entry [RECORD_FAULT_COMMUTATION_TYPE - RECORD_FAULT_CODE] = motor_pwm_cycle.ui8_motor_commutation_type;
+  p_entry [RECORD_FAULT_MOTOR_STATE - RECORD_FAULT_CODE] = motor_pwm_cycle.ui8_motor_state;
+  p_entry [RECORD_FAULT_CONTROLLER_STATE - RECORD_FAULT_CODE] = motor_pwm_cycle.ui8_motor_controller_state;
+}
+
+void fault_log_queue_put (uint8_t *p_entry)
+{
+  uint8_t ui8_next = (ui8_fault_log_queue_head + 1) % FAULT_LOG_QUEUE_SIZE;
+  uint8_t ui8_i;
+
+  if (ui8_next == ui8_fault_log_queue_tail)
+  {
+    if (ui8_fault_log_lost < 255) { ui8_fault_log_lost++; }
+    return;
+  }
+
+  for (ui8_i = 0; ui8_i < RECORD_FAULT_DATA_SIZE; ui8_i++)
+  {
+    ui8_fault_log_queue [ui8_fault_log_queue_head][ui8_i] = p_entry [ui8_i];
+  }
+  ui8_fault_log_queue_head = ui8_next;
+}
+
+// call every 100ms
+void fault_log_controller (void)
+{
+  uint8_t *p_record;
+  uint8_t ui8_i;
+
+  ui32_fault_log_uptime_100ms = ui32_system_time_get_ms () / 100;
+
+  // uptime is set here, the interrupt could read it while it is being updated
+  if (ui8_fault_log_interrupt_entry_full)
+  {
+    ui32_to_bytes (ui32_fault_log_uptime_100ms, &ui8_fault_log_interrupt_entry [RECORD_FAULT_UPTIME - RECORD_FAULT_CODE]);
+    fault_log_queue_put (ui8_fault_log_interrupt_entry);
+    ui8_fault_log_interrupt_entry_full = 0;
+  }
+
+  // the EEPROM record is copied when its programming starts, after that it can take the next fault
+  if ((ui8_fault_log_queue_tail != ui8_fault_log_queue_head) &&
+      (!eeprom_record_write_is_pending (EEPROM_AREA_FAULT_LOG)))
+  {
+    p_record = eeprom_get_record (EEPROM_AREA_FAULT_LOG);
+    for (ui8_i = 0; ui8_i < RECORD_FAULT_DATA_SIZE; ui8_i++)
+    {
+      p_record [RECORD_FAULT_CODE + ui8_i] = ui8_fault_log_queue [ui8_fault_log_queue_tail][ui8_i];
+    }
+    eeprom_write_record (EEPROM_AREA_FAULT_LOG);
+    ui8_fault_log_queue_tail = (ui8_fault_log_queue_tail + 1) % FAULT_LOG_QUEUE_SIZE;
+  }
+}
+
+// answer to UART_COMMAND_READ_FAULT_LOG: one package for each saved fault, with the sequence number and
+// the record data, on slot order; a last package with the number of lost faults and the number of over current
+// retries since power up (2 bytes).
+// UART sending waits for each byte: only one package (~19ms at 9600 baud) each call, so the main loop tasks
+// keep running. Call again up to it returns 1, after the last package.
+// EEPROM can't be read while a record is being programmed, see eeprom_is_busy ().
+uint8_t fault_log_send (void)
+{
+  uint8_t ui8_record [EEPROM_FAULT_LOG_RECORD_SIZE];
+  uint8_t ui8_last [3];
+
+  while (ui8_fault_log_send_slot < EEPROM_FAULT_LOG_RECORDS_NUMBER)
+  {
+    if (eeprom_read_slot (EEPROM_AREA_FAULT_LOG, ui8_fault_log_send_slot++, ui8_record))
+    {
+      uart_send_package (UART_COMMAND_READ_FAULT_LOG, &ui8_record [RECORD_SEQUENCE], 1 + RECORD_FAULT_DATA_SIZE);
+      return 0;
+    }
+  }
+
+  ui8_last [0] = ui8_fault_log_lost;
+  ui16_to_bytes (ui16_motor_get_over_current_retries (), &ui8_last [1]);
+  uart_send_package (UART_COMMAND_READ_FAULT_LOG, ui8_last, 3);
+  ui8_fault_log_send_slot = 0;
+  return 1;
+}
@@ -0,0 +1,56 @@
+/*
+ * BMSBattery S series motor controllers firmware
+ *
+ * Copyright (C) Casainho, 2017.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+#ifndef _FAULT_LOG_H_
+#define _FAULT_LOG_H_
+
+#include "main.h"
+#include "eeprom.h"
+
+// fault codes
+#define FAULT_LOG_OVER_CURRENT			1
+#define FAULT_LOG_UNDER_VOLTAGE			2
+#define FAULT_LOG_MOTOR_BLOCKED			3
+#define FAULT_LOG_OVER_CURRENT_LATCHED		4 // too many over current faults, no more retries
+
+#define FAULT_LOG_QUEUE_SIZE			4 // faults waiting to be saved on EEPROM
+
+extern uint8_t ui8_fault_log_interrupt_entry [RECORD_FAULT_DATA_SIZE];
+extern volatile uint8_t ui8_fault_log_interrupt_entry_full;
+extern uint8_t ui8_fault_log_lost;
+
+// Save the motor controller state from an interrupt, same record as fault_log_add (): inline code, as function
+// calls from interrupts are not reliable with SDCC. Needs motor.h and adc.h. Only for the interrupts at the level
+// of the PWM cycle one, that can't stop them in the middle of ui16_motor_speed_erps. The uptime is written by
+// fault_log_controller (); a second fault before the first is moved to the queue is lost
+#define FAULT_LOG_ADD_FROM_INTERRUPT(code) \
+{ \
+  if (ui8_fault_log_interrupt_entry_full) \
+  { \
+    if (ui8_fault_log_lost < 255) { ui8_fault_log_lost++; } \
+  } \
+  else \
+  { \
+    ui8_fault_log_interrupt_entry [RECORD_FAULT_CODE - RECORD_FAULT_CODE] = (code); \
+    ui8_fault_log_interrupt_entry [RECORD_FAULT_MOTOR_SPEED_ERPS - RECORD_FAULT_CODE] = (uint8_t) (motor_pwm_cycle.ui16_motor_speed_erps >> 8); \
+    ui8_fault_log_interrupt_entry [RECORD_FAULT_MOTOR_SPEED_ERPS + 1 - RECORD_FAULT_CODE] = (uint8_t) motor_pwm_cycle.ui16_motor_speed_erps; \
+    ui8_fault_log_interrupt_entry [RECORD_FAULT_DUTY_CYCLE - RECORD_FAULT_CODE] = motor_pwm_cycle.ui8_duty_cycle; \
+    ui8_fault_log_interrupt_entry [RECORD_FAULT_MOTOR_CURRENT - RECORD_FAULT_CODE] = (uint8_t) (UI8_ADC_MOTOR_TOTAL_CURRENT - motor_pwm_cycle.ui8_motor_total_current_offset); \
+    ui8_fault_log_interrupt_entry [RECORD_FAULT_BATTERY_VOLTAGE - RECORD_FAULT_CODE] = UI8_ADC_BATTERY_VOLTAGE; \
+    ui8_fault_log_interrupt_entry [RECORD_FAULT_COMMUTATION_TYPE - RECORD_FAULT_CODE] = motor_pwm_cycle.ui8_motor_commutation_type; \
+    ui8_fault_log_interrupt_entry [RECORD_FAULT_MOTOR_STATE - RECORD_FAULT_CODE] = motor_pwm_cycle.ui8_motor_state; \
+    ui8_fault_log_interrupt_entry [RECORD_FAULT_CONTROLLER_STATE - RECORD_FAULT_CODE] = motor_pwm_cycle.ui8_motor_controller_state; \
+    ui8_fault_log_interrupt_entry_full = 1; \
+  } \
+}
+
+void fault_log_add (uint8_t ui8_code);
+void fault_log_controller (void);
+uint8_t fault_log_send (void); // 1 when all the packages were sent
+
+#endif /* _FAULT_LOG_H_ */
@@ -9,6 +9,7 @@
 #include "stm8s.h"
 #include "stm8s_gpio.h"
 #include "gpio.h"
+#include "hal.h"
 
 void gpio_init (void)
 {
@@ -24,12 +25,12 @@ void debug_pin_init (void)
 
 void debug_pin_set (void)
 {
-  GPIO_WriteHigh(DEBUG__PORT, DEBUG__PIN);
+  HAL_GPIO_WRITE_HIGH (DEBUG__PORT, DEBUG__PIN);
 }
 
 void debug_pin_reset (void)
 {
-  GPIO_WriteLow(DEBUG__PORT, DEBUG__PIN);
+  HAL_GPIO_WRITE_LOW (DEBUG__PORT, DEBUG__PIN);
 }
 
 
@@ -19,6 +19,7 @@
  * PB6  (ADC_AIN6)    | in  | motor_total_current
  * PE7  (ADC_AIN8)    | in  | motor_total_current_filtered
  * PD7                | in  | motor_total_over_current
+ * PE3  (TIM1_BKIN)   | in  | motor_total_over_current (optional, same signal as PD7)
  *
  * PE6  (ADC_AIN9)    | in  | battery_voltage
  *
@@ -38,6 +39,7 @@
  *
  * PA4                | in  | brake
  * PB4  (ADC_AIN4)    | in  | throttle
+ * PB3  (ADC_AIN3)    | in  | motor_temperature (optional)
  * PD0                | in  | PAS
  * PC5                | in  | wheel speed
  *
@@ -58,6 +60,8 @@
 #define CURRENT_MOTOR_TOTAL_FILTRED__PORT GPIOE
 #define CURRENT_MOTOR_TOTAL_OVER__PIN  GPIO_PIN_7
 #define CURRENT_MOTOR_TOTAL_OVER__PORT GPIOD
+#define CURRENT_MOTOR_TOTAL_OVER_BREAK__PIN  GPIO_PIN_3
+#define CURRENT_MOTOR_TOTAL_OVER_BREAK__PORT GPIOE
 
 #define BATTERY_VOLTAGE__PIN      GPIO_PIN_6
 #define BATTERY_VOLTAGE__PORT     GPIOE
@@ -96,6 +100,9 @@
 #define THROTTLE__PIN             GPIO_PIN_4
 #define THROTTLE__PORT            GPIOB
 
+#define MOTOR_TEMPERATURE__PIN    GPIO_PIN_3
+#define MOTOR_TEMPERATURE__PORT   GPIOB
+
 #define PAS__PIN                  GPIO_PIN_0
 #define PAS__PORT                 GPIOD
 
@@ -0,0 +1,61 @@
+/*
+ * BMSBattery S series motor controllers firmware
+ *
+ * Copyright (C) Casainho, 2017.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+#ifndef _HAL_H_
+#define _HAL_H_
+
+#include "stm8s.h"
+
+// Direct register access for the interrupts and the main loop. StdPeriphLib functions cost a call, the
+// parameters checks and a return on each use: they are kept only for the one time initializations.
+// The host simulator (sim/sim_stm8s.h) defines the ones that can't work on plain memory before this file.
+
+// GPIO
+#define HAL_GPIO_READ_INPUT_PIN(port, pin)	((port)->IDR & (uint8_t) (pin))
+#define HAL_GPIO_WRITE_HIGH(port, pin)		((port)->ODR |= (uint8_t) (pin))
+#define HAL_GPIO_WRITE_LOW(port, pin)		((port)->ODR &= (uint8_t) (~(pin)))
+
+// UART2
+#define HAL_UART2_RX_NOT_EMPTY()		(UART2->SR & UART2_SR_RXNE)
+#define HAL_UART2_TX_EMPTY()			(UART2->SR & UART2_SR_TXE)
+#define HAL_UART2_RECEIVE_DATA8()		(UART2->DR)
+#ifndef HAL_UART2_SEND_DATA8
+#define HAL_UART2_SEND_DATA8(data)		(UART2->DR = (uint8_t) (data))
+#endif
+#define HAL_UART2_RX_INTERRUPT_ENABLE()	(UART2->CR2 |= UART2_CR2_RIEN)
+#define HAL_UART2_RX_INTERRUPT_DISABLE()	(UART2->CR2 &= (uint8_t) (~UART2_CR2_RIEN))
+
+// TIM1
+#define HAL_TIM1_OUTPUTS_ENABLE()		(TIM1->BKR |= TIM1_BKR_MOE)
+#define HAL_TIM1_OUTPUTS_DISABLE()		(TIM1->BKR &= (uint8_t) (~TIM1_BKR_MOE))
+#define HAL_TIM1_CLEAR_UPDATE_FLAG()		(TIM1->SR1 = (uint8_t) (~TIM1_SR1_UIF)) // flags are cleared writing 0
+#define HAL_TIM1_CLEAR_BREAK_FLAG()		(TIM1->SR1 = (uint8_t) (~TIM1_SR1_BIF))
+
+// TIM4
+#define HAL_TIM4_CLEAR_UPDATE_FLAG()		(TIM4->SR1 = (uint8_t) (~TIM4_SR1_UIF))
+#define HAL_TIM4_IS_ENABLED()			(TIM4->CR1 & TIM4_CR1_CEN)
+#define HAL_TIM4_DISABLE()			(TIM4->CR1 &= (uint8_t) (~TIM4_CR1_CEN))
+#define HAL_TIM4_ENABLE_FROM_ZERO()		{ TIM4->CNTR = 0; TIM4->CR1 |= TIM4_CR1_CEN; }
+
+// IWDG: a new reload value is only used from the next refresh, done here
+#define HAL_IWDG_SET_RELOAD(value)		{ IWDG->KR = (uint8_t) IWDG_WriteAccess_Enable; IWDG->RLR = (uint8_t) (value); IWDG->KR = IWDG_KEY_REFRESH; }
+
+// ADC1: scan conversion up to channel 9, results on the data buffer registers
+#define HAL_ADC1_START_CONVERSION()		{ ADC1->CSR &= 0x09; ADC1->CR1 |= ADC1_CR1_ADON; } // clear EOC flag first
+#ifndef HAL_ADC1_END_OF_CONVERSION
+#define HAL_ADC1_END_OF_CONVERSION()		(ADC1->CSR & ADC1_CSR_EOC)
+#endif
+
+// FLASH: data EEPROM
+#ifndef HAL_FLASH_READ_BYTE
+#define HAL_FLASH_READ_BYTE(address)		(*((PointerAttr uint8_t *) (MemoryAddressCast) (address)))
+#endif
+#define HAL_FLASH_DATA_UNLOCKED()		(FLASH->IAPSR & FLASH_IAPSR_DUL)
+#define HAL_FLASH_END_OF_PROGRAMMING()	(FLASH->IAPSR & FLASH_IAPSR_EOP)
+
+#endif /* _HAL_H_ */
@@ -0,0 +1,21 @@
+/*
+ * BMSBattery S series motor controllers firmware
+ *
+ * Copyright (C) Casainho, 2017.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+#include <stdint.h>
+#include "stm8s.h"
+#include "stm8s_itc.h"
+#include "interrupts.h"
+
+void interrupts_init (void)
+{
+  ITC_SetSoftwarePriority (ITC_IRQ_TIM1_OVF, INTERRUPTS_PRIORITY_PWM_CYCLE);
+  ITC_SetSoftwarePriority (ITC_IRQ_PORTD, INTERRUPTS_PRIORITY_OVER_CURRENT);
+  ITC_SetSoftwarePriority (ITC_IRQ_PORTA, INTERRUPTS_PRIORITY_BRAKE);
+  ITC_SetSoftwarePriority (ITC_IRQ_UART2_RX, INTERRUPTS_PRIORITY_UART2);
+  ITC_SetSoftwarePriority (ITC_IRQ_TIM4_OVF, INTERRUPTS_PRIORITY_TICK);
+}
@@ -17,5 +17,26 @@
 #define TIM2_UPD_OVF_TRG_BRK_IRQHANDLER 13
 #define UART2_IRQHANDLER 21
 #define ADC1_IRQHANDLER 22
+#define TIM4_UPD_OVF_IRQHANDLER 23
+
+// ITC software priorities: the PWM cycle interrupt has the highest level and preempts the brake and UART2 ones,
+// so its start and the TIM1 compare registers writes don't depend on the LCD communications or on the brake.
+// Over current is on the same level as the PWM cycle: it is never stopped before the bridge outputs are
+// disabled and it only delays the PWM cycle interrupt on a fault. Rules for the state shared by the interrupts,
+// as the brake and UART2 ones can now stop in the middle for the PWM cycle one:
+// - one byte written by an interrupt and read by another one: plain variable, the access is atomic
+// - more than one byte from the PWM cycle interrupt: motor_snapshot_read (), never the motor_pwm_cycle fields
+// - read-modify-write only of the variables and registers the PWM cycle interrupt doesn't write
+//   (ui8_motor_controller_state, TIM1->BKR). When the over current interrupt also writes them, the brake
+//   interrupt and the main loop do it with interrupts disabled or with one bset/bres instruction
+//   (HAL_TIM1_OUTPUTS_ENABLE ())
+// - events: one queue for each interrupt, see events.h
+#define INTERRUPTS_PRIORITY_PWM_CYCLE ITC_PRIORITYLEVEL_3
+#define INTERRUPTS_PRIORITY_OVER_CURRENT ITC_PRIORITYLEVEL_3
+#define INTERRUPTS_PRIORITY_BRAKE ITC_PRIORITYLEVEL_2
+#define INTERRUPTS_PRIORITY_UART2 ITC_PRIORITYLEVEL_1
+#define INTERRUPTS_PRIORITY_TICK ITC_PRIORITYLEVEL_1 // main loop tick, only wakes up the main loop
+
+void interrupts_init (void); // before enableInterrupts (), priorities can only be changed with interrupts disabled
 
 #endif
@@ -13,7 +13,6 @@
 #include "stm8s_itc.h"
 #include "stm8s_gpio.h"
 #include "interrupts.h"
-#include "stm8s_tim2.h"
 #include "watchdog.h"
 #include "uart.h"
 #include "adc.h"
@@ -24,15 +23,12 @@
 #include "config.h"
 #include "ebike_app.h"
 #include "eeprom.h"
+#include "statistics.h"
+#include "battery.h"
 #include "motor.h"
 #include "pas.h"
 #include "wheel_speed_sensor.h"
 
-uint16_t ui16_TIM2_counter = 0;
-uint16_t ui16_motor_controller_counter = 0;
-uint16_t ui16_ebike_app_controller_counter = 0;
-uint16_t ui16_communications_controller_counter = 0;
-
 /////////////////////////////////////////////////////////////////////////////////////////////
 //// Functions prototypes
 
@@ -68,6 +64,9 @@ void TIM1_UPD_OVF_TRG_BRK_IRQHandler(void) __interrupt(TIM1_UPD_OVF_TRG_BRK_IRQH
 // UART2 Receive interrupt
 void UART2_IRQHandler(void) __interrupt(UART2_IRQHANDLER);
 
+// Timer4 main loop tick interrupt
+void TIM4_UPD_OVF_IRQHandler(void) __interrupt(TIM4_UPD_OVF_IRQHANDLER);
+
 /////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -76,44 +75,61 @@ int main (void)
   //set clock at the max 16MHz
   CLK_HSIPrescalerConfig (CLK_PRESCALER_HSIDIV1);
 
+  motor_pwm_cycle_init ();
   gpio_init ();
   brake_init ();
   while (brake_is_set()) ; // hold here while brake is pressed -- this is a protection for development
   debug_pin_init ();
   timer2_init ();
+  timer4_init ();
   uart_init ();
   pwm_init_bipolar_4q ();
   hall_sensor_init ();
   adc_init ();
   eeprom_init ();
+  statistics_init ();
+  battery_init ();
   motor_init ();
   pas_init ();
   wheel_speed_sensor_init ();
+  interrupts_init ();
   enableInterrupts ();
 
   while (1)
   {
 #ifdef DEBUG_UART
-//    printf ("%d, %d, %d, %d\n", ui16_motor_get_motor_speed_erps (), ui8_duty_cycle, ui8_motor_commutation_type, ui8_angle_correction);
+//    printf ("%d, %d, %d, %d\n", ui16_motor_get_motor_speed_erps (), motor_pwm_cycle.ui8_duty_cycle, motor_pwm_cycle.ui8_motor_commutation_type, motor_pwm_cycle.ui8_angle_correction);
 #endif
 
+    // events from the interrupts, before anything else
+    ebike_app_events_controller ();
+
     // because of continue; at the end of each if code block that will stop the while (1) loop there,
-    // the first if block code will have the higher priority over the others
-    ui16_TIM2_counter = TIM2_GetCounter ();
-    if ((ui16_TIM2_counter - ui16_motor_controller_counter) > 781) // every 100ms
+    // the first if block code will have the higher priority over the others.
+    // Tasks only get ready on a new tick: the system time is read once each 1ms, not on every PWM cycle
+    if (ui8_system_time_tick)
     {
-      ui16_motor_controller_counter = ui16_TIM2_counter;
-      motor_controller ();
-      continue;
+      if (system_time_task_is_ready (SYSTEM_TIME_TASK_MOTOR_CONTROLLER, 100)) // every 100ms
+      {
+	motor_controller ();
+	continue;
+      }
+
+      if (system_time_task_is_ready (SYSTEM_TIME_TASK_EBIKE_APP_CONTROLLER, 100)) // every 100ms
+      {
+	ebike_app_controller ();
+	continue;
+      }
+
+      ui8_system_time_tick = 0; // a tick meanwhile is lost, and only delays the tasks up to the next one
     }
 
-    ui16_TIM2_counter = TIM2_GetCounter ();
-    if ((ui16_TIM2_counter - ui16_ebike_app_controller_counter) > 781) // every 150ms
-    {
-      ui16_ebike_app_controller_counter = ui16_TIM2_counter;
-      ebike_app_controller ();
-      continue;
-    }
+    // program on data EEPROM the records that changed, one step each time, never waits
+    eeprom_controller ();
+
+    // no task ready: sleep up to the next interrupt, at most the next PWM cycle or the 1ms tick (8ms in deep
+    // idle). An interrupt after the checks above only delays its task up to the next one
+    wfi ();
   }
 
   return 0;
@@ -82,6 +82,43 @@
 
 #define MOTOR_OVER_SPEED_ERPS 520 // motor max speed, protection max value | 30 points for the sinewave at max speed
 
+// Regen when braking: target current goes from 0 at MOTOR_REGEN_ERPS_MIN up to ADC_MOTOR_REGEN_CURRENT_MAX at
+// MOTOR_REGEN_ERPS_FULL and, from the brake start, ramps up MOTOR_REGEN_CURRENT_RAMP_STEP each 100ms
+#define MOTOR_REGEN_ERPS_MIN 10 // too slow, back EMF is too low to charge the battery
+#define MOTOR_REGEN_ERPS_FULL 40
+#define MOTOR_REGEN_CURRENT_RAMP_STEP 2 // 1A
+#define MOTOR_REGEN_DUTY_CYCLE_STEP_CYCLES 4 // PWM cycle regen current controller: duty_cycle step each 256us
+#define MOTOR_REGEN_MOTORING_CURRENT 4 // 2A: while the motor draws more than this when braking, a duty_cycle step each PWM cycle
+
+// Motor start: MOTOR_STATE_STARTUP that takes longer than MOTOR_STARTUP_TIME_MAX_MS is a blocked motor, the PWM stays
+// disabled for at least MOTOR_COOL_DOWN_TIME_MS and up to the throttle is released
+#define MOTOR_STARTUP_TIME_MAX_MS 2000
+#define MOTOR_COOL_DOWN_TIME_MS 1000
+
+// Over current recovery: PWM is enabled again after a cool down of MOTOR_OVER_CURRENT_COOL_DOWN_MS from the fault,
+// doubled on each new fault, at half of the motor current max that then ramps up 0.5A each 100ms. After
+// MOTOR_OVER_CURRENT_RETRIES_MAX cool downs, the next fault without MOTOR_OVER_CURRENT_WINDOW_MS of normal running since the
+// last one latches the motor off until power up
+#define MOTOR_OVER_CURRENT_COOL_DOWN_MS 500
+#define MOTOR_OVER_CURRENT_RETRIES_MAX 4 // cool downs of 0.5, 1, 2 and 4 seconds, the 5th fault latches
+#define MOTOR_OVER_CURRENT_WINDOW_MS 30000
+
+// The PWM cycle interrupt state (motor_pwm_cycle on motor.c) is placed at the start of RAM, on page 0 (0x00 - 0xff)
+// where the CPU uses 1 byte short addresses: shorter and faster instructions. The linker places the other variables
+// after it, from the --data-loc of the Makefiles, keep both in sync. Address 0 is left unused as NULL
+#define MOTOR_PWM_CYCLE_ADDRESS 0x0001
+#define MOTOR_PWM_CYCLE_SIZE_MAX 0x5f // up to --data-loc 0x0060
+
+// Deep idle, bike parked: motor stopped, throttle released, no PAS cadence and no wheel speed. The PWM cycle
+// interrupt then runs only once each MOTOR_IDLE_PWM_CYCLES PWM periods (TIM1 repetition counter) and keeps just the
+// ADC conversions, the battery current accumulation and the watchdog, with a longer timeout. The TIM4 1ms tick is
+// stopped and the PWM cycle interrupt counts the system time, MOTOR_IDLE_TICK_MS each time: about 125 timer wake-ups/s.
+// A change on the hall sensors, PAS or wheel speed sensor signals, or a duty_cycle target, gets it back to every PWM period
+#define MOTOR_IDLE_PWM_CYCLES 125 // 8ms; TIM1 RCR is 8 bits and counts 2 update events each PWM period: 128 max
+#define MOTOR_IDLE_TICK_MS 8 // MOTOR_IDLE_PWM_CYCLES * 64us
+#define MOTOR_IDLE_WATCHDOG_RELOAD 191 // 192 * 62.5us = 12ms, over the 8ms
+#define MOTOR_WATCHDOG_RELOAD 2 // 187.5us, see watchdog_init ()
+
 #if CONTROLLER_TYPE == CONTROLLER_TYPE_S06S
 #define MOTOR_SPEED_CONTROLLER_KP 2 // x << 5
 #elif CONTROLLER_TYPE == CONTROLLER_TYPE_S12S
@@ -107,6 +144,7 @@
 #define THROTTLE_MAX_VALUE 255
 
 #define CRUISE_CONTROL_MIN 20
+#define CRUISE_CONTROL_LOCK_TIME_MS 8000 // throttle kept in the same position for 8 seconds locks cruise control
 
 // *************************************************************************** //
 // PAS
@@ -116,6 +154,8 @@
 // (1/(150RPM/60)) / (PAS_NUMBER_MAGNETS * 0.000064)
 #define PAS_ABSOLUTE_MAX_CADENCE_PWM_CYCLE_TICKS  (6250 / PAS_NUMBER_MAGNETS) // max hard limit to 150RPM PAS cadence
 #define PAS_ABSOLUTE_MIN_CADENCE_PWM_CYCLE_TICKS  (156250 / PAS_NUMBER_MAGNETS) // min hard limit to 6RPM PAS cadence
+// cadence in RPM = 60 / (ticks * PAS_NUMBER_MAGNETS * 0.000064) = PAS_CADENCE_RPM_TICKS / ticks
+#define PAS_CADENCE_RPM_TICKS  (937500L / PAS_NUMBER_MAGNETS)
 // *************************************************************************** //
 
 // *************************************************************************** //
@@ -144,10 +184,15 @@
 #define ADC_BATTERY_VOLTAGE_PER_ADC_STEP 0.272 // this value was found experimentaly, to beter represent the real value
 #define ADC_BATTERY_VOLTAGE_K 73 // 0.272 << 8
 
+#define BATTERY_CAPACITY_MAH 10000 // battery pack capacity, for the state of charge
+#define BATTERY_INTERNAL_RESISTANCE_MOHM 200 // initial value, it is measured while riding
+
 #define COMMUNICATIONS_BATTERY_VOLTAGE	(BATTERY_LI_ION_CELLS_NUMBER * 3.45) // example: 7S battery, should be = 24
 #define ADC_BATTERY_VOLTAGE_MAX 	((BATTERY_LI_ION_CELLS_NUMBER * LI_ION_CELL_VOLTS_MAX) / ADC_BATTERY_VOLTAGE_PER_ADC_STEP)
 #define ADC_BATTERY_VOLTAGE_MED 	((COMMUNICATIONS_BATTERY_VOLTAGE / ADC_BATTERY_VOLTAGE_PER_ADC_STEP)) << 6
 #define ADC_BATTERY_VOLTAGE_MIN 	((BATTERY_LI_ION_CELLS_NUMBER * LI_ION_CELL_VOLTS_MIN) / ADC_BATTERY_VOLTAGE_PER_ADC_STEP)
+#define ADC_BATTERY_VOLTAGE_DERATING 	((BATTERY_LI_ION_CELLS_NUMBER * LI_ION_CELL_VOLTS_DERATING) / ADC_BATTERY_VOLTAGE_PER_ADC_STEP)
+#define ADC_BATTERY_VOLTAGE_CUT_OFF 	((BATTERY_LI_ION_CELLS_NUMBER * LI_ION_CELL_VOLTS_CUT_OFF) / ADC_BATTERY_VOLTAGE_PER_ADC_STEP)
 
 // Considering the follow voltage values for each li-ion battery cell
 // State of charge 		| voltage
@@ -160,6 +205,13 @@
 #define LI_ION_CELL_VOLTS_0 	3.27
 #define LI_ION_CELL_VOLTS_MIN 	3.10
 
+// Low voltage: motor current is reduced linearly from LI_ION_CELL_VOLTS_DERATING down to 0 at LI_ION_CELL_VOLTS_MIN,
+// and comes back only when the voltage recovers over the hysteresis. Under LI_ION_CELL_VOLTS_CUT_OFF the battery is
+// empty and the motor is disabled until the controller is switched off.
+#define LI_ION_CELL_VOLTS_DERATING		3.30
+#define LI_ION_CELL_VOLTS_DERATING_HYSTERESIS	0.05
+#define LI_ION_CELL_VOLTS_CUT_OFF		2.90
+
 #define BATTERY_PACK_VOLTS_100	(LI_ION_CELL_VOLTS_100 * BATTERY_LI_ION_CELLS_NUMBER) * 256
 #define BATTERY_PACK_VOLTS_80 	(LI_ION_CELL_VOLTS_80 * BATTERY_LI_ION_CELLS_NUMBER) * 256
 #define BATTERY_PACK_VOLTS_60	(LI_ION_CELL_VOLTS_60 * BATTERY_LI_ION_CELLS_NUMBER) * 256
@@ -23,6 +23,11 @@
 #include "uart.h"
 #include "adc.h"
 #include "watchdog.h"
+#include "statistics.h"
+#include "fault_log.h"
+#include "events.h"
+#include "timers.h"
+#include "hal.h"
 
 #define SVM_TABLE_LEN 256
 
@@ -286,38 +291,29 @@ uint8_t ui8_svm_table [SVM_TABLE_LEN] =
     122
 };
 
-uint16_t ui16_PWM_cycles_counter = 0;
-uint16_t ui16_PWM_cycles_counter_6 = 0;
-uint16_t ui16_PWM_cycles_counter_total = 0;
+// not initialized by the C startup code, see motor_pwm_cycle_init ()
+struc_motor_pwm_cycle __at (MOTOR_PWM_CYCLE_ADDRESS) motor_pwm_cycle;
 
-uint16_t ui16_motor_speed_erps = 0;
-uint8_t ui8_sinewave_table_index = 0;
-uint8_t ui8_motor_rotor_absolute_angle;
-uint8_t ui8_motor_rotor_angle;
-uint8_t ui8_flag_foc_read_id_current = 0;
-volatile uint8_t ui8_angle_correction = 127;
-uint8_t ui8_interpolation_angle = 0;
+// fails to compile if motor_pwm_cycle grows over the RAM left for it before the other variables
+typedef uint8_t motor_pwm_cycle_size_check [(sizeof (struc_motor_pwm_cycle) <= MOTOR_PWM_CYCLE_SIZE_MAX) ? 1 : -1];
 
-uint8_t ui8_motor_commutation_type = BLOCK_COMMUTATION;
-volatile uint8_t ui8_motor_state = MOTOR_STATE_STOP;
-uint8_t ui8_motor_startup_counter;
-uint8_t ui8_motor_controller_state = MOTOR_CONTROLLER_STATE_OK;
+uint32_t ui32_motor_state_start_ms; // MOTOR_STATE_STARTUP and MOTOR_STATE_COOL timeouts
 
-uint8_t ui8_hall_sensors = 0;
-uint8_t ui8_hall_sensors_last = 0;
-
-uint8_t ui8_adc_id_current = 0;
-
-uint8_t ui8_adc_target_motor_current_max;
 int8_t i8_motor_current_filtered_10b;
-uint8_t ui8_adc_target_motor_regen_current_max;
+uint8_t ui8_motor_regen_current = 0;
+
+// over current recovery, see motor_over_current_controller ()
+volatile uint8_t ui8_motor_over_current_duty_cycle; // duty_cycle when the over current happened
+uint16_t ui16_motor_over_current_erps;
+uint16_t ui16_motor_over_current_cool_down_ms = 0; // 0 when not waiting to enable the PWM again
+uint32_t ui32_motor_over_current_start_ms = 0; // last fault or recovery
+uint8_t ui8_motor_over_current_faults = 0;
+uint8_t ui8_motor_over_current_latched = 0;
+uint8_t ui8_motor_over_current_current_max = ADC_MOTOR_CURRENT_MAX;
+uint16_t ui16_motor_over_current_retries = 0;
 
-uint8_t ui8_adc_motor_total_current;
-uint8_t ui8_motor_total_current_offset;
 uint16_t ui16_motor_total_current_offset_10b;
 
-uint8_t ui8_half_erps_flag = 0;
-
 uint16_t ui16_target_erps = 0;
 volatile uint16_t ui16_target_erps_max = MOTOR_OVER_SPEED_ERPS;
 uint16_t ui16_target_current_10b = 0;
@@ -330,33 +326,20 @@ uint16_t ui16_adc_motor_current_filtered_10b;
 
 uint8_t ui8_motor_controller_error = MOTOR_CONTROLLER_ERROR_EMPTY;
 
-volatile uint8_t ui8_duty_cycle = 0;
-uint8_t ui8_duty_cycle_target;
-uint16_t ui16_duty_cycle_ramp_up_inverse_step;
-uint16_t ui16_duty_cycle_ramp_down_inverse_step;
-uint16_t ui16_counter_duty_cycle_ramp_up = 0;
-uint16_t ui16_counter_duty_cycle_ramp_down = 0;
-uint8_t ui8_value_a;
-uint8_t ui8_value_b;
-uint8_t ui8_value_c;
-uint16_t ui16_value;
-
-uint8_t ui8_first_time_run_flag = 1;
-
-uint8_t ui8_pas_state;
-uint8_t ui8_pas_state_old;
-uint16_t ui16_pas_counter = (uint16_t) PAS_ABSOLUTE_MIN_CADENCE_PWM_CYCLE_TICKS;
-uint16_t ui16_pas_on_time_counter;
-uint16_t ui16_pas_off_time_counter;
-
-uint8_t ui8_wheel_speed_sensor_state;
-uint8_t ui8_wheel_speed_sensor_state_old;
-uint16_t ui16_wheel_speed_sensor_counter;
-
 uint8_t ui8_pwm_duty_cycle_duty_cycle_controller;
 
+// exchange with the main loop, see struc_motor_snapshot and struc_motor_command on motor.h
+volatile struc_motor_snapshot motor_snapshot [2] =
+{
+  { 0, 0, (uint16_t) PAS_ABSOLUTE_MIN_CADENCE_PWM_CYCLE_TICKS, 0, (uint16_t) WHEEL_SPEED_SENSOR_MIN_PWM_CYCLE_TICKS, 1 }
+};
+struc_motor_command motor_command;
+volatile struc_motor_command motor_command_buffer [2];
+
 // functions prototypes
 void do_battery_voltage_protection (void);
+void motor_regen_controller (void);
+void motor_over_current_controller (void);
 uint8_t motor_current_controller (void);
 uint8_t motor_speed_controller (void);
 void do_motor_state_machine (void);
@@ -368,191 +351,245 @@ void motor_controller (void)
   do_motor_state_machine ();
   calc_motor_current_filtered ();
   do_battery_voltage_protection ();
+  motor_over_current_controller ();
+  motor_regen_controller ();
   do_motor_controller_mode ();
 }
 
 // runs every 64us (PWM frequency)
 void TIM1_UPD_OVF_TRG_BRK_IRQHandler(void) __interrupt(TIM1_UPD_OVF_TRG_BRK_IRQHANDLER)
 {
+  volatile struc_motor_command *p_command;
+  uint16_t ui16_regen_target_x16;
+  volatile struc_motor_snapshot *p_snapshot;
+  uint8_t ui8_adc_id_current;
   uint8_t ui8_temp;
 
   /****************************************************************************/
   // trigger ADC conversion of all channels (scan conversion, buffered)
-  ADC1->CSR &= 0x09; // clear EOC flag first (selected also channel 9)
-  ADC1->CR1 |= ADC1_CR1_ADON; // Start ADC1 conversion
+  HAL_ADC1_START_CONVERSION ();
+  /****************************************************************************/
+
+  /****************************************************************************/
+  // deep idle, see MOTOR_IDLE_PWM_CYCLES: while the hall sensors, PAS and wheel speed sensor signals don't change,
+  // only the system time, the battery current accumulation and the watchdog
+  if (motor_pwm_cycle.ui8_idle == MOTOR_IDLE_ON)
+  {
+    // the first interrupt after motor_idle_enter () stops the TIM4 tick, each next one ends a long period
+    if (HAL_TIM4_IS_ENABLED ()) { HAL_TIM4_DISABLE (); }
+    else
+    {
+      ui32_system_time_ms += MOTOR_IDLE_TICK_MS;
+      ui8_system_time_tick = 1;
+    }
+
+    if ((HAL_GPIO_READ_INPUT_PIN (HALL_SENSORS__PORT, HALL_SENSORS_MASK) == motor_pwm_cycle.ui8_hall_sensors) &&
+	((HAL_GPIO_READ_INPUT_PIN (PAS__PORT, PAS__PIN) ? 1 : 0) == motor_pwm_cycle.ui8_pas_state) &&
+	((HAL_GPIO_READ_INPUT_PIN (WHEEL_SPEED_SENSOR__PORT, WHEEL_SPEED_SENSOR__PIN) ? 1 : 0) == motor_pwm_cycle.ui8_wheel_speed_sensor_state))
+    {
+      // each sample counts for the MOTOR_IDLE_PWM_CYCLES PWM periods, see battery_controller ()
+      motor_pwm_cycle.ui32_adc_battery_current_accumulated += ((uint16_t) UI8_ADC_MOTOR_TOTAL_CURRENT) * MOTOR_IDLE_PWM_CYCLES;
+      motor_pwm_cycle.ui32_adc_battery_voltage_cycles_accumulated += ((uint16_t) UI8_ADC_BATTERY_VOLTAGE) * MOTOR_IDLE_PWM_CYCLES;
+      motor_pwm_cycle.ui16_adc_battery_current_samples += MOTOR_IDLE_PWM_CYCLES;
+      IWDG->KR = IWDG_KEY_REFRESH;
+      HAL_TIM1_CLEAR_UPDATE_FLAG ();
+      return;
+    }
+
+    // the repetition counter is loaded on the next update event: one more long period up to the next interrupt
+    TIM1->RCR = 1;
+    motor_pwm_cycle.ui8_idle = MOTOR_IDLE_LEAVING;
+  }
+  else if (motor_pwm_cycle.ui8_idle == MOTOR_IDLE_LEAVING)
+  {
+    // end of the last long period, the TIM4 tick counts the system time again
+    if (!HAL_TIM4_IS_ENABLED ())
+    {
+      ui32_system_time_ms += MOTOR_IDLE_TICK_MS;
+      ui8_system_time_tick = 1;
+      HAL_TIM4_ENABLE_FROM_ZERO ();
+    }
+
+    // every PWM period from now
+    HAL_IWDG_SET_RELOAD (MOTOR_WATCHDOG_RELOAD);
+    motor_pwm_cycle.ui8_idle = MOTOR_IDLE_OFF;
+  }
   /****************************************************************************/
 
   /****************************************************************************/
   // read hall sensor signals and:
   // - find the motor rotor absolute angle
-  // - read FOC Id current and calc FOC (adjust ui8_angle_correction)
-  // - calc motor speed in erps (ui16_motor_speed_erps)
+  // - read FOC Id current and calc FOC (adjust motor_pwm_cycle.ui8_angle_correction)
+  // - calc motor speed in erps (motor_pwm_cycle.ui16_motor_speed_erps)
 
   // read hall sensors signal pins and mask other pins
-  ui8_hall_sensors = ((uint8_t) HALL_SENSORS__PORT->IDR) & (HALL_SENSORS_MASK);
+  motor_pwm_cycle.ui8_hall_sensors = HAL_GPIO_READ_INPUT_PIN (HALL_SENSORS__PORT, HALL_SENSORS_MASK);
   // make sure we run next code only when there is a change on the hall sensors signal
-  if (ui8_hall_sensors != ui8_hall_sensors_last)
+  if (motor_pwm_cycle.ui8_hall_sensors != motor_pwm_cycle.ui8_hall_sensors_last)
   {
-    ui8_hall_sensors_last = ui8_hall_sensors;
+    motor_pwm_cycle.ui8_hall_sensors_last = motor_pwm_cycle.ui8_hall_sensors;
 
-    switch (ui8_hall_sensors)
+    switch (motor_pwm_cycle.ui8_hall_sensors)
     {
       case 3:
-      if (ui8_motor_commutation_type != SINEWAVE_INTERPOLATION_360_DEGREES)
+      if (motor_pwm_cycle.ui8_motor_commutation_type != SINEWAVE_INTERPOLATION_360_DEGREES)
       {
-	ui8_motor_rotor_absolute_angle = (uint8_t) ANGLE_180;
+	motor_pwm_cycle.ui8_motor_rotor_absolute_angle = (uint8_t) ANGLE_180;
       }
       break;
 
       case 1:
-      if (ui8_half_erps_flag == 1)
+      if (motor_pwm_cycle.ui8_half_erps_flag == 1)
       {
-	ui8_half_erps_flag = 0;
-	ui16_PWM_cycles_counter_total = ui16_PWM_cycles_counter;
-	ui16_PWM_cycles_counter = 0;
+	motor_pwm_cycle.ui8_half_erps_flag = 0;
+	motor_pwm_cycle.ui16_PWM_cycles_counter_total = motor_pwm_cycle.ui16_PWM_cycles_counter;
+	motor_pwm_cycle.ui16_PWM_cycles_counter = 0;
 	// this division takes 4.4us and without the cast (uint16_t) PWM_CYCLES_SECOND, would take 111us!! Verified on 2017.11.20
-	ui16_motor_speed_erps = ((uint16_t) PWM_CYCLES_SECOND) / ui16_PWM_cycles_counter_total;
+	motor_pwm_cycle.ui16_motor_speed_erps = ((uint16_t) PWM_CYCLES_SECOND) / motor_pwm_cycle.ui16_PWM_cycles_counter_total;
+	motor_pwm_cycle.ui8_snapshot_changed = 1;
       }
       // update motor commutation state based on motor speed
 #ifdef DO_SINEWAVE_INTERPOLATION_360_DEGREES
-      if (ui16_motor_speed_erps > MOTOR_ROTOR_ERPS_START_INTERPOLATION_360_DEGREES)
+      if (motor_pwm_cycle.ui16_motor_speed_erps > MOTOR_ROTOR_ERPS_START_INTERPOLATION_360_DEGREES)
       {
-	if (ui8_motor_commutation_type == SINEWAVE_INTERPOLATION_60_DEGREES)
+	if (motor_pwm_cycle.ui8_motor_commutation_type == SINEWAVE_INTERPOLATION_60_DEGREES)
 	{
-	  ui8_motor_commutation_type = SINEWAVE_INTERPOLATION_360_DEGREES;
+	  motor_pwm_cycle.ui8_motor_commutation_type = SINEWAVE_INTERPOLATION_360_DEGREES;
 	}
       }
       else
       {
-	if (ui8_motor_commutation_type == SINEWAVE_INTERPOLATION_360_DEGREES)
+	if (motor_pwm_cycle.ui8_motor_commutation_type == SINEWAVE_INTERPOLATION_360_DEGREES)
 	{
-	  ui8_motor_commutation_type = SINEWAVE_INTERPOLATION_60_DEGREES;
+	  motor_pwm_cycle.ui8_motor_commutation_type = SINEWAVE_INTERPOLATION_60_DEGREES;
 	}
       }
 #endif
-      if (ui16_motor_speed_erps > MOTOR_ROTOR_ERPS_START_INTERPOLATION_60_DEGREES)
+      if (motor_pwm_cycle.ui16_motor_speed_erps > MOTOR_ROTOR_ERPS_START_INTERPOLATION_60_DEGREES)
       {
-	if (ui8_motor_commutation_type == BLOCK_COMMUTATION)
+	if (motor_pwm_cycle.ui8_motor_commutation_type == BLOCK_COMMUTATION)
 	{
-	  ui8_motor_commutation_type = SINEWAVE_INTERPOLATION_60_DEGREES;
-	  ui8_motor_state = MOTOR_STATE_RUNNING;
+	  motor_pwm_cycle.ui8_motor_commutation_type = SINEWAVE_INTERPOLATION_60_DEGREES;
+	  motor_pwm_cycle.ui8_motor_state = MOTOR_STATE_RUNNING;
 	}
       }
       else
       {
-	if (ui8_motor_commutation_type == SINEWAVE_INTERPOLATION_60_DEGREES)
+	if (motor_pwm_cycle.ui8_motor_commutation_type == SINEWAVE_INTERPOLATION_60_DEGREES)
 	{
-	  ui8_motor_commutation_type = BLOCK_COMMUTATION;
-	  ui8_angle_correction = 127;
+	  motor_pwm_cycle.ui8_motor_commutation_type = BLOCK_COMMUTATION;
+	  motor_pwm_cycle.ui8_angle_correction = 127;
 	}
       }
 
-      if (ui8_motor_commutation_type != SINEWAVE_INTERPOLATION_360_DEGREES)
+      if (motor_pwm_cycle.ui8_motor_commutation_type != SINEWAVE_INTERPOLATION_360_DEGREES)
       {
-	ui8_motor_rotor_absolute_angle = (uint8_t) ANGLE_240;
+	motor_pwm_cycle.ui8_motor_rotor_absolute_angle = (uint8_t) ANGLE_240;
       }
       break;
 
       case 5:
-      if (ui8_motor_commutation_type != SINEWAVE_INTERPOLATION_360_DEGREES)
+      if (motor_pwm_cycle.ui8_motor_commutation_type != SINEWAVE_INTERPOLATION_360_DEGREES)
       {
-	ui8_motor_rotor_absolute_angle = (uint8_t) ANGLE_300;
+	motor_pwm_cycle.ui8_motor_rotor_absolute_angle = (uint8_t) ANGLE_300;
       }
       break;
 
       case 4:
-      if (ui8_motor_commutation_type != SINEWAVE_INTERPOLATION_360_DEGREES)
+      if (motor_pwm_cycle.ui8_motor_commutation_type != SINEWAVE_INTERPOLATION_360_DEGREES)
       {
-	ui8_motor_rotor_absolute_angle = (uint8_t) ANGLE_1;
+	motor_pwm_cycle.ui8_motor_rotor_absolute_angle = (uint8_t) ANGLE_1;
       }
       break;
 
       case 6:
-      ui8_half_erps_flag = 1;
-      ui8_flag_foc_read_id_current = 1;
+      motor_pwm_cycle.ui8_half_erps_flag = 1;
+      motor_pwm_cycle.ui8_flag_foc_read_id_current = 1;
 
-      if (ui8_motor_commutation_type != SINEWAVE_INTERPOLATION_360_DEGREES)
+      if (motor_pwm_cycle.ui8_motor_commutation_type != SINEWAVE_INTERPOLATION_360_DEGREES)
       {
-	ui8_motor_rotor_absolute_angle = (uint8_t) ANGLE_60;
+	motor_pwm_cycle.ui8_motor_rotor_absolute_angle = (uint8_t) ANGLE_60;
       }
       break;
 
       case 2:
-      if (ui8_motor_commutation_type != SINEWAVE_INTERPOLATION_360_DEGREES)
+      if (motor_pwm_cycle.ui8_motor_commutation_type != SINEWAVE_INTERPOLATION_360_DEGREES)
       {
-	ui8_motor_rotor_absolute_angle = (uint8_t) ANGLE_120;
+	motor_pwm_cycle.ui8_motor_rotor_absolute_angle = (uint8_t) ANGLE_120;
       }
       break;
 
       default:
+      EVENTS_POST_FROM_INTERRUPT (EVENTS_SOURCE_PWM_CYCLE, EVENT_HALL_SENSORS_ERROR);
       return;
       break;
     }
 
-    ui16_PWM_cycles_counter_6 = 0;
+    motor_pwm_cycle.ui16_PWM_cycles_counter_6 = 0;
   }
   /****************************************************************************/
 
   /****************************************************************************/
   // count number of fast loops / PWM cycles and reset some states when motor is near zero speed
-  if (ui16_PWM_cycles_counter < ((uint16_t) PWM_CYCLES_COUNTER_MAX))
+  if (motor_pwm_cycle.ui16_PWM_cycles_counter < ((uint16_t) PWM_CYCLES_COUNTER_MAX))
   {
-    ui16_PWM_cycles_counter++;
-    ui16_PWM_cycles_counter_6++;
+    motor_pwm_cycle.ui16_PWM_cycles_counter++;
+    motor_pwm_cycle.ui16_PWM_cycles_counter_6++;
   }
   else // happens when motor is stopped or near zero speed
   {
-    ui16_PWM_cycles_counter = 0;
-    ui16_PWM_cycles_counter_6 = 0;
-    ui8_half_erps_flag = 0;
-    ui16_motor_speed_erps = 0;
-    ui16_PWM_cycles_counter_total = 0xffff;
-    ui8_angle_correction = 127;
-    ui8_motor_commutation_type = BLOCK_COMMUTATION;
-    ui8_hall_sensors_last = 0; // this way we force execution of hall sensors code next time
-    ebike_app_cruise_control_stop ();
-    if (ui8_motor_state == MOTOR_STATE_RUNNING) { ui8_motor_state = MOTOR_STATE_STOP; }
+    motor_pwm_cycle.ui16_PWM_cycles_counter = 0;
+    motor_pwm_cycle.ui16_PWM_cycles_counter_6 = 0;
+    motor_pwm_cycle.ui8_half_erps_flag = 0;
+    if (motor_pwm_cycle.ui16_motor_speed_erps) { EVENTS_POST_FROM_INTERRUPT (EVENTS_SOURCE_PWM_CYCLE, EVENT_MOTOR_STOPPED); }
+    motor_pwm_cycle.ui16_motor_speed_erps = 0;
+    motor_pwm_cycle.ui16_PWM_cycles_counter_total = 0xffff;
+    motor_pwm_cycle.ui8_snapshot_changed = 1;
+    motor_pwm_cycle.ui8_angle_correction = 127;
+    motor_pwm_cycle.ui8_motor_commutation_type = BLOCK_COMMUTATION;
+    motor_pwm_cycle.ui8_hall_sensors_last = 0; // this way we force execution of hall sensors code next time
+    if (motor_pwm_cycle.ui8_motor_state == MOTOR_STATE_RUNNING) { motor_pwm_cycle.ui8_motor_state = MOTOR_STATE_STOP; }
   }
   /****************************************************************************/
 
   /****************************************************************************/
   // - calc interpolation angle and sinewave table index
-  // - read FOC Id current and ajust ui8_angle_correction
+  // - read FOC Id current and ajust motor_pwm_cycle.ui8_angle_correction
 #define DO_INTERPOLATION 1 // may be usefull to disable interpolation when debugging
 #if DO_INTERPOLATION == 1
   // calculate the interpolation angle (and it doesn't work when motor starts and at very low speeds)
-  if (ui8_motor_commutation_type == SINEWAVE_INTERPOLATION_60_DEGREES)
+  if (motor_pwm_cycle.ui8_motor_commutation_type == SINEWAVE_INTERPOLATION_60_DEGREES)
   {
-    ui8_interpolation_angle = (ui16_PWM_cycles_counter_6 << 8) / ui16_PWM_cycles_counter_total; // this operations take 4.4us
-    ui8_motor_rotor_angle = ui8_motor_rotor_absolute_angle + ui8_interpolation_angle;
-    ui8_sinewave_table_index = ui8_motor_rotor_angle + ui8_angle_correction;
+    motor_pwm_cycle.ui8_interpolation_angle = (motor_pwm_cycle.ui16_PWM_cycles_counter_6 << 8) / motor_pwm_cycle.ui16_PWM_cycles_counter_total; // this operations take 4.4us
+    motor_pwm_cycle.ui8_motor_rotor_angle = motor_pwm_cycle.ui8_motor_rotor_absolute_angle + motor_pwm_cycle.ui8_interpolation_angle;
+    motor_pwm_cycle.ui8_sinewave_table_index = motor_pwm_cycle.ui8_motor_rotor_angle + motor_pwm_cycle.ui8_angle_correction;
   }
-  else if (ui8_motor_commutation_type == SINEWAVE_INTERPOLATION_360_DEGREES)
+  else if (motor_pwm_cycle.ui8_motor_commutation_type == SINEWAVE_INTERPOLATION_360_DEGREES)
   {
-    ui8_interpolation_angle = (ui16_PWM_cycles_counter << 8) / ui16_PWM_cycles_counter_total;
-    ui8_motor_rotor_angle = ui8_motor_rotor_absolute_angle + ui8_interpolation_angle;
-    ui8_sinewave_table_index = ui8_motor_rotor_angle + ui8_angle_correction;
+    motor_pwm_cycle.ui8_interpolation_angle = (motor_pwm_cycle.ui16_PWM_cycles_counter << 8) / motor_pwm_cycle.ui16_PWM_cycles_counter_total;
+    motor_pwm_cycle.ui8_motor_rotor_angle = motor_pwm_cycle.ui8_motor_rotor_absolute_angle + motor_pwm_cycle.ui8_interpolation_angle;
+    motor_pwm_cycle.ui8_sinewave_table_index = motor_pwm_cycle.ui8_motor_rotor_angle + motor_pwm_cycle.ui8_angle_correction;
   }
   else
 #endif
   {
-    ui8_sinewave_table_index = ui8_motor_rotor_absolute_angle + ui8_angle_correction;
+    motor_pwm_cycle.ui8_sinewave_table_index = motor_pwm_cycle.ui8_motor_rotor_absolute_angle + motor_pwm_cycle.ui8_angle_correction;
   }
 
-  ui8_motor_rotor_angle += ((uint8_t) FOC_READ_ID_CURRENT_OFFSET);
-  // make sure we just execute one time per ERPS, so use the flag ui8_flag_foc_read_id_current
-  if ((ui8_motor_rotor_angle >= ((uint8_t) FOC_READ_ID_CURRENT_ANGLE_ADJUST)) && (ui8_flag_foc_read_id_current))
+  motor_pwm_cycle.ui8_motor_rotor_angle += ((uint8_t) FOC_READ_ID_CURRENT_OFFSET);
+  // make sure we just execute one time per ERPS, so use the flag motor_pwm_cycle.ui8_flag_foc_read_id_current
+  if ((motor_pwm_cycle.ui8_motor_rotor_angle >= ((uint8_t) FOC_READ_ID_CURRENT_ANGLE_ADJUST)) && (motor_pwm_cycle.ui8_flag_foc_read_id_current))
   {
-    ui8_flag_foc_read_id_current = 0;
+    motor_pwm_cycle.ui8_flag_foc_read_id_current = 0;
 
     // minimum speed to do FOC
-    if (ui16_motor_speed_erps > MOTOR_ROTOR_ERPS_START_INTERPOLATION_60_DEGREES)
+    if (motor_pwm_cycle.ui16_motor_speed_erps > MOTOR_ROTOR_ERPS_START_INTERPOLATION_60_DEGREES)
     {
       // read here the phase B current: FOC Id current
       ui8_adc_id_current = UI8_ADC_PHASE_B_CURRENT;
 
-      if (ui8_adc_id_current > 127) { ui8_angle_correction++; }
-      else if (ui8_adc_id_current < 125) { ui8_angle_correction--; }
+      if (ui8_adc_id_current > 127) { motor_pwm_cycle.ui8_angle_correction++; }
+      else if (ui8_adc_id_current < 125) { motor_pwm_cycle.ui8_angle_correction--; }
     }
   }
   /****************************************************************************/
@@ -560,53 +597,108 @@ void TIM1_UPD_OVF_TRG_BRK_IRQHandler(void) __interrupt(TIM1_UPD_OVF_TRG_BRK_IRQH
   /****************************************************************************/
   // PWM duty_cycle controller:
   // - limit motor max current
+  // - regen current controller, when braking
   // - limit motor max regen current
   // - ramp up/down PWM duty_cycle value
 
+  // new values from the main loop, see motor_command_publish ()
+  if (motor_pwm_cycle.ui8_command_sequence != motor_pwm_cycle.ui8_motor_command_sequence)
+  {
+    motor_pwm_cycle.ui8_command_sequence = motor_pwm_cycle.ui8_motor_command_sequence;
+    p_command = &motor_command_buffer [motor_pwm_cycle.ui8_command_sequence & 1];
+    motor_pwm_cycle.ui8_duty_cycle_target = p_command->ui8_duty_cycle_target;
+    motor_pwm_cycle.ui8_adc_target_motor_current_max = p_command->ui8_adc_target_motor_current_max;
+    motor_pwm_cycle.ui8_adc_target_motor_regen_current = p_command->ui8_adc_target_motor_regen_current;
+    motor_pwm_cycle.ui8_motor_regen_duty_cycle_min = p_command->ui8_motor_regen_duty_cycle_min;
+    motor_pwm_cycle.ui16_duty_cycle_ramp_up_inverse_step = p_command->ui16_duty_cycle_ramp_up_inverse_step;
+    motor_pwm_cycle.ui16_duty_cycle_ramp_down_inverse_step = p_command->ui16_duty_cycle_ramp_down_inverse_step;
+  }
+
   // verify motor max current limit
-  ui8_adc_motor_total_current = UI8_ADC_MOTOR_TOTAL_CURRENT;
-  if (ui8_adc_motor_total_current > ui8_adc_target_motor_current_max)  // motor max current, reduce duty_cycle
+  motor_pwm_cycle.ui8_adc_motor_total_current = UI8_ADC_MOTOR_TOTAL_CURRENT;
+  motor_pwm_cycle.ui32_adc_battery_current_accumulated += motor_pwm_cycle.ui8_adc_motor_total_current;
+  motor_pwm_cycle.ui32_adc_battery_voltage_cycles_accumulated += UI8_ADC_BATTERY_VOLTAGE;
+  motor_pwm_cycle.ui16_adc_battery_current_samples++;
+  if (motor_pwm_cycle.ui8_adc_motor_total_current > motor_pwm_cycle.ui8_adc_target_motor_current_max)  // motor max current, reduce duty_cycle
   {
-    if (ui8_duty_cycle > 0)
+    if (motor_pwm_cycle.ui8_duty_cycle > 0)
     {
-      ui8_duty_cycle--;
+      motor_pwm_cycle.ui8_duty_cycle--;
     }
   }
   // verify if there is regen current > 0 (if there is happening regen) and
   // if battery voltage is over or equal to absolute battery max voltage, and if so
   // reduce regen current
-  else if ((ui8_adc_motor_total_current < ui8_motor_total_current_offset) &&
+  else if ((motor_pwm_cycle.ui8_adc_motor_total_current < motor_pwm_cycle.ui8_motor_total_current_offset) &&
       (UI8_ADC_BATTERY_VOLTAGE >= ((uint8_t) ADC_BATTERY_VOLTAGE_MAX)))
   {
-    if (ui8_duty_cycle < 255)
+    if (motor_pwm_cycle.ui8_duty_cycle < 255)
     {
-      ui8_duty_cycle++;
+      motor_pwm_cycle.ui8_duty_cycle++;
+    }
+  }
+  // braking: regulate the regen current to the target, lower duty_cycle gives more regen current. The ripple of the
+  // hall sectors on the current is larger than the regen current, so the controller uses the filtered current and a
+  // duty_cycle step each MOTOR_REGEN_DUTY_CYCLE_STEP_CYCLES, on every cycle while the motor still draws current
+  else if (motor_pwm_cycle.ui8_motor_controller_state & MOTOR_CONTROLLER_STATE_BRAKE)
+  {
+    motor_pwm_cycle.ui16_motor_regen_current_filtered_x16 -= motor_pwm_cycle.ui16_motor_regen_current_filtered_x16 >> 4;
+    motor_pwm_cycle.ui16_motor_regen_current_filtered_x16 += motor_pwm_cycle.ui8_adc_motor_total_current;
+
+    if ((++motor_pwm_cycle.ui8_motor_regen_step_counter >= MOTOR_REGEN_DUTY_CYCLE_STEP_CYCLES) ||
+        (motor_pwm_cycle.ui8_adc_motor_total_current > (motor_pwm_cycle.ui8_motor_total_current_offset + MOTOR_REGEN_MOTORING_CURRENT)))
+    {
+      motor_pwm_cycle.ui8_motor_regen_step_counter = 0;
+
+      // the first time the current goes negative, the duty_cycle is about the one of the motor back EMF
+      if ((motor_pwm_cycle.ui8_motor_regen_duty_cycle_zero == 0) &&
+          (motor_pwm_cycle.ui16_motor_regen_current_filtered_x16 < (((uint16_t) motor_pwm_cycle.ui8_motor_total_current_offset) << 4)))
+      {
+        motor_pwm_cycle.ui8_motor_regen_duty_cycle_zero = motor_pwm_cycle.ui8_duty_cycle;
+        motor_pwm_cycle.ui16_motor_regen_erps_zero = motor_pwm_cycle.ui16_motor_speed_erps;
+      }
+
+      ui16_regen_target_x16 = ((uint16_t) motor_pwm_cycle.ui8_adc_target_motor_regen_current) << 4;
+      if (motor_pwm_cycle.ui16_motor_regen_current_filtered_x16 > ui16_regen_target_x16)
+      {
+        if (motor_pwm_cycle.ui8_duty_cycle > motor_pwm_cycle.ui8_motor_regen_duty_cycle_min)
+        {
+          motor_pwm_cycle.ui8_duty_cycle--;
+        }
+      }
+      else if (motor_pwm_cycle.ui16_motor_regen_current_filtered_x16 < ui16_regen_target_x16)
+      {
+        if (motor_pwm_cycle.ui8_duty_cycle < 255)
+        {
+          motor_pwm_cycle.ui8_duty_cycle++;
+        }
+      }
     }
   }
   // verify motor max regen current limit
-  else if (ui8_adc_motor_total_current < ui8_adc_target_motor_regen_current_max)
+  else if (motor_pwm_cycle.ui8_adc_motor_total_current < motor_pwm_cycle.ui8_adc_target_motor_regen_current_max)
   {
-    if (ui8_duty_cycle < 255)
+    if (motor_pwm_cycle.ui8_duty_cycle < 255)
     {
-      ui8_duty_cycle++;
+      motor_pwm_cycle.ui8_duty_cycle++;
     }
   }
   else // no motor current limits, adjust duty_cycle to duty_cycle_target, including ramping
   {
-    if (ui8_duty_cycle_target > ui8_duty_cycle)
+    if (motor_pwm_cycle.ui8_duty_cycle_target > motor_pwm_cycle.ui8_duty_cycle)
     {
-      if (ui16_counter_duty_cycle_ramp_up++ >= ui16_duty_cycle_ramp_up_inverse_step)
+      if (motor_pwm_cycle.ui16_counter_duty_cycle_ramp_up++ >= motor_pwm_cycle.ui16_duty_cycle_ramp_up_inverse_step)
       {
-	ui16_counter_duty_cycle_ramp_up = 0;
-	ui8_duty_cycle++;
+	motor_pwm_cycle.ui16_counter_duty_cycle_ramp_up = 0;
+	motor_pwm_cycle.ui8_duty_cycle++;
       }
     }
-    else if (ui8_duty_cycle_target < ui8_duty_cycle)
+    else if (motor_pwm_cycle.ui8_duty_cycle_target < motor_pwm_cycle.ui8_duty_cycle)
     {
-      if (ui16_counter_duty_cycle_ramp_down++ >= ui16_duty_cycle_ramp_down_inverse_step)
+      if (motor_pwm_cycle.ui16_counter_duty_cycle_ramp_down++ >= motor_pwm_cycle.ui16_duty_cycle_ramp_down_inverse_step)
       {
-	ui16_counter_duty_cycle_ramp_down = 0;
-	ui8_duty_cycle--;
+	motor_pwm_cycle.ui16_counter_duty_cycle_ramp_down = 0;
+	motor_pwm_cycle.ui8_duty_cycle--;
       }
     }
   }
@@ -616,158 +708,179 @@ void TIM1_UPD_OVF_TRG_BRK_IRQHandler(void) __interrupt(TIM1_UPD_OVF_TRG_BRK_IRQH
   // calc final PWM duty_cycle values to be applied to TIMER1
 
   // scale and apply _duty_cycle
-  ui8_temp = ui8_svm_table [ui8_sinewave_table_index];
+  ui8_temp = ui8_svm_table [motor_pwm_cycle.ui8_sinewave_table_index];
   if (ui8_temp > MIDDLE_PWM_DUTY_CYCLE_MAX)
   {
-    ui16_value = ((uint16_t) (ui8_temp - MIDDLE_PWM_DUTY_CYCLE_MAX)) * ui8_duty_cycle;
-    ui8_temp = (uint8_t) (ui16_value >> 8);
-    ui8_value_a = MIDDLE_PWM_DUTY_CYCLE_MAX + ui8_temp;
+    motor_pwm_cycle.ui16_value = ((uint16_t) (ui8_temp - MIDDLE_PWM_DUTY_CYCLE_MAX)) * motor_pwm_cycle.ui8_duty_cycle;
+    ui8_temp = (uint8_t) (motor_pwm_cycle.ui16_value >> 8);
+    motor_pwm_cycle.ui8_value_a = MIDDLE_PWM_DUTY_CYCLE_MAX + ui8_temp;
   }
   else
   {
-    ui16_value = ((uint16_t) (MIDDLE_PWM_DUTY_CYCLE_MAX - ui8_temp)) * ui8_duty_cycle;
-    ui8_temp = (uint8_t) (ui16_value >> 8);
-    ui8_value_a = MIDDLE_PWM_DUTY_CYCLE_MAX - ui8_temp;
+    motor_pwm_cycle.ui16_value = ((uint16_t) (MIDDLE_PWM_DUTY_CYCLE_MAX - ui8_temp)) * motor_pwm_cycle.ui8_duty_cycle;
+    ui8_temp = (uint8_t) (motor_pwm_cycle.ui16_value >> 8);
+    motor_pwm_cycle.ui8_value_a = MIDDLE_PWM_DUTY_CYCLE_MAX - ui8_temp;
   }
 
   // add 120 degrees and limit
-  ui8_temp = ui8_svm_table [(uint8_t) (ui8_sinewave_table_index + 85 /* 120º */)];
+  ui8_temp = ui8_svm_table [(uint8_t) (motor_pwm_cycle.ui8_sinewave_table_index + 85 /* 120º */)];
   if (ui8_temp > MIDDLE_PWM_DUTY_CYCLE_MAX)
   {
-    ui16_value = ((uint16_t) (ui8_temp - MIDDLE_PWM_DUTY_CYCLE_MAX)) * ui8_duty_cycle;
-    ui8_temp = (uint8_t) (ui16_value >> 8);
-    ui8_value_b = MIDDLE_PWM_DUTY_CYCLE_MAX + ui8_temp;
+    motor_pwm_cycle.ui16_value = ((uint16_t) (ui8_temp - MIDDLE_PWM_DUTY_CYCLE_MAX)) * motor_pwm_cycle.ui8_duty_cycle;
+    ui8_temp = (uint8_t) (motor_pwm_cycle.ui16_value >> 8);
+    motor_pwm_cycle.ui8_value_b = MIDDLE_PWM_DUTY_CYCLE_MAX + ui8_temp;
   }
   else
   {
-    ui16_value = ((uint16_t) (MIDDLE_PWM_DUTY_CYCLE_MAX - ui8_temp)) * ui8_duty_cycle;
-    ui8_temp = (uint8_t) (ui16_value >> 8);
-    ui8_value_b = MIDDLE_PWM_DUTY_CYCLE_MAX - ui8_temp;
+    motor_pwm_cycle.ui16_value = ((uint16_t) (MIDDLE_PWM_DUTY_CYCLE_MAX - ui8_temp)) * motor_pwm_cycle.ui8_duty_cycle;
+    ui8_temp = (uint8_t) (motor_pwm_cycle.ui16_value >> 8);
+    motor_pwm_cycle.ui8_value_b = MIDDLE_PWM_DUTY_CYCLE_MAX - ui8_temp;
   }
 
   // subtract 120 degrees and limit
-  ui8_temp = ui8_svm_table [(uint8_t) (ui8_sinewave_table_index + 171 /* 240º */)];
+  ui8_temp = ui8_svm_table [(uint8_t) (motor_pwm_cycle.ui8_sinewave_table_index + 171 /* 240º */)];
   if (ui8_temp > MIDDLE_PWM_DUTY_CYCLE_MAX)
   {
-    ui16_value = ((uint16_t) (ui8_temp - MIDDLE_PWM_DUTY_CYCLE_MAX)) * ui8_duty_cycle;
-    ui8_temp = (uint8_t) (ui16_value >> 8);
-    ui8_value_c = MIDDLE_PWM_DUTY_CYCLE_MAX + ui8_temp;
+    motor_pwm_cycle.ui16_value = ((uint16_t) (ui8_temp - MIDDLE_PWM_DUTY_CYCLE_MAX)) * motor_pwm_cycle.ui8_duty_cycle;
+    ui8_temp = (uint8_t) (motor_pwm_cycle.ui16_value >> 8);
+    motor_pwm_cycle.ui8_value_c = MIDDLE_PWM_DUTY_CYCLE_MAX + ui8_temp;
   }
   else
   {
-    ui16_value = ((uint16_t) (MIDDLE_PWM_DUTY_CYCLE_MAX - ui8_temp)) * ui8_duty_cycle;
-    ui8_temp = (uint8_t) (ui16_value >> 8);
-    ui8_value_c = MIDDLE_PWM_DUTY_CYCLE_MAX - ui8_temp;
+    motor_pwm_cycle.ui16_value = ((uint16_t) (MIDDLE_PWM_DUTY_CYCLE_MAX - ui8_temp)) * motor_pwm_cycle.ui8_duty_cycle;
+    ui8_temp = (uint8_t) (motor_pwm_cycle.ui16_value >> 8);
+    motor_pwm_cycle.ui8_value_c = MIDDLE_PWM_DUTY_CYCLE_MAX - ui8_temp;
   }
 
   // set final duty_cycle value
   // phase A
-  TIM1->CCR1H = (uint8_t) (ui8_value_a >> 7);
-  TIM1->CCR1L = (uint8_t) (ui8_value_a << 1);
+  TIM1->CCR1H = (uint8_t) (motor_pwm_cycle.ui8_value_a >> 7);
+  TIM1->CCR1L = (uint8_t) (motor_pwm_cycle.ui8_value_a << 1);
   // phase B
-  TIM1->CCR2H = (uint8_t) (ui8_value_c >> 7);
-  TIM1->CCR2L = (uint8_t) (ui8_value_c << 1);
+  TIM1->CCR2H = (uint8_t) (motor_pwm_cycle.ui8_value_c >> 7);
+  TIM1->CCR2L = (uint8_t) (motor_pwm_cycle.ui8_value_c << 1);
   // phase C
-  TIM1->CCR3H = (uint8_t) (ui8_value_b >> 7);
-  TIM1->CCR3L = (uint8_t) (ui8_value_b << 1);
+  TIM1->CCR3H = (uint8_t) (motor_pwm_cycle.ui8_value_b >> 7);
+  TIM1->CCR3L = (uint8_t) (motor_pwm_cycle.ui8_value_b << 1);
 
   // enable PWM signals only when MOTOR_CONTROLLER_STATE_OK
-  if (ui8_motor_controller_state == MOTOR_CONTROLLER_STATE_OK)
+  if (motor_pwm_cycle.ui8_motor_controller_state == MOTOR_CONTROLLER_STATE_OK)
   {
-    TIM1->BKR |= TIM1_BKR_MOE;
+    HAL_TIM1_OUTPUTS_ENABLE ();
   }
   /****************************************************************************/
 
   /****************************************************************************/
   // calc PAS timming between each positive pulses, in PWM cycles ticks
   // calc PAS on and off timming of each pulse, in PWM cycles ticks
-  ui16_pas_counter++;
+  motor_pwm_cycle.ui16_pas_counter++;
 
   // detect PAS signal changes
-  if ((PAS__PORT->IDR & PAS__PIN) == 0)
+  if (HAL_GPIO_READ_INPUT_PIN (PAS__PORT, PAS__PIN) == 0)
   {
-    ui8_pas_state = 0;
-    ui16_pas_off_time_counter++;
+    motor_pwm_cycle.ui8_pas_state = 0;
+    motor_pwm_cycle.ui16_pas_off_time_counter++;
   }
   else
   {
-    ui8_pas_state = 1;
-    ui16_pas_on_time_counter++;
+    motor_pwm_cycle.ui8_pas_state = 1;
+    motor_pwm_cycle.ui16_pas_on_time_counter++;
   }
 
-  if (ui8_pas_state != ui8_pas_state_old) // PAS signal did change
+  if (motor_pwm_cycle.ui8_pas_state != motor_pwm_cycle.ui8_pas_state_old) // PAS signal did change
   {
-    ui8_pas_state_old = ui8_pas_state;
+    motor_pwm_cycle.ui8_pas_state_old = motor_pwm_cycle.ui8_pas_state;
 
-    if (ui8_pas_state == 1) // consider only when PAS signal transition from 0 to 1
+    if (motor_pwm_cycle.ui8_pas_state == 1) // consider only when PAS signal transition from 0 to 1
     {
       // limit PAS cadence to be less than PAS_ABSOLUTE_MAX_CADENCE_PWM_CYCLE_TICKS
-      if (ui16_pas_counter < ((uint16_t) PAS_ABSOLUTE_MAX_CADENCE_PWM_CYCLE_TICKS)) { ui16_pas_counter = PAS_ABSOLUTE_MAX_CADENCE_PWM_CYCLE_TICKS; }
+      if (motor_pwm_cycle.ui16_pas_counter < ((uint16_t) PAS_ABSOLUTE_MAX_CADENCE_PWM_CYCLE_TICKS)) { motor_pwm_cycle.ui16_pas_counter = PAS_ABSOLUTE_MAX_CADENCE_PWM_CYCLE_TICKS; }
 
-      ui16_pas_pwm_cycles_ticks = ui16_pas_counter;
-      ui16_pas_counter = 0;
+      motor_pwm_cycle.ui16_pas_pwm_cycles_ticks = motor_pwm_cycle.ui16_pas_counter;
+      motor_pwm_cycle.ui16_pas_counter = 0;
+      motor_pwm_cycle.ui8_snapshot_changed = 1;
     }
     else
     {
 #if (PAS_DIRECTION == PAS_DIRECTION_RIGHT)
-      if (ui16_pas_on_time_counter > ui16_pas_off_time_counter)
+      if (motor_pwm_cycle.ui16_pas_on_time_counter > motor_pwm_cycle.ui16_pas_off_time_counter)
 #else
-      if (ui16_pas_on_time_counter <= ui16_pas_off_time_counter)
+      if (motor_pwm_cycle.ui16_pas_on_time_counter <= motor_pwm_cycle.ui16_pas_off_time_counter)
 #endif
-      { ui8_pas_direction = 1; }
-      else { ui8_pas_direction = 0; }
+      { motor_pwm_cycle.ui8_pas_direction = 1; }
+      else { motor_pwm_cycle.ui8_pas_direction = 0; }
+      motor_pwm_cycle.ui8_snapshot_changed = 1;
 
-      ui16_pas_off_time_counter = 0;
-      ui16_pas_on_time_counter = 0;
+      motor_pwm_cycle.ui16_pas_off_time_counter = 0;
+      motor_pwm_cycle.ui16_pas_on_time_counter = 0;
     }
   }
 
   // limit min PAS cadence
-  if (ui16_pas_counter > ((uint16_t) PAS_ABSOLUTE_MIN_CADENCE_PWM_CYCLE_TICKS))
+  if (motor_pwm_cycle.ui16_pas_counter > ((uint16_t) PAS_ABSOLUTE_MIN_CADENCE_PWM_CYCLE_TICKS))
   {
-    ui16_pas_pwm_cycles_ticks = (uint16_t) PAS_ABSOLUTE_MIN_CADENCE_PWM_CYCLE_TICKS;
-    ui16_pas_counter = 0;
-    ui16_pas_on_time_counter = 0;
-    ui16_pas_off_time_counter = 0;
-    ui8_pas_direction = 1;
+    motor_pwm_cycle.ui16_pas_pwm_cycles_ticks = (uint16_t) PAS_ABSOLUTE_MIN_CADENCE_PWM_CYCLE_TICKS;
+    motor_pwm_cycle.ui16_pas_counter = 0;
+    motor_pwm_cycle.ui16_pas_on_time_counter = 0;
+    motor_pwm_cycle.ui16_pas_off_time_counter = 0;
+    motor_pwm_cycle.ui8_pas_direction = 1;
+    motor_pwm_cycle.ui8_snapshot_changed = 1;
   }
   /****************************************************************************/
 
   /****************************************************************************/
   // calc wheel speed sensor timming between each positive pulses, in PWM cycles ticks
-  ui16_wheel_speed_sensor_counter++;
+  motor_pwm_cycle.ui16_wheel_speed_sensor_counter++;
 
   // detect wheel speed sensor signal changes
-  if ((WHEEL_SPEED_SENSOR__PORT->IDR & WHEEL_SPEED_SENSOR__PIN) == 0) { ui8_wheel_speed_sensor_state = 0; }
-  else { ui8_wheel_speed_sensor_state = 1; }
+  if (HAL_GPIO_READ_INPUT_PIN (WHEEL_SPEED_SENSOR__PORT, WHEEL_SPEED_SENSOR__PIN) == 0) { motor_pwm_cycle.ui8_wheel_speed_sensor_state = 0; }
+  else { motor_pwm_cycle.ui8_wheel_speed_sensor_state = 1; }
 
-  if (ui8_wheel_speed_sensor_state != ui8_wheel_speed_sensor_state_old) // wheel speed sensor signal did change
+  if (motor_pwm_cycle.ui8_wheel_speed_sensor_state != motor_pwm_cycle.ui8_wheel_speed_sensor_state_old) // wheel speed sensor signal did change
   {
-    ui8_wheel_speed_sensor_state_old = ui8_wheel_speed_sensor_state;
+    motor_pwm_cycle.ui8_wheel_speed_sensor_state_old = motor_pwm_cycle.ui8_wheel_speed_sensor_state;
 
-    if (ui8_wheel_speed_sensor_state == 1) // consider only when wheel speed sensor signal transition from 0 to 1
+    if (motor_pwm_cycle.ui8_wheel_speed_sensor_state == 1) // consider only when wheel speed sensor signal transition from 0 to 1
     {
-      ui16_wheel_speed_sensor_pwm_cycles_ticks = ui16_wheel_speed_sensor_counter;
-      ui16_wheel_speed_sensor_counter = 0;
-      ui8_wheel_speed_sensor_is_disconnected = 0;
+      motor_pwm_cycle.ui16_wheel_speed_sensor_pwm_cycles_ticks = motor_pwm_cycle.ui16_wheel_speed_sensor_counter;
+      motor_pwm_cycle.ui16_wheel_speed_sensor_counter = 0;
+      motor_pwm_cycle.ui8_wheel_speed_sensor_is_disconnected = 0;
+      motor_pwm_cycle.ui8_snapshot_changed = 1;
     }
   }
 
   // limit min wheel speed
-  if (ui16_wheel_speed_sensor_counter > ((uint16_t) WHEEL_SPEED_SENSOR_MIN_PWM_CYCLE_TICKS))
+  if (motor_pwm_cycle.ui16_wheel_speed_sensor_counter > ((uint16_t) WHEEL_SPEED_SENSOR_MIN_PWM_CYCLE_TICKS))
+  {
+    motor_pwm_cycle.ui16_wheel_speed_sensor_pwm_cycles_ticks = (uint16_t) WHEEL_SPEED_SENSOR_MIN_PWM_CYCLE_TICKS;
+    motor_pwm_cycle.ui16_wheel_speed_sensor_counter = 0;
+    motor_pwm_cycle.ui8_wheel_speed_sensor_is_disconnected = 1;
+    motor_pwm_cycle.ui8_snapshot_changed = 1;
+  }
+  /****************************************************************************/
+
+  /****************************************************************************/
+  // publish the values for the main loop, see motor_snapshot_read ()
+  if (motor_pwm_cycle.ui8_snapshot_changed)
   {
-    ui16_wheel_speed_sensor_pwm_cycles_ticks = (uint16_t) WHEEL_SPEED_SENSOR_MIN_PWM_CYCLE_TICKS;
-    ui16_wheel_speed_sensor_counter = 0;
-    ui8_wheel_speed_sensor_is_disconnected = 1;
+    motor_pwm_cycle.ui8_snapshot_changed = 0;
+    p_snapshot = &motor_snapshot [(motor_pwm_cycle.ui8_motor_snapshot_sequence + 1) & 1];
+    p_snapshot->ui16_motor_speed_erps = motor_pwm_cycle.ui16_motor_speed_erps;
+    p_snapshot->ui16_PWM_cycles_counter_total = motor_pwm_cycle.ui16_PWM_cycles_counter_total;
+    p_snapshot->ui16_pas_pwm_cycles_ticks = motor_pwm_cycle.ui16_pas_pwm_cycles_ticks;
+    p_snapshot->ui8_pas_direction = motor_pwm_cycle.ui8_pas_direction;
+    p_snapshot->ui16_wheel_speed_sensor_pwm_cycles_ticks = motor_pwm_cycle.ui16_wheel_speed_sensor_pwm_cycles_ticks;
+    p_snapshot->ui8_wheel_speed_sensor_is_disconnected = motor_pwm_cycle.ui8_wheel_speed_sensor_is_disconnected;
+    motor_pwm_cycle.ui8_motor_snapshot_sequence++; // only after the buffer is complete
   }
   /****************************************************************************/
 
   /****************************************************************************/
   // reload watchdog timer, every PWM cycle to avoid automatic reset of the microcontroller
-  if (ui8_first_time_run_flag)
+  if (motor_pwm_cycle.ui8_first_time_run_flag)
   { // from the init of watchdog up to first reset on PWM cycle interrupt,
     // it can take up to 250ms and so we need to init here inside the PWM cycle
-    ui8_first_time_run_flag = 0;
+    motor_pwm_cycle.ui8_first_time_run_flag = 0;
     watchdog_init ();
   }
   else
@@ -778,33 +891,56 @@ void TIM1_UPD_OVF_TRG_BRK_IRQHandler(void) __interrupt(TIM1_UPD_OVF_TRG_BRK_IRQH
 
   /****************************************************************************/
   // clears the TIM1 interrupt TIM1_IT_UPDATE pending bit
-  TIM1->SR1 = (uint8_t)(~(uint8_t)TIM1_IT_UPDATE);
+  HAL_TIM1_CLEAR_UPDATE_FLAG ();
   /****************************************************************************/
 }
 
 void motor_disable_PWM (void)
 {
-  TIM1_CtrlPWMOutputs(DISABLE);
+  HAL_TIM1_OUTPUTS_DISABLE ();
 }
 
 void motor_enable_PWM (void)
 {
-  TIM1_CtrlPWMOutputs(ENABLE);
+  HAL_TIM1_OUTPUTS_ENABLE ();
 }
 
+// brake and over current interrupts also change the state bits
 void motor_controller_set_state (uint8_t ui8_state)
 {
-  ui8_motor_controller_state |= ui8_state;
+  disableInterrupts ();
+  motor_pwm_cycle.ui8_motor_controller_state |= ui8_state;
+  enableInterrupts ();
 }
 
 void motor_controller_reset_state (uint8_t ui8_state)
 {
-  ui8_motor_controller_state &= ~ui8_state;
+  disableInterrupts ();
+  motor_pwm_cycle.ui8_motor_controller_state &= ~ui8_state;
+  enableInterrupts ();
 }
 
 uint8_t motor_controller_state_is_set (uint8_t ui8_state)
 {
-  return ui8_motor_controller_state & ui8_state;
+  return motor_pwm_cycle.ui8_motor_controller_state & ui8_state;
+}
+
+void motor_pwm_cycle_init (void)
+{
+  uint8_t *p_ui8_byte = (uint8_t *) &motor_pwm_cycle;
+  uint8_t ui8_i;
+
+  for (ui8_i = 0; ui8_i < sizeof (struc_motor_pwm_cycle); ui8_i++) { p_ui8_byte [ui8_i] = 0; }
+
+  motor_pwm_cycle.ui8_motor_commutation_type = BLOCK_COMMUTATION;
+  motor_pwm_cycle.ui8_angle_correction = 127;
+  motor_pwm_cycle.ui8_motor_controller_state = MOTOR_CONTROLLER_STATE_OK;
+  motor_pwm_cycle.ui8_motor_state = MOTOR_STATE_STOP;
+  motor_pwm_cycle.ui16_pas_counter = (uint16_t) PAS_ABSOLUTE_MIN_CADENCE_PWM_CYCLE_TICKS;
+  motor_pwm_cycle.ui16_pas_pwm_cycles_ticks = (uint16_t) PAS_ABSOLUTE_MIN_CADENCE_PWM_CYCLE_TICKS;
+  motor_pwm_cycle.ui16_wheel_speed_sensor_pwm_cycles_ticks = (uint16_t) WHEEL_SPEED_SENSOR_MIN_PWM_CYCLE_TICKS;
+  motor_pwm_cycle.ui8_wheel_speed_sensor_is_disconnected = 1;
+  motor_pwm_cycle.ui8_first_time_run_flag = 1;
 }
 
 void hall_sensor_init (void)
@@ -832,6 +968,7 @@ void motor_init (void)
 
   motor_set_current_max (ADC_MOTOR_CURRENT_MAX);
   motor_set_regen_current_max (4);
+  motor_command.ui8_adc_target_motor_regen_current = motor_pwm_cycle.ui8_motor_total_current_offset;
   motor_set_pwm_duty_cycle_ramp_up_inverse_step (PWM_DUTY_CYCLE_RAMP_UP_INVERSE_STEP); // each step = 64us
   motor_set_pwm_duty_cycle_ramp_down_inverse_step (PWM_DUTY_CYCLE_RAMP_DOWN_INVERSE_STEP); // each step = 64us
 }
@@ -839,13 +976,16 @@ void motor_init (void)
 void motor_set_pwm_duty_cycle_target (uint8_t ui8_value)
 {
   if (ui8_value > PWM_DUTY_CYCLE_MAX) { ui8_value = PWM_DUTY_CYCLE_MAX; }
+  if (ui8_value) { motor_idle_exit (); }
 
-  ui8_duty_cycle_target = ui8_value;
+  motor_command.ui8_duty_cycle_target = ui8_value;
+  motor_command_publish ();
 }
 
 void motor_set_current_max (uint8_t ui8_value)
 {
-  ui8_adc_target_motor_current_max = ui8_motor_total_current_offset + ui8_value;
+  motor_command.ui8_adc_target_motor_current_max = motor_pwm_cycle.ui8_motor_total_current_offset + ui8_value;
+  motor_command_publish ();
 }
 
 int8_t motor_get_current_filtered_10b (void)
@@ -855,27 +995,68 @@ int8_t motor_get_current_filtered_10b (void)
 
 void motor_set_regen_current_max (uint8_t ui8_value)
 {
-  ui8_adc_target_motor_regen_current_max = ui8_motor_total_current_offset - ui8_value;
+  motor_pwm_cycle.ui8_adc_target_motor_regen_current_max = motor_pwm_cycle.ui8_motor_total_current_offset - ui8_value;
 }
 
 void motor_set_pwm_duty_cycle_ramp_up_inverse_step (uint16_t ui16_value)
 {
-  ui16_duty_cycle_ramp_up_inverse_step = ui16_value;
+  motor_command.ui16_duty_cycle_ramp_up_inverse_step = ui16_value;
+  motor_command_publish ();
 }
 
 void motor_set_pwm_duty_cycle_ramp_down_inverse_step (uint16_t ui16_value)
 {
-  ui16_duty_cycle_ramp_down_inverse_step = ui16_value;
+  motor_command.ui16_duty_cycle_ramp_down_inverse_step = ui16_value;
+  motor_command_publish ();
 }
 
 uint16_t ui16_motor_get_motor_speed_erps (void)
 {
-  return ui16_motor_speed_erps;
+  struc_motor_snapshot snapshot;
+
+  motor_snapshot_read (&snapshot);
+  return snapshot.ui16_motor_speed_erps;
 }
 
 uint16_t motor_get_er_PWM_ticks (void)
 {
-  return ui16_PWM_cycles_counter_total;
+  struc_motor_snapshot snapshot;
+
+  motor_snapshot_read (&snapshot);
+  return snapshot.ui16_PWM_cycles_counter_total;
+}
+
+// copy again when the PWM cycle interrupt did publish twice while copying, the second time on the buffer being copied
+void motor_snapshot_read (struc_motor_snapshot *p_snapshot)
+{
+  uint8_t ui8_sequence;
+  volatile struc_motor_snapshot *p_last;
+
+  do
+  {
+    ui8_sequence = motor_pwm_cycle.ui8_motor_snapshot_sequence;
+    p_last = &motor_snapshot [ui8_sequence & 1];
+    p_snapshot->ui16_motor_speed_erps = p_last->ui16_motor_speed_erps;
+    p_snapshot->ui16_PWM_cycles_counter_total = p_last->ui16_PWM_cycles_counter_total;
+    p_snapshot->ui16_pas_pwm_cycles_ticks = p_last->ui16_pas_pwm_cycles_ticks;
+    p_snapshot->ui8_pas_direction = p_last->ui8_pas_direction;
+    p_snapshot->ui16_wheel_speed_sensor_pwm_cycles_ticks = p_last->ui16_wheel_speed_sensor_pwm_cycles_ticks;
+    p_snapshot->ui8_wheel_speed_sensor_is_disconnected = p_last->ui8_wheel_speed_sensor_is_disconnected;
+  } while (((uint8_t) (motor_pwm_cycle.ui8_motor_snapshot_sequence - ui8_sequence)) > 1);
+}
+
+// the PWM cycle interrupt reads the buffer of motor_pwm_cycle.ui8_motor_command_sequence and never the other one, written here
+void motor_command_publish (void)
+{
+  volatile struc_motor_command *p_next = &motor_command_buffer [(uint8_t) (motor_pwm_cycle.ui8_motor_command_sequence + 1) & 1];
+
+  p_next->ui8_duty_cycle_target = motor_command.ui8_duty_cycle_target;
+  p_next->ui8_adc_target_motor_current_max = motor_command.ui8_adc_target_motor_current_max;
+  p_next->ui8_adc_target_motor_regen_current = motor_command.ui8_adc_target_motor_regen_current;
+  p_next->ui8_motor_regen_duty_cycle_min = motor_command.ui8_motor_regen_duty_cycle_min;
+  p_next->ui16_duty_cycle_ramp_up_inverse_step = motor_command.ui16_duty_cycle_ramp_up_inverse_step;
+  p_next->ui16_duty_cycle_ramp_down_inverse_step = motor_command.ui16_duty_cycle_ramp_down_inverse_step;
+  motor_pwm_cycle.ui8_motor_command_sequence++;
 }
 
 void motor_controller_set_target_speed_erps (uint16_t ui16_erps)
@@ -923,7 +1104,7 @@ uint8_t motor_speed_controller (void)
   else if (i16_output < (-MOTOR_SPEED_CONTROLLER_OUTPUT_MAX)) i16_output = -MOTOR_SPEED_CONTROLLER_OUTPUT_MAX;
   i16_output >>= 5; // divide to 64, as MOTOR_SPEED_CONTROLLER_KP is 64x; avoid using floats
 
-  i16_output = ui8_duty_cycle + i16_output;
+  i16_output = motor_pwm_cycle.ui8_duty_cycle + i16_output;
   if (i16_output > PWM_DUTY_CYCLE_MAX) i16_output = PWM_DUTY_CYCLE_MAX;
   if (i16_output < 0) i16_output = 0;
 
@@ -952,7 +1133,7 @@ uint8_t motor_current_controller (void)
   else if (i16_output < (-MOTOR_CURRENT_CONTROLLER_OUTPUT_MAX)) i16_output = -MOTOR_CURRENT_CONTROLLER_OUTPUT_MAX;
   i16_output >>= 5; // divide to 64, avoid using floats
 
-  i16_output = ui8_duty_cycle + i16_output;
+  i16_output = motor_pwm_cycle.ui8_duty_cycle + i16_output;
   if (i16_output > PWM_DUTY_CYCLE_MAX) i16_output = PWM_DUTY_CYCLE_MAX;
   if (i16_output < 0) i16_output = 0;
 
@@ -966,8 +1147,17 @@ void do_battery_voltage_protection (void)
   ui16_adc_battery_voltage_accumulated += ((uint16_t) ui8_adc_read_battery_voltage ());
   ui8_adc_battery_voltage_filtered = ui16_adc_battery_voltage_accumulated >> 6;
 
-  if (ui8_adc_battery_voltage_filtered < ((uint8_t) ADC_BATTERY_VOLTAGE_MIN))
+  // under ADC_BATTERY_VOLTAGE_MIN the motor current is already derated to 0 (battery_controller ()), so the
+  // voltage only gets to the cut off when the battery is really empty
+  if (ui8_adc_battery_voltage_filtered < ((uint8_t) ADC_BATTERY_VOLTAGE_CUT_OFF))
   {
+    // battery is about to be empty: save the statistics while there is still power
+    if (!motor_controller_state_is_set (MOTOR_CONTROLLER_STATE_UNDER_VOLTAGE))
+    {
+      statistics_save ();
+      fault_log_add (FAULT_LOG_UNDER_VOLTAGE);
+    }
+
     // motor will stop and battery symbol on LCD will be empty and flashing
     motor_controller_set_state (MOTOR_CONTROLLER_STATE_UNDER_VOLTAGE);
     motor_disable_PWM ();
@@ -975,6 +1165,163 @@ void do_battery_voltage_protection (void)
   }
 }
 
+// Regen current target for the PWM cycle regen current controller: grows with the motor speed and with the
+// brake time, is 0 at low speed or with the battery full.
+// Regen current is max at about half of the back EMF duty_cycle and goes to 0 at duty_cycle = 0 (motor phases
+// shorted), so the controller only works over that half: ui8_motor_regen_duty_cycle_min.
+void motor_regen_controller (void)
+{
+  uint16_t ui16_motor_speed_erps;
+  uint8_t ui8_regen_current;
+  uint8_t ui8_duty_cycle_zero;
+  uint16_t ui16_erps_zero;
+  uint32_t ui32_duty_cycle_min;
+
+  if (!motor_controller_state_is_set (MOTOR_CONTROLLER_STATE_BRAKE))
+  {
+    ui8_motor_regen_current = 0;
+    motor_command.ui8_motor_regen_duty_cycle_min = 0;
+    motor_pwm_cycle.ui8_motor_regen_duty_cycle_zero = 0;
+    // the PWM cycle regen current filter starts from 0A on the next brake
+    disableInterrupts ();
+    motor_pwm_cycle.ui16_motor_regen_current_filtered_x16 = ((uint16_t) motor_pwm_cycle.ui8_motor_total_current_offset) << 4;
+    enableInterrupts ();
+  }
+  else
+  {
+    ui16_motor_speed_erps = ui16_motor_get_motor_speed_erps ();
+
+    // back EMF duty_cycle found when the current went negative, goes down with the motor speed
+    disableInterrupts ();
+    ui8_duty_cycle_zero = motor_pwm_cycle.ui8_motor_regen_duty_cycle_zero;
+    ui16_erps_zero = motor_pwm_cycle.ui16_motor_regen_erps_zero;
+    enableInterrupts ();
+    if ((ui8_duty_cycle_zero > 0) && (ui16_erps_zero > 0))
+    {
+      ui32_duty_cycle_min = ((((uint32_t) ui8_duty_cycle_zero) * ui16_motor_speed_erps) / ui16_erps_zero) >> 1;
+      if (ui32_duty_cycle_min > 255) { ui32_duty_cycle_min = 255; }
+      motor_command.ui8_motor_regen_duty_cycle_min = (uint8_t) ui32_duty_cycle_min;
+    }
+    if (ui16_motor_speed_erps <= MOTOR_REGEN_ERPS_MIN) { ui8_regen_current = 0; }
+    else if (ui16_motor_speed_erps >= MOTOR_REGEN_ERPS_FULL) { ui8_regen_current = ADC_MOTOR_REGEN_CURRENT_MAX; }
+    else
+    {
+      ui8_regen_current = (uint8_t) ((((uint16_t) (ui16_motor_speed_erps - MOTOR_REGEN_ERPS_MIN)) * ADC_MOTOR_REGEN_CURRENT_MAX) /
+	  (MOTOR_REGEN_ERPS_FULL - MOTOR_REGEN_ERPS_MIN));
+    }
+
+    if (ui8_adc_battery_voltage_filtered >= ((uint8_t) ADC_BATTERY_VOLTAGE_MAX)) { ui8_regen_current = 0; }
+
+    if ((ui8_motor_regen_current + MOTOR_REGEN_CURRENT_RAMP_STEP) < ui8_regen_current)
+    {
+      ui8_motor_regen_current += MOTOR_REGEN_CURRENT_RAMP_STEP;
+    }
+    else { ui8_motor_regen_current = ui8_regen_current; }
+  }
+
+  motor_command.ui8_adc_target_motor_regen_current = motor_pwm_cycle.ui8_motor_total_current_offset - ui8_motor_regen_current;
+  motor_command_publish ();
+}
+
+// Over current recovery, see MOTOR_OVER_CURRENT_COOL_DOWN_MS. PWM starts again on the duty_cycle of the fault, scaled
+// down with the motor speed, so a motor that is still turning is not braked hard.
+void motor_over_current_controller (void)
+{
+  uint32_t ui32_duty_cycle;
+
+  if (!motor_controller_state_is_set (MOTOR_CONTROLLER_STATE_OVER_CURRENT))
+  {
+    // running without faults: forget the old ones and ramp up the current
+    if (system_time_is_timeout (ui32_motor_over_current_start_ms, MOTOR_OVER_CURRENT_WINDOW_MS)) { ui8_motor_over_current_faults = 0; }
+
+    if (ui8_motor_over_current_current_max < ADC_MOTOR_CURRENT_MAX) { ui8_motor_over_current_current_max++; }
+    return;
+  }
+
+  if (ui8_motor_over_current_latched) { return; }
+
+  // new fault
+  if (ui16_motor_over_current_cool_down_ms == 0)
+  {
+    if (++ui8_motor_over_current_faults > MOTOR_OVER_CURRENT_RETRIES_MAX)
+    {
+      ui8_motor_over_current_latched = 1;
+      fault_log_add (FAULT_LOG_OVER_CURRENT_LATCHED);
+      return;
+    }
+
+    ui16_motor_over_current_cool_down_ms = MOTOR_OVER_CURRENT_COOL_DOWN_MS << (ui8_motor_over_current_faults - 1);
+    ui16_motor_over_current_erps = ui16_motor_get_motor_speed_erps ();
+    ui32_motor_over_current_start_ms = ui32_system_time_get_ms ();
+    return;
+  }
+
+  // other protections keep the PWM disabled, the power mosfets cool down meanwhile
+  if (motor_controller_state_is_set (MOTOR_CONTROLLER_STATE_UNDER_VOLTAGE | MOTOR_CONTROLLER_STATE_MOTOR_BLOCKED)) { return; }
+
+  if (!system_time_is_timeout (ui32_motor_over_current_start_ms, ui16_motor_over_current_cool_down_ms)) { return; }
+
+  ui32_duty_cycle = 0;
+  if (ui16_motor_over_current_erps > 0)
+  {
+    ui32_duty_cycle = (((uint32_t) ui8_motor_over_current_duty_cycle) * ui16_motor_get_motor_speed_erps ()) /
+	ui16_motor_over_current_erps;
+    if (ui32_duty_cycle > ui8_motor_over_current_duty_cycle) { ui32_duty_cycle = ui8_motor_over_current_duty_cycle; }
+  }
+
+  // duty_cycle and its target on the same PWM cycle: the interrupt takes the new target on its next cycle
+  motor_command.ui8_duty_cycle_target = (uint8_t) ui32_duty_cycle;
+  disableInterrupts ();
+  motor_pwm_cycle.ui8_duty_cycle = (uint8_t) ui32_duty_cycle;
+  motor_command_publish ();
+  motor_pwm_cycle.ui8_motor_controller_state &= (uint8_t) ~MOTOR_CONTROLLER_STATE_OVER_CURRENT;
+  enableInterrupts ();
+
+  if (ui8_motor_controller_error == MOTOR_CONTROLLER_ERROR_06_SHORT_CIRCUIT) { motor_controller_clear_error (); }
+  ui8_motor_over_current_current_max = ADC_MOTOR_CURRENT_MAX >> 1;
+  ui16_motor_over_current_cool_down_ms = 0;
+  ui32_motor_over_current_start_ms = ui32_system_time_get_ms ();
+  ui16_motor_over_current_retries++;
+
+  // MOE can't be set while the TIM1 break input is still active, the flag only records it happened
+  HAL_TIM1_CLEAR_BREAK_FLAG ();
+  motor_enable_PWM ();
+}
+
+// bike parked, see MOTOR_IDLE_PWM_CYCLES. The watchdog timeout is made longer before the PWM cycle interrupt period
+void motor_idle_enter (void)
+{
+  if (motor_pwm_cycle.ui8_idle == MOTOR_IDLE_ON) { return; }
+
+  disableInterrupts ();
+  HAL_IWDG_SET_RELOAD (MOTOR_IDLE_WATCHDOG_RELOAD);
+  TIM1->RCR = (MOTOR_IDLE_PWM_CYCLES << 1) - 1; // center aligned: 2 update events each PWM period
+  motor_pwm_cycle.ui8_idle = MOTOR_IDLE_ON;
+  enableInterrupts ();
+}
+
+// the PWM cycle interrupt also leaves the deep idle by itself, on the hall sensors, PAS and wheel speed sensor signals
+void motor_idle_exit (void)
+{
+  disableInterrupts ();
+  if (motor_pwm_cycle.ui8_idle == MOTOR_IDLE_ON)
+  {
+    TIM1->RCR = 1;
+    motor_pwm_cycle.ui8_idle = MOTOR_IDLE_LEAVING; // the PWM cycle interrupt sets back the watchdog timeout
+  }
+  enableInterrupts ();
+}
+
+uint8_t ui8_motor_get_over_current_current_max (void)
+{
+  return ui8_motor_over_current_current_max;
+}
+
+uint16_t ui16_motor_get_over_current_retries (void)
+{
+  return ui16_motor_over_current_retries;
+}
+
 void do_motor_controller_mode (void)
 {
   uint8_t ui8_pwm_duty_cycle_speed_controller;
@@ -996,6 +1343,7 @@ void do_motor_controller_mode (void)
   {
     motor_set_pwm_duty_cycle_target (ui8_pwm_duty_cycle);
   }
+  else { motor_set_pwm_duty_cycle_target (0); }
 }
 
 uint8_t motor_get_ADC_battery_voltage_filtered (void)
@@ -1003,6 +1351,11 @@ uint8_t motor_get_ADC_battery_voltage_filtered (void)
   return ui8_adc_battery_voltage_filtered;
 }
 
+uint16_t ui16_motor_get_ADC_battery_voltage_filtered_x64 (void)
+{
+  return ui16_adc_battery_voltage_accumulated;
+}
+
 void motor_controller_set_error (uint8_t error)
 {
   ui8_motor_controller_error = error;
@@ -1022,7 +1375,7 @@ void motor_set_pwm_duty_cycle (uint8_t ui8_value)
 {
   if (ui8_value > PWM_DUTY_CYCLE_MAX) { ui8_value = PWM_DUTY_CYCLE_MAX; }
 
-  ui8_duty_cycle = ui8_value;
+  motor_pwm_cycle.ui8_duty_cycle = ui8_value;
 }
 
 void do_motor_state_machine (void)
@@ -1030,33 +1383,36 @@ void do_motor_state_machine (void)
   uint16_t ui16_motor_speed_erps;
 
   ui16_motor_speed_erps = ui16_motor_get_motor_speed_erps ();
-  switch (ui8_motor_state)
+  switch (motor_pwm_cycle.ui8_motor_state)
   {
     case MOTOR_STATE_STOP:
     if ((ui16_motor_speed_erps < 5) && (!ebike_app_is_throttle_released ()))
     {
-      ui8_motor_startup_counter = 0;
-      ui8_motor_state = MOTOR_STATE_STARTUP;
+      ui32_motor_state_start_ms = ui32_system_time_get_ms ();
+      motor_pwm_cycle.ui8_motor_state = MOTOR_STATE_STARTUP;
     }
     else if (ui16_motor_speed_erps > 4)
     {
-      ui8_motor_state = MOTOR_STATE_RUNNING;
+      motor_pwm_cycle.ui8_motor_state = MOTOR_STATE_RUNNING;
     }
     break;
 
     case MOTOR_STATE_STARTUP:
-    if (ui8_motor_startup_counter++ > 19) // 20 * 100ms; 2.5 seconds max time
+    // PWM disabled waiting for the over current recovery: motor can't start, that doesn't mean it is blocked
+    if (motor_controller_state_is_set (MOTOR_CONTROLLER_STATE_OVER_CURRENT)) { ui32_motor_state_start_ms = ui32_system_time_get_ms (); }
+    else if (system_time_is_timeout (ui32_motor_state_start_ms, MOTOR_STARTUP_TIME_MAX_MS))
     {
+      fault_log_add (FAULT_LOG_MOTOR_BLOCKED);
       motor_controller_set_state (MOTOR_CONTROLLER_STATE_MOTOR_BLOCKED);
       motor_disable_PWM ();
       ebike_app_cruise_control_stop ();
-      ui8_motor_state = MOTOR_STATE_COOL;
-      ui8_motor_startup_counter = 0;
+      motor_pwm_cycle.ui8_motor_state = MOTOR_STATE_COOL;
+      ui32_motor_state_start_ms = ui32_system_time_get_ms ();
     }
 
     if (ui16_motor_speed_erps > 4)
     {
-      ui8_motor_state = MOTOR_STATE_RUNNING;
+      motor_pwm_cycle.ui8_motor_state = MOTOR_STATE_RUNNING;
     }
     break;
 
@@ -1066,15 +1422,14 @@ void do_motor_state_machine (void)
 
     // wait for the power mosfets cool down and for user release the throttle
     case MOTOR_STATE_COOL:
-    if (ui8_motor_startup_counter++ > 10) // 1 second timeout
+    if (system_time_is_timeout (ui32_motor_state_start_ms, MOTOR_COOL_DOWN_TIME_MS))
     {
-      ui8_motor_startup_counter = 11;
       if (ebike_app_is_throttle_released ())
       {
-	ui8_duty_cycle = 0;
-	ui8_duty_cycle_target = 0;
+	motor_set_pwm_duty_cycle_target (0);
+	motor_pwm_cycle.ui8_duty_cycle = 0;
 	motor_controller_reset_state (MOTOR_CONTROLLER_STATE_MOTOR_BLOCKED);
-        ui8_motor_state = MOTOR_STATE_STOP;
+        motor_pwm_cycle.ui8_motor_state = MOTOR_STATE_STOP;
       }
     }
     break;
@@ -1093,8 +1448,18 @@ void calc_motor_current_filtered (void)
 // motor overcurrent interrupt
 void EXTI_PORTD_IRQHandler(void) __interrupt(EXTI_PORTD_IRQHANDLER)
 {
-  // motor will stop and error symbol on LCD will be shown
-  motor_controller_set_state (MOTOR_CONTROLLER_STATE_OVER_CURRENT);
-  motor_disable_PWM ();
-  motor_controller_set_error (MOTOR_CONTROLLER_ERROR_06_SHORT_CIRCUIT);
+  // only the first one is logged: state is latched
+  if (!(motor_pwm_cycle.ui8_motor_controller_state & MOTOR_CONTROLLER_STATE_OVER_CURRENT))
+  {
+    FAULT_LOG_ADD_FROM_INTERRUPT (FAULT_LOG_OVER_CURRENT);
+    ui8_motor_over_current_duty_cycle = motor_pwm_cycle.ui8_duty_cycle;
+    EVENTS_POST_FROM_INTERRUPT (EVENTS_SOURCE_OVER_CURRENT, EVENT_OVER_CURRENT);
+  }
+
+  // motor will stop and error symbol on LCD will be shown. Registers and variables are written directly, as
+  // function calls from interrupts are not reliable with SDCC. With MOTOR_OVER_CURRENT_TIM1_BREAK the TIM1 break
+  // input already disabled the outputs and this only records the fault
+  HAL_TIM1_OUTPUTS_DISABLE ();
+  motor_pwm_cycle.ui8_motor_controller_state |= MOTOR_CONTROLLER_STATE_OVER_CURRENT;
+  ui8_motor_controller_error = MOTOR_CONTROLLER_ERROR_06_SHORT_CIRCUIT;
 }
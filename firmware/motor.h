@@ -10,6 +10,7 @@
 #define _MOTOR_H_
 
 #include <stdint.h>
+#include "main.h"
 
 // motor states
 #define BLOCK_COMMUTATION 			1
@@ -22,6 +23,11 @@
 #define MOTOR_STATE_COOL 	3
 #define MOTOR_STATE_RUNNING 	4
 
+// deep idle, see MOTOR_IDLE_PWM_CYCLES
+#define MOTOR_IDLE_OFF		0
+#define MOTOR_IDLE_ON		1
+#define MOTOR_IDLE_LEAVING	2 // last long PWM cycle interrupt period, still with the longer watchdog timeout
+
 #define MOTOR_CONTROLLER_STATE_OK		1
 #define MOTOR_CONTROLLER_STATE_BRAKE		2
 #define MOTOR_CONTROLLER_STATE_OVER_CURRENT	4
@@ -38,19 +44,115 @@
 #define MOTOR_CONTROLLER_ERROR_06_SHORT_CIRCUIT		0x21
 #define MOTOR_CONTROLLER_ERROR_91_BATTERY_UNDER_VOLTAGE 0x91
 
-extern uint8_t ui8_motor_commutation_type;
-extern volatile uint8_t ui8_angle_correction;
-extern uint8_t ui8_adc_motor_total_current;
-extern uint8_t ui8_motor_total_current_offset;
-extern volatile uint8_t ui8_duty_cycle;
-extern uint8_t ui8_duty_cycle_target;
-extern volatile uint8_t ui8_duty_cycle;
-extern uint16_t ui16_PWM_cycles_counter_total;
+// variables used on every PWM cycle interrupt, on RAM page 0 for the short addressing, see MOTOR_PWM_CYCLE_ADDRESS
+typedef struct _motor_pwm_cycle
+{
+  // hall sensors, rotor angle and speed
+  uint8_t ui8_hall_sensors;
+  uint8_t ui8_hall_sensors_last;
+  uint8_t ui8_half_erps_flag;
+  uint8_t ui8_motor_commutation_type;
+  uint16_t ui16_PWM_cycles_counter;
+  uint16_t ui16_PWM_cycles_counter_6;
+  uint16_t ui16_PWM_cycles_counter_total;
+  uint16_t ui16_motor_speed_erps;
+  uint8_t ui8_motor_rotor_absolute_angle;
+  uint8_t ui8_motor_rotor_angle;
+  uint8_t ui8_interpolation_angle;
+  uint8_t ui8_sinewave_table_index;
+  volatile uint8_t ui8_angle_correction;
+  uint8_t ui8_flag_foc_read_id_current;
+  volatile uint8_t ui8_motor_state;
+
+  // duty_cycle controller
+  uint8_t ui8_motor_controller_state;
+  uint8_t ui8_adc_motor_total_current;
+  uint8_t ui8_adc_target_motor_current_max;
+  uint8_t ui8_motor_total_current_offset;
+  volatile uint8_t ui8_duty_cycle;
+  uint8_t ui8_duty_cycle_target;
+  uint8_t ui8_adc_target_motor_regen_current;
+  uint8_t ui8_motor_regen_duty_cycle_min;
+  uint16_t ui16_motor_regen_current_filtered_x16; // motor total current 8 bits ADC * 16, 1ms low pass filter
+  uint8_t ui8_motor_regen_step_counter;
+  uint8_t ui8_adc_target_motor_regen_current_max;
+  volatile uint8_t ui8_motor_regen_duty_cycle_zero; // duty_cycle when the regen current went negative
+  volatile uint16_t ui16_motor_regen_erps_zero;
+  uint16_t ui16_duty_cycle_ramp_up_inverse_step;
+  uint16_t ui16_duty_cycle_ramp_down_inverse_step;
+  uint16_t ui16_counter_duty_cycle_ramp_up;
+  uint16_t ui16_counter_duty_cycle_ramp_down;
+  uint8_t ui8_value_a;
+  uint8_t ui8_value_b;
+  uint8_t ui8_value_c;
+  uint16_t ui16_value;
+
+  // motor total current and battery voltage of every PWM cycle, read and reset by battery_controller ()
+  volatile uint32_t ui32_adc_battery_current_accumulated;
+  volatile uint32_t ui32_adc_battery_voltage_cycles_accumulated;
+  volatile uint16_t ui16_adc_battery_current_samples;
+
+  // PAS and wheel speed sensor
+  uint8_t ui8_pas_state;
+  uint8_t ui8_pas_state_old;
+  uint16_t ui16_pas_counter;
+  uint16_t ui16_pas_on_time_counter;
+  uint16_t ui16_pas_off_time_counter;
+  uint8_t ui8_wheel_speed_sensor_state;
+  uint8_t ui8_wheel_speed_sensor_state_old;
+  uint16_t ui16_wheel_speed_sensor_counter;
+  uint16_t ui16_pas_pwm_cycles_ticks;
+  uint8_t ui8_pas_direction;
+  uint16_t ui16_wheel_speed_sensor_pwm_cycles_ticks;
+  uint8_t ui8_wheel_speed_sensor_is_disconnected;
+
+  // exchange with the main loop, see motor_snapshot_read () and motor_command_publish ()
+  uint8_t ui8_snapshot_changed;
+  volatile uint8_t ui8_motor_snapshot_sequence; // last values on motor_snapshot [ui8_motor_snapshot_sequence & 1]
+  volatile uint8_t ui8_motor_command_sequence; // last values on motor_command_buffer [ui8_motor_command_sequence & 1]
+  uint8_t ui8_command_sequence; // ui8_motor_command_sequence of the values in use
+
+  uint8_t ui8_idle;
+
+  uint8_t ui8_first_time_run_flag;
+} struc_motor_pwm_cycle;
+
+extern struc_motor_pwm_cycle __at (MOTOR_PWM_CYCLE_ADDRESS) motor_pwm_cycle;
+
+// PWM cycle interrupt -> main loop: values of more than one byte, or that must be read together. The interrupt
+// writes them to one of 2 buffers and then increments a sequence counter, motor_snapshot_read () copies the other
+// one and copies again only when the interrupt did write it meanwhile. The interrupt never waits
+typedef struct _motor_snapshot
+{
+  uint16_t ui16_motor_speed_erps;
+  uint16_t ui16_PWM_cycles_counter_total;
+  uint16_t ui16_pas_pwm_cycles_ticks;
+  uint8_t ui8_pas_direction;
+  uint16_t ui16_wheel_speed_sensor_pwm_cycles_ticks;
+  uint8_t ui8_wheel_speed_sensor_is_disconnected;
+} struc_motor_snapshot;
+
+// main loop -> PWM cycle interrupt: the main loop changes motor_command and motor_command_publish () copies it to
+// the buffer the interrupt is not using, then increments a sequence counter. The interrupt takes the new values on
+// its next cycle, all of them together
+typedef struct _motor_command
+{
+  uint8_t ui8_duty_cycle_target;
+  uint8_t ui8_adc_target_motor_current_max;
+  uint8_t ui8_adc_target_motor_regen_current;
+  uint8_t ui8_motor_regen_duty_cycle_min;
+  uint16_t ui16_duty_cycle_ramp_up_inverse_step;
+  uint16_t ui16_duty_cycle_ramp_down_inverse_step;
+} struc_motor_command;
+
 extern int8_t i8_motor_current_filtered_10b;
 extern uint8_t ui8_pwm_duty_cycle_duty_cycle_controller;
 
 /***************************************************************************************/
 // Motor interface
+void motor_pwm_cycle_init (void); // must be called first, before any other init
+void motor_snapshot_read (struc_motor_snapshot *p_snapshot);
+void motor_command_publish (void);
 void hall_sensor_init (void); // must be called before using the motor
 void motor_init (void); // must be called before using the motor
 void motor_controller (void);
@@ -69,6 +171,7 @@ void motor_controller_reset_state (uint8_t state);
 uint8_t motor_controller_get_state (void);
 uint8_t motor_controller_state_is_set (uint8_t state);
 uint8_t motor_get_ADC_battery_voltage_filtered (void);
+uint16_t ui16_motor_get_ADC_battery_voltage_filtered_x64 (void);
 void motor_controller_set_target_speed_erps (uint16_t ui16_erps);
 void motor_controller_set_speed_erps_max (uint16_t ui16_erps);
 uint16_t motor_controller_get_target_speed_erps_max (void);
@@ -77,6 +180,10 @@ void motor_controller_set_error (uint8_t ui8_error);
 void motor_controller_clear_error (void);
 uint8_t motor_controller_get_error (void);
 void motor_set_pwm_duty_cycle (uint8_t ui8_value);
+void motor_idle_enter (void);
+void motor_idle_exit (void);
+uint8_t ui8_motor_get_over_current_current_max (void); // reduced after an over current fault
+uint16_t ui16_motor_get_over_current_retries (void); // since power up
 /***************************************************************************************/
 
 #endif /* _MOTOR_H_ */
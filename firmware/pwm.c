@@ -9,6 +9,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include "stm8s_tim1.h"
+#include "config.h"
 #include "gpio.h"
 #include "pwm.h"
 #include "motor.h"
@@ -45,7 +46,7 @@ void pwm_init_bipolar_4q (void)
 	       TIM1_OCPOLARITY_HIGH,
 	       TIM1_OCNPOLARITY_LOW,
 	       TIM1_OCIDLESTATE_RESET,
-	       TIM1_OCIDLESTATE_SET);
+	       TIM1_OCNIDLESTATE_SET);
 
   TIM1_OC3Init(TIM1_OCMODE_PWM1,
 #ifdef DISABLE_PWM_CHANNELS_1_3
@@ -62,6 +63,22 @@ void pwm_init_bipolar_4q (void)
 	       TIM1_OCNIDLESTATE_SET);
 
   // break, dead time and lock configuration
+#ifdef MOTOR_OVER_CURRENT_TIM1_BREAK
+  // over current comparator on TIM1_BKIN: on low level the hardware clears MOE and all the outputs go to the idle
+  // states above (all mosfets off); only software can set MOE again. Lock level 1 keeps break and idle
+  // states configuration from being changed until the next reset
+  GPIO_Init(CURRENT_MOTOR_TOTAL_OVER_BREAK__PORT,
+	    CURRENT_MOTOR_TOTAL_OVER_BREAK__PIN,
+	    GPIO_MODE_IN_FL_NO_IT);
+
+  TIM1_BDTRConfig(TIM1_OSSISTATE_ENABLE,
+		  TIM1_LOCKLEVEL_1,
+		  // hardware nees a dead time of 1us
+		  16, // DTG = 0; dead time in 62.5 ns steps; 1us/62.5ns = 16
+		  TIM1_BREAK_ENABLE,
+		  TIM1_BREAKPOLARITY_LOW,
+		  TIM1_AUTOMATICOUTPUT_DISABLE);
+#else
   TIM1_BDTRConfig(TIM1_OSSISTATE_ENABLE,
 		  TIM1_LOCKLEVEL_OFF,
 		  // hardware nees a dead time of 1us
@@ -69,6 +86,7 @@ void pwm_init_bipolar_4q (void)
 		  TIM1_BREAK_DISABLE,
 		  TIM1_BREAKPOLARITY_LOW,
 		  TIM1_AUTOMATICOUTPUT_DISABLE);
+#endif
 
   TIM1_ITConfig(TIM1_IT_UPDATE, ENABLE);
   TIM1_Cmd(ENABLE); // TIM1 counter enable
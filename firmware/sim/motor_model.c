@@ -0,0 +1,384 @@
+/*
+ * BMSBattery S series motor controllers firmware
+ *
+ * Copyright (C) Casainho, 2017.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+// Plant model for the simulator: 6 FET bridge with dead time, BLDC hub motor with hall sensors,
+// li-ion battery with internal resistance and the bike (mass, grade, rolling resistance, air drag).
+// The model reads the TIM1 compare registers written by the firmware PWM interrupt and writes back
+// the ADC data buffer and GPIO input registers the firmware reads.
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "stm8s.h"
+#include "main.h"
+#include "sim.h"
+
+#define GRAVITY 9.81
+#define AIR_DENSITY 1.2
+#define TWO_PI (2.0 * M_PI)
+
+// phase voltage sign is smoothed around zero current, otherwise dead time compensation chatters
+#define DEAD_TIME_CURRENT_SMOOTHING 0.3 // A
+#define PHASE_SHORT_RESISTANCE 0.05 // ohm, motor cable short
+
+// phase shift of each PWM channel, in the same order as the firmware writes CCR1, CCR2 and CCR3
+static const float f_phase_shift [3] = { 0.0, -TWO_PI / 3.0, TWO_PI / 3.0 };
+
+// Motor parameters: estimates from the datasheets and from the values on main.h (e.g. Q85 motor
+// characteristic 202 = 12.6 gear ratio * 8 pole pairs * 2). Hall offset matches the phase the firmware
+// expects with the default MOTOR_ROTOR_OFFSET_ANGLE of 202 and angle correction of 127.
+static const struc_sim_motor_parameters motors [] =
+{
+  { "q85",  8, 12.6, 0.25, 150e-6, 0.0060, 20e-6, 2e-5, 0.85, 73 },
+  { "q100", 10, 14.4, 0.30, 120e-6, 0.0053, 25e-6, 2e-5, 0.85, 73 },
+  { "q11",  23, 1.0,  0.35, 400e-6, 0.0288, 0.12,  5e-3, 1.0, 73 },
+};
+
+// li-ion cell open circuit voltage, same state of charge points as main.h
+static const float f_cell_soc [6] = { 0.0, 0.2, 0.4, 0.6, 0.8, 1.0 };
+static const float f_cell_volts [6] = { LI_ION_CELL_VOLTS_0, LI_ION_CELL_VOLTS_20, LI_ION_CELL_VOLTS_40,
+					LI_ION_CELL_VOLTS_60, LI_ION_CELL_VOLTS_80, LI_ION_CELL_VOLTS_100 };
+
+// hall sensors state for each 60 degrees sector, rotating forward
+static const uint8_t ui8_hall_sequence [6] = { 4, 6, 2, 3, 1, 5 };
+
+static uint8_t ui8_brake_pin = 1;
+static uint8_t ui8_over_current_pin = 1;
+
+const struc_sim_motor_parameters *sim_model_get_motor_parameters (const char *name)
+{
+  uint8_t ui8_i;
+
+  for (ui8_i = 0; ui8_i < (sizeof (motors) / sizeof (motors[0])); ui8_i++)
+  {
+    if (strcmp (name, motors[ui8_i].name) == 0) { return &motors[ui8_i]; }
+  }
+
+  return 0;
+}
+
+static float battery_open_circuit_voltage (void)
+{
+  float f_soc = sim.f_battery_charge / sim.battery.f_capacity;
+  uint8_t ui8_i;
+
+  if (f_soc <= 0.0) { return sim.battery.ui8_cells * f_cell_volts[0]; }
+  for (ui8_i = 1; ui8_i < 6; ui8_i++)
+  {
+    if (f_soc <= f_cell_soc[ui8_i])
+    {
+      return sim.battery.ui8_cells * (f_cell_volts[ui8_i - 1] + (f_cell_volts[ui8_i] - f_cell_volts[ui8_i - 1]) *
+	  (f_soc - f_cell_soc[ui8_i - 1]) / (f_cell_soc[ui8_i] - f_cell_soc[ui8_i - 1]));
+    }
+  }
+
+  return sim.battery.ui8_cells * f_cell_volts[5];
+}
+
+void sim_model_init (void)
+{
+  memset (sim.f_phase_current, 0, sizeof (sim.f_phase_current));
+  sim.f_rotor_angle = 0;
+  sim.f_rotor_speed = 0;
+  sim.f_motor_torque = 0;
+  sim.ui8_motor_coupled = 1;
+  sim.f_battery_charge = sim.battery.f_capacity * sim.battery.f_state_of_charge;
+  sim.f_battery_voltage = battery_open_circuit_voltage ();
+  sim.f_battery_current = 0;
+  sim.f_speed = 0;
+  sim.f_distance = 0;
+  sim.f_wheel_angle = 0;
+  sim.f_pedal_angle = 0;
+  sim.f_energy_out = 0;
+  sim.f_energy_in = 0;
+  sim.ui32_over_current_events = 0;
+  sim.ui32_over_current_trip_us = 0;
+  sim.ui32_over_current_outputs_off_us = 0;
+  ui8_brake_pin = 1;
+  ui8_over_current_pin = 1;
+}
+
+static void electrical_step (float f_dt, const float *f_duty, uint8_t ui8_outputs_enabled, float f_dead_time)
+{
+  float f_omega_e = sim.f_rotor_speed * sim.motor.ui8_pole_pairs;
+  float f_bemf [3];
+  float f_volts [3];
+  float f_neutral = 0;
+  float f_sin;
+  float f_torque = 0;
+  float f_dc_current = 0;
+  uint8_t ui8_conducting [3];
+  uint8_t ui8_conducting_count = 0;
+  uint8_t ui8_i;
+
+  for (ui8_i = 0; ui8_i < 3; ui8_i++)
+  {
+    f_sin = sinf (sim.f_rotor_angle + f_phase_shift[ui8_i]);
+    f_bemf[ui8_i] = sim.motor.f_flux_linkage * f_omega_e * f_sin;
+    f_torque += sim.motor.f_flux_linkage * sim.motor.ui8_pole_pairs * f_sin * sim.f_phase_current[ui8_i];
+
+    if (ui8_outputs_enabled)
+    {
+      // average phase voltage over the PWM period; dead time makes the voltage follow the current direction
+      f_volts[ui8_i] = f_duty[ui8_i] * sim.f_battery_voltage;
+      if ((f_duty[ui8_i] > 0.0) && (f_duty[ui8_i] < 1.0))
+      {
+	f_volts[ui8_i] -= sim.f_battery_voltage * f_dead_time *
+	    tanhf (sim.f_phase_current[ui8_i] / DEAD_TIME_CURRENT_SMOOTHING);
+      }
+      ui8_conducting[ui8_i] = 1;
+    }
+    else
+    {
+      // all FETs off: current can only flow on the body diodes until it reaches zero
+      if (sim.f_phase_current[ui8_i] > 0.001) { f_volts[ui8_i] = 0; ui8_conducting[ui8_i] = 1; }
+      else if (sim.f_phase_current[ui8_i] < -0.001) { f_volts[ui8_i] = sim.f_battery_voltage; ui8_conducting[ui8_i] = 1; }
+      else { f_volts[ui8_i] = 0; ui8_conducting[ui8_i] = 0; }
+    }
+
+    if (ui8_conducting[ui8_i])
+    {
+      ui8_conducting_count++;
+      f_neutral += f_volts[ui8_i] - f_bemf[ui8_i] - sim.motor.f_phase_resistance * sim.f_phase_current[ui8_i];
+    }
+  }
+  sim.f_motor_torque = f_torque;
+
+  if (ui8_conducting_count < 2)
+  {
+    memset (sim.f_phase_current, 0, sizeof (sim.f_phase_current));
+  }
+  else
+  {
+    // star connection: the neutral point voltage makes the sum of the currents zero
+    f_neutral /= ui8_conducting_count;
+
+    for (ui8_i = 0; ui8_i < 3; ui8_i++)
+    {
+      if (!ui8_conducting[ui8_i]) { continue; }
+
+      float f_previous = sim.f_phase_current[ui8_i];
+      sim.f_phase_current[ui8_i] += f_dt * (f_volts[ui8_i] - f_neutral - f_bemf[ui8_i] -
+	  sim.motor.f_phase_resistance * f_previous) / sim.motor.f_phase_inductance;
+
+      // diodes don't conduct backwards
+      if ((!ui8_outputs_enabled) && ((f_previous * sim.f_phase_current[ui8_i]) < 0.0)) { sim.f_phase_current[ui8_i] = 0; }
+    }
+  }
+
+  // DC link current
+  for (ui8_i = 0; ui8_i < 3; ui8_i++)
+  {
+    if (ui8_outputs_enabled) { f_dc_current += f_duty[ui8_i] * sim.f_phase_current[ui8_i]; }
+    else if (sim.f_phase_current[ui8_i] < 0.0) { f_dc_current += sim.f_phase_current[ui8_i]; }
+  }
+
+  // phase A to phase B short on the motor cable: battery shorted while one leg is high and the other low
+  if (ui8_outputs_enabled && sim.inputs.ui8_phase_short)
+  {
+    f_dc_current += sim.f_battery_voltage * fabsf (f_duty[0] - f_duty[1]) / PHASE_SHORT_RESISTANCE;
+  }
+
+  sim.f_battery_current = f_dc_current;
+  sim.f_battery_voltage = battery_open_circuit_voltage () - (sim.battery.f_internal_resistance * f_dc_current);
+  if (sim.f_battery_voltage < 0.0) { sim.f_battery_voltage = 0; }
+
+  sim.f_battery_charge -= f_dc_current * f_dt / 3600.0;
+  if (f_dc_current > 0.0) { sim.f_energy_out += sim.f_battery_voltage * f_dc_current * f_dt / 3600.0; }
+  else { sim.f_energy_in -= sim.f_battery_voltage * f_dc_current * f_dt / 3600.0; }
+}
+
+static void mechanical_step (float f_dt)
+{
+  float f_wheel_radius = sim.bike.f_wheel_perimeter / TWO_PI;
+  float f_gear = sim.motor.f_gear_ratio;
+  float f_angle = atanf (sim.inputs.f_grade);
+  float f_wheel_speed = sim.f_speed / f_wheel_radius; // rad/s
+  float f_force = 0;
+  float f_mass = sim.bike.f_mass;
+  float f_motor_force;
+
+  // rider
+  if ((sim.inputs.f_pedal_cadence > 0.0) && (sim.inputs.f_rider_power > 0.0))
+  {
+    f_force += sim.inputs.f_rider_power / (sim.f_speed > 1.5 ? sim.f_speed : 1.5);
+  }
+
+  // environment
+  f_force -= sim.bike.f_mass * GRAVITY * sinf (f_angle);
+  if (sim.f_speed > 0.0)
+  {
+    f_force -= sim.bike.f_rolling_resistance * sim.bike.f_mass * GRAVITY * cosf (f_angle);
+    f_force -= 0.5 * AIR_DENSITY * sim.bike.f_drag_area * sim.f_speed * sim.f_speed;
+    if (sim.inputs.ui8_brake) { f_force -= sim.bike.f_brake_force; }
+  }
+
+  // motor: direct drive is always coupled to the wheel, geared motors drive the wheel only trough
+  // the freewheel clutch, so they can't brake/regen and they don't turn when the wheel is faster
+  if (f_gear <= 1.0)
+  {
+    sim.ui8_motor_coupled = 1;
+  }
+  else
+  {
+    sim.ui8_motor_coupled = ((sim.f_motor_torque > 0.0) && ((sim.f_rotor_speed / f_gear) >= (f_wheel_speed - 0.01))) ? 1 : 0;
+  }
+
+  if (sim.ui8_motor_coupled)
+  {
+    f_motor_force = (sim.f_motor_torque - sim.motor.f_rotor_friction * sim.f_rotor_speed) * f_gear / f_wheel_radius;
+    f_motor_force *= (f_motor_force > 0.0) ? sim.motor.f_gear_efficiency : (1.0 / sim.motor.f_gear_efficiency);
+    f_force += f_motor_force;
+    f_mass += sim.motor.f_rotor_inertia * f_gear * f_gear / (f_wheel_radius * f_wheel_radius);
+  }
+  else
+  {
+    sim.f_rotor_speed += f_dt * (sim.f_motor_torque - sim.motor.f_rotor_friction * sim.f_rotor_speed) / sim.motor.f_rotor_inertia;
+    if (sim.f_rotor_speed < 0.0) { sim.f_rotor_speed = 0; }
+  }
+
+  sim.f_speed += f_dt * f_force / f_mass;
+  if (sim.f_speed < 0.0) { sim.f_speed = 0; } // rider holds the bike instead of rolling backwards
+
+  if (sim.ui8_motor_coupled) { sim.f_rotor_speed = (sim.f_speed / f_wheel_radius) * f_gear; }
+
+  sim.f_distance += sim.f_speed * f_dt;
+  sim.f_wheel_angle += sim.f_speed * f_dt / sim.bike.f_wheel_perimeter;
+  sim.f_pedal_angle += sim.inputs.f_pedal_cadence * f_dt / 60.0;
+
+  sim.f_rotor_angle += sim.f_rotor_speed * sim.motor.ui8_pole_pairs * f_dt;
+  if (sim.f_rotor_angle >= TWO_PI) { sim.f_rotor_angle -= TWO_PI; }
+}
+
+// one PWM period
+void sim_model_step (void)
+{
+  float f_duty [3];
+  float f_dt = (SIM_PWM_PERIOD_US * 1e-6) / SIM_ELECTRICAL_SUBSTEPS;
+  float f_dead_time;
+  uint8_t ui8_outputs_enabled;
+  uint8_t ui8_over_current_comparator;
+  uint32_t ui32_trip_time_us;
+  uint8_t ui8_i;
+
+  // TIM1 runs center aligned with ARR = 511
+  f_duty[0] = ((float) ((TIM1->CCR1H << 8) | TIM1->CCR1L)) / 512.0;
+  f_duty[1] = ((float) ((TIM1->CCR2H << 8) | TIM1->CCR2L)) / 512.0;
+  f_duty[2] = ((float) ((TIM1->CCR3H << 8) | TIM1->CCR3L)) / 512.0;
+  for (ui8_i = 0; ui8_i < 3; ui8_i++) { if (f_duty[ui8_i] > 1.0) { f_duty[ui8_i] = 1.0; } }
+  ui8_outputs_enabled = (TIM1->BKR & TIM1_BKR_MOE) ? 1 : 0;
+  // outputs disabled by the software, after the over current interrupt
+  if ((!ui8_outputs_enabled) && sim.ui32_over_current_trip_us && (!sim.ui32_over_current_outputs_off_us))
+  {
+    sim.ui32_over_current_outputs_off_us = sim.ui32_time_us;
+  }
+  // dead time: DTG steps of 62.5ns (for DTG < 128), one on each edge of the PWM period
+  f_dead_time = (((float) (TIM1->DTR & 0x7f)) / 16e6) / (SIM_PWM_PERIOD_US * 1e-6);
+
+  // overcurrent comparator: low for the whole PWM period if it tripped on any step, the firmware sees it
+  // through the PD7 falling edge interrupt at the end of the period
+  ui8_over_current_comparator = 1;
+  for (ui8_i = 0; ui8_i < SIM_ELECTRICAL_SUBSTEPS; ui8_i++)
+  {
+    electrical_step (f_dt, f_duty, ui8_outputs_enabled, f_dead_time);
+    mechanical_step (f_dt);
+
+    if ((sim.f_battery_current > sim.hardware.f_over_current) || (sim.f_battery_current < -sim.hardware.f_over_current))
+    {
+      ui32_trip_time_us = sim.ui32_time_us + ((ui8_i + 1) * SIM_PWM_PERIOD_US / SIM_ELECTRICAL_SUBSTEPS);
+      if (ui8_over_current_pin && ui8_over_current_comparator) { sim.ui32_over_current_events++; }
+      if (!sim.ui32_over_current_trip_us) { sim.ui32_over_current_trip_us = ui32_trip_time_us; }
+      ui8_over_current_comparator = 0;
+
+      // TIM1 break input wired to the comparator: hardware clears MOE right away
+      if ((TIM1->BKR & TIM1_BKR_BKE) && ui8_outputs_enabled)
+      {
+	TIM1->BKR &= (uint8_t) ~TIM1_BKR_MOE;
+	TIM1->SR1 |= TIM1_SR1_BIF;
+	ui8_outputs_enabled = 0;
+	if (!sim.ui32_over_current_outputs_off_us) { sim.ui32_over_current_outputs_off_us = ui32_trip_time_us; }
+      }
+    }
+  }
+  ui8_over_current_pin = ui8_over_current_comparator;
+
+  ui8_brake_pin = sim.inputs.ui8_brake ? 0 : 1;
+
+  sim.ui32_time_us += SIM_PWM_PERIOD_US;
+}
+
+static void write_adc_10b (volatile uint8_t *p_high, volatile uint8_t *p_low, int16_t i16_value)
+{
+  if (i16_value < 0) { i16_value = 0; }
+  if (i16_value > 1023) { i16_value = 1023; }
+  // left aligned: 8 MSB on the high register
+  *p_high = (uint8_t) (i16_value >> 2);
+  *p_low = (uint8_t) (i16_value & 3);
+}
+
+// write the model outputs to the registers the firmware reads
+void sim_model_update_io (void)
+{
+  float f_hall_angle;
+  float f_fraction;
+  uint8_t ui8_sector;
+  uint8_t ui8_idr;
+
+  // hall sensors, PE0 - PE2
+  f_hall_angle = sim.f_rotor_angle - (((float) sim.motor.ui8_hall_offset) * TWO_PI / 256.0);
+  while (f_hall_angle < 0.0) { f_hall_angle += TWO_PI; }
+  ui8_sector = ((uint8_t) (f_hall_angle / (TWO_PI / 6.0))) % 6;
+  GPIOE->IDR = (GPIOE->IDR & ~0x07) | ui8_hall_sequence[ui8_sector];
+
+  // PAS, PD0: firmware detects pedaling direction by the on/off time of the pulses
+  ui8_idr = GPIOD->IDR & ~0x01;
+  f_fraction = (sim.f_pedal_angle * PAS_NUMBER_MAGNETS) - floorf (sim.f_pedal_angle * PAS_NUMBER_MAGNETS);
+#if PAS_DIRECTION == PAS_DIRECTION_LEFT
+  if ((sim.inputs.f_pedal_cadence > 0.0) && (f_fraction < 0.65)) { ui8_idr |= 0x01; }
+#else
+  if ((sim.inputs.f_pedal_cadence > 0.0) && (f_fraction < 0.35)) { ui8_idr |= 0x01; }
+#endif
+  // overcurrent comparator, PD7, active low
+  ui8_idr &= ~0x80;
+  if (ui8_over_current_pin) { ui8_idr |= 0x80; }
+  GPIOD->IDR = ui8_idr;
+
+  // wheel speed sensor, PC5: reed switch to ground, short low pulse each wheel turn
+  f_fraction = sim.f_wheel_angle - floorf (sim.f_wheel_angle);
+  if (f_fraction < 0.05) { GPIOC->IDR &= ~0x20; }
+  else { GPIOC->IDR |= 0x20; }
+
+  // brake, PA4, active low
+  if (ui8_brake_pin) { GPIOA->IDR |= 0x10; }
+  else { GPIOA->IDR &= ~0x10; }
+
+  // throttle, AIN4: released ~0.8V, full ~4.3V
+  ADC1->DB4RH = (uint8_t) (40.0 + (sim.inputs.f_throttle * 192.0));
+
+  // phase B current, AIN5
+  write_adc_10b (&ADC1->DB5RH, &ADC1->DB5RL, (int16_t) (sim.hardware.ui16_adc_phase_b_current_offset_10b +
+      lrintf (sim.f_phase_current[1] / sim.hardware.f_adc_phase_b_current_per_step_10b)));
+
+  // motor total current, AIN8
+  write_adc_10b (&ADC1->DB8RH, &ADC1->DB8RL, (int16_t) (sim.hardware.ui16_adc_current_offset_10b +
+      lrintf (sim.f_battery_current / sim.hardware.f_adc_current_per_step_10b)));
+
+  // battery voltage, AIN9
+  write_adc_10b (&ADC1->DB9RH, &ADC1->DB9RL, (int16_t) lrintf (sim.f_battery_voltage * 4.0 /
+      sim.hardware.f_adc_battery_voltage_per_step_8b));
+}
+
+uint8_t sim_model_brake_pin (void)
+{
+  return ui8_brake_pin;
+}
+
+uint8_t sim_model_over_current_pin (void)
+{
+  return ui8_over_current_pin;
+}
@@ -0,0 +1,631 @@
+/*
+ * BMSBattery S series motor controllers firmware
+ *
+ * Copyright (C) Casainho, 2017.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+// Closed loop simulator: runs the firmware PWM interrupt and main loop tasks, compiled for the host,
+// against the motor/bike model of motor_model.c and reports control performance metrics for a set of
+// standard scenarios. Each scenario runs on a forked process so the firmware globals start fresh.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "stm8s.h"
+#include "stm8s_itc.h"
+#include "main.h"
+#include "interrupts.h"
+#include "motor.h"
+#include "ebike_app.h"
+#include "eeprom.h"
+#include "statistics.h"
+#include "battery.h"
+#include "timers.h"
+#include "sim.h"
+
+// firmware functions that have no prototype on the headers
+void gpio_init (void);
+void debug_pin_init (void);
+void brake_init (void);
+BitStatus brake_is_set (void);
+void uart_init (void);
+void pwm_init_bipolar_4q (void);
+void adc_init (void);
+void pas_init (void);
+void wheel_speed_sensor_init (void);
+void TIM1_UPD_OVF_TRG_BRK_IRQHandler (void);
+void EXTI_PORTA_IRQHandler (void);
+void EXTI_PORTD_IRQHandler (void);
+void UART2_IRQHandler (void);
+void TIM4_UPD_OVF_IRQHandler (void);
+
+#define LCD_FRAME_PERIOD_PWM_CYCLES 3125 // LCD sends its configuration every 200ms
+#define LCD_BYTE_PWM_CYCLES 16 // ~1ms per byte at 9600 baud
+#define RIPPLE_FILTER_TAU 0.010 // s, battery current average used to calc the ripple
+#define TRACE_PERIOD_PWM_CYCLES 156 // 10ms
+#define REGEN_TRACKING_MIN 60 // %, regen_% of brake_regen on the direct drive motors, dead time losses are about 20%
+
+struc_sim sim;
+
+typedef struct _sim_scenario
+{
+  const char *name;
+  const char *description;
+  float f_duration; // s
+  float f_step_time; // s, when the rider asks for power
+  float f_settle_time; // s, steady state is measured on the 2 seconds before this time
+  struc_lcd_configuration_variables lcd;
+  void (*inputs) (float f_time, struc_sim_inputs *inputs);
+} struc_sim_scenario;
+
+typedef struct _sim_metrics
+{
+  float f_rise_time; // s, 10% to 90% of the steady state speed
+  float f_overshoot; // % over the steady state speed
+  float f_steady_speed; // km/h
+  float f_current_ripple; // A rms, battery current around its 10ms average
+  float f_energy_per_distance; // Wh/km, net from the battery
+  float f_energy_regen; // Wh
+  float f_peak_current; // A
+  float f_distance; // m
+  float f_over_current_reaction; // us, from the over current comparator trip to the bridge outputs off, -1 if no trip
+  float f_pwm_irq_jitter; // us, max delay of the PWM interrupt start by the other interrupts
+  float f_idle_time; // s, PWM interrupt at the deep idle rate (MOTOR_IDLE_PWM_CYCLES)
+  float f_idle_wakeups; // per s, interrupts in deep idle
+  float f_brake_current; // A, battery current average while braking over MOTOR_REGEN_ERPS_MIN, negative is regen
+  float f_regen_tracking; // %, regen battery current over the reachable regen target, while braking and the motor turns the wheel
+} struc_sim_metrics;
+
+/***************************************************************************************/
+// Scenarios
+
+static void scenario_launch_inputs (float f_time, struc_sim_inputs *inputs)
+{
+  // full throttle from standstill, flat road
+  inputs->f_throttle = (f_time >= 0.5) ? 1.0 : 0.0;
+}
+
+static void scenario_hill_climb_inputs (float f_time, struc_sim_inputs *inputs)
+{
+  // 6% climb, rider pedals at 60 RPM with 80W, motor on PAS only
+  inputs->f_grade = 0.06;
+  if (f_time >= 0.5)
+  {
+    inputs->f_pedal_cadence = 60;
+    inputs->f_rider_power = 80;
+  }
+}
+
+static void scenario_speed_limit_inputs (float f_time, struc_sim_inputs *inputs)
+{
+  // full throttle against the LCD max speed
+  inputs->f_throttle = (f_time >= 0.5) ? 1.0 : 0.0;
+}
+
+static void scenario_brake_regen_inputs (float f_time, struc_sim_inputs *inputs)
+{
+  // reach cruising speed, then release throttle and brake until stopped
+  if ((f_time >= 0.5) && (f_time < 15.0)) { inputs->f_throttle = 1.0; }
+  if (f_time >= 15.0) { inputs->ui8_brake = 1; }
+}
+
+static void scenario_phase_short_inputs (float f_time, struc_sim_inputs *inputs)
+{
+  // full throttle, then the motor cable gets a phase to phase short: over current comparator must turn off the
+  // bridge, oc_us is the time it took
+  inputs->f_throttle = (f_time >= 0.5) ? 1.0 : 0.0;
+  if (f_time >= 10.0) { inputs->ui8_phase_short = 1; }
+}
+
+static void scenario_current_spike_inputs (float f_time, struc_sim_inputs *inputs)
+{
+  // full throttle with a 1ms phase to phase short at 10s, like a damaged cable touching on a pothole: the ride
+  // must go on after the over current recovery
+  inputs->f_throttle = (f_time >= 0.5) ? 1.0 : 0.0;
+  if ((f_time >= 10.0) && (f_time < 10.001)) { inputs->ui8_phase_short = 1; }
+}
+
+static const struc_sim_scenario scenarios [] =
+{
+  // name, description, duration, step, settle, { assist, motor characteristic, wheel size, max speed, mode, max current }
+  { "launch", "full throttle from standstill", 20.0, 0.5, 20.0,
+    { 5, DEFAULT_VALUE_MOTOR_CHARACTARISTIC, DEFAULT_VALUE_WHEEL_SIZE, 45, 8, 10 }, scenario_launch_inputs },
+  { "hill_climb", "6% grade, PAS 60 RPM, assist 5", 40.0, 0.5, 40.0,
+    { 5, DEFAULT_VALUE_MOTOR_CHARACTARISTIC, DEFAULT_VALUE_WHEEL_SIZE, 45, 8, 10 }, scenario_hill_climb_inputs },
+  { "speed_limit", "full throttle, LCD max speed 18 km/h", 30.0, 0.5, 30.0,
+    { 5, DEFAULT_VALUE_MOTOR_CHARACTARISTIC, DEFAULT_VALUE_WHEEL_SIZE, 18, 8, 10 }, scenario_speed_limit_inputs },
+  { "brake_regen", "cruise then brake to stop at 15s", 25.0, 0.5, 15.0,
+    { 5, DEFAULT_VALUE_MOTOR_CHARACTARISTIC, DEFAULT_VALUE_WHEEL_SIZE, 45, 8, 10 }, scenario_brake_regen_inputs },
+  { "phase_short", "full throttle, phase A to B short at 10s", 12.0, 0.5, 10.0,
+    { 5, DEFAULT_VALUE_MOTOR_CHARACTARISTIC, DEFAULT_VALUE_WHEEL_SIZE, 45, 8, 10 }, scenario_phase_short_inputs },
+  { "current_spike", "full throttle, 1ms phase short at 10s", 25.0, 0.5, 25.0,
+    { 5, DEFAULT_VALUE_MOTOR_CHARACTARISTIC, DEFAULT_VALUE_WHEEL_SIZE, 45, 8, 10 }, scenario_current_spike_inputs },
+};
+
+#define SCENARIOS_NUMBER (sizeof (scenarios) / sizeof (scenarios[0]))
+
+/***************************************************************************************/
+// LCD link
+
+void sim_lcd_tx_byte (uint8_t ui8_byte)
+{
+  // frames from the controller start with 65 and have 12 bytes
+  if ((sim.ui8_lcd_tx_counter == 0) && (ui8_byte != 65)) { return; }
+
+  sim.ui8_lcd_tx_frame[sim.ui8_lcd_tx_counter++] = ui8_byte;
+  if (sim.ui8_lcd_tx_counter >= sizeof (sim.ui8_lcd_tx_frame))
+  {
+    sim.ui8_lcd_tx_counter = 0;
+    sim.ui32_lcd_tx_frames++;
+  }
+}
+
+// LCD3 configuration frame, the inverse of what communications_controller () decodes
+static void lcd_build_frame (const struc_lcd_configuration_variables *lcd, uint8_t *ui8_frame)
+{
+  uint8_t ui8_crc = 0;
+  uint8_t ui8_i;
+
+  memset (ui8_frame, 0, 13);
+  ui8_frame[0] = 50;
+  ui8_frame[1] = 14;
+  ui8_frame[3] = lcd->ui8_assist_level & 7;
+  // max speed = 10 + (B4[7:3] | B6[5])
+  ui8_frame[4] = (((lcd->ui8_max_speed - 10) & 31) << 3) | ((lcd->ui8_wheel_size >> 2) & 7);
+  ui8_frame[5] = lcd->ui8_motor_characteristic;
+  ui8_frame[6] = ((lcd->ui8_wheel_size & 3) << 6) | ((lcd->ui8_max_speed - 10) & 32) | (lcd->ui8_power_assist_control_mode ? 8 : 0);
+  ui8_frame[9] = lcd->ui8_controller_max_current & 15;
+
+  for (ui8_i = 0; ui8_i <= 12; ui8_i++)
+  {
+    if (ui8_i == 7) continue;
+    ui8_crc ^= ui8_frame[ui8_i];
+  }
+  ui8_frame[7] = ui8_crc ^ 2; // CRC LCD3
+}
+
+// returns 1 if the UART2 interrupt did run
+static uint8_t lcd_rx_byte (uint8_t ui8_byte)
+{
+  // UART2 receive interrupt is disabled while firmware processes a package: byte is lost
+  if (!(UART2->CR2 & (1 << 5))) { return 0; }
+
+  UART2->DR = ui8_byte;
+  UART2->SR |= UART2_SR_RXNE;
+  UART2_IRQHandler ();
+  UART2->SR &= (uint8_t) ~UART2_SR_RXNE;
+  return 1;
+}
+
+/***************************************************************************************/
+// Interrupts latency: the PWM interrupt runs at the start of each PWM period. Another interrupt arrives at a
+// pseudo random time of the period and runs for ui8_duration_us; when it is still running at the end of the
+// period, the PWM interrupt start is delayed, unless it has a higher ITC software priority and preempts it.
+// Only measured: the firmware still runs the PWM interrupt on time. Also counts the interrupts in deep idle
+static uint32_t ui32_irq_random = 1;
+
+static void irq_jitter (uint8_t ui8_irq, uint8_t ui8_duration_us, struc_sim_metrics *metrics)
+{
+  int32_t i32_delay;
+
+  if (motor_pwm_cycle.ui8_idle == MOTOR_IDLE_ON) { sim.ui32_idle_interrupts++; }
+
+  ui32_irq_random = (ui32_irq_random * 1103515245) + 12345;
+  i32_delay = ((ui32_irq_random >> 16) % SIM_PWM_PERIOD_US) + ui8_duration_us - SIM_PWM_PERIOD_US;
+  if ((i32_delay > metrics->f_pwm_irq_jitter) &&
+      (sim_itc_level (ITC_IRQ_TIM1_OVF) <= sim_itc_level (ui8_irq)))
+  {
+    metrics->f_pwm_irq_jitter = i32_delay;
+  }
+}
+
+/***************************************************************************************/
+// Firmware
+
+// same initialization sequence as main ()
+static void firmware_init (const struc_lcd_configuration_variables *lcd)
+{
+  // configuration previously saved by the LCD, on the old format: eeprom_init () migrates it to a record
+  sim_io[ADDRESS_KEY] = KEY;
+  sim_io[ADDRESS_ASSIST_LEVEL] = lcd->ui8_assist_level;
+  sim_io[ADDRESS_MOTOR_CHARACTARISTIC] = lcd->ui8_motor_characteristic;
+  sim_io[ADDRESS_WHEEL_SIZE] = lcd->ui8_wheel_size;
+  sim_io[ADDRESS_MAX_SPEED] = lcd->ui8_max_speed;
+  sim_io[ADDRESS_POWER_ASSIST_CONTROL_MODE] = lcd->ui8_power_assist_control_mode;
+  sim_io[ADDRESS_CONTROLLER_MAX_CURRENT] = lcd->ui8_controller_max_current;
+
+  sim_model_init ();
+  sim_model_update_io ();
+
+  memset ((void *) &ITC->ISPR1, 0xff, 8); // reset value: all interrupts at level 3
+
+  CLK_HSIPrescalerConfig (CLK_PRESCALER_HSIDIV1);
+  motor_pwm_cycle_init ();
+  gpio_init ();
+  brake_init ();
+  while (brake_is_set ()) ;
+  debug_pin_init ();
+  timer2_init ();
+  timer4_init ();
+  uart_init ();
+  pwm_init_bipolar_4q ();
+  hall_sensor_init ();
+  adc_init ();
+  eeprom_init ();
+  statistics_init ();
+  battery_init ();
+  motor_init ();
+  pas_init ();
+  wheel_speed_sensor_init ();
+  interrupts_init ();
+
+  if (sim.ui8_itc_reset_priorities) { memset ((void *) &ITC->ISPR1, 0xff, 8); }
+}
+
+/***************************************************************************************/
+// Run
+
+static void run_scenario (const struc_sim_scenario *scenario, FILE *trace, struc_sim_metrics *metrics)
+{
+  uint32_t ui32_cycles = (uint32_t) (scenario->f_duration * 1e6 / SIM_PWM_PERIOD_US);
+  uint32_t ui32_cycle;
+  uint8_t ui8_brake_pin_old = 1;
+  uint8_t ui8_over_current_pin_old = 1;
+  uint8_t ui8_lcd_frame [13];
+  uint8_t ui8_lcd_byte = 13;
+  float f_dt = SIM_PWM_PERIOD_US * 1e-6;
+  float f_time;
+  float f_kmh;
+  float f_current_average = 0;
+  float f_ripple_sum = 0;
+  uint32_t ui32_ripple_samples = 0;
+  float f_steady_sum = 0;
+  uint32_t ui32_steady_samples = 0;
+  float f_max_speed = 0;
+  float *f_speed_log;
+  uint32_t ui32_i;
+  uint32_t ui32_start = (uint32_t) (scenario->f_step_time / f_dt);
+  uint32_t ui32_end = (uint32_t) (scenario->f_settle_time / f_dt);
+  uint8_t ui8_pwm_irq_cycles = 0;
+  uint8_t ui8_pwm_irq_period = 1;
+  uint32_t ui32_tick_us = SIM_TICK_US;
+  float f_brake_sum = 0;
+  uint32_t ui32_brake_samples = 0;
+  float f_regen_sum = 0;
+  float f_regen_target_sum = 0;
+  float f_regen_max;
+  float f_bemf;
+
+  memset (metrics, 0, sizeof (*metrics));
+  f_speed_log = calloc (ui32_cycles, sizeof (float));
+
+  firmware_init (&scenario->lcd);
+  lcd_build_frame (&scenario->lcd, ui8_lcd_frame);
+  sim.ui8_running = 1;
+
+  if (trace)
+  {
+    fprintf (trace, "time,speed_kmh,battery_current,battery_voltage,phase_current_a,duty_cycle,duty_cycle_target,"
+	"erps,commutation,angle_correction,motor_state\n");
+  }
+
+  for (ui32_cycle = 0; ui32_cycle < ui32_cycles; ui32_cycle++)
+  {
+    f_time = ui32_cycle * f_dt;
+
+    memset (&sim.inputs, 0, sizeof (sim.inputs));
+    scenario->inputs (f_time, &sim.inputs);
+
+    sim_model_step ();
+    sim_model_update_io ();
+    sim_flash_update ();
+
+    // external interrupts
+    if (sim_model_brake_pin () != ui8_brake_pin_old)
+    {
+      ui8_brake_pin_old = sim_model_brake_pin ();
+      EXTI_PORTA_IRQHandler ();
+      irq_jitter (ITC_IRQ_PORTA, SIM_BRAKE_IRQ_US, metrics);
+    }
+    if (sim_model_over_current_pin () != ui8_over_current_pin_old)
+    {
+      ui8_over_current_pin_old = sim_model_over_current_pin ();
+      if (!ui8_over_current_pin_old)
+      {
+	EXTI_PORTD_IRQHandler ();
+	irq_jitter (ITC_IRQ_PORTD, SIM_OVER_CURRENT_IRQ_US, metrics);
+      }
+    }
+
+    // LCD sends its configuration periodically
+    if ((ui32_cycle % LCD_FRAME_PERIOD_PWM_CYCLES) == 0) { ui8_lcd_byte = 0; }
+    if ((ui8_lcd_byte < 13) && ((ui32_cycle % LCD_BYTE_PWM_CYCLES) == 0))
+    {
+      if (lcd_rx_byte (ui8_lcd_frame[ui8_lcd_byte++])) { irq_jitter (ITC_IRQ_UART2_RX, SIM_UART2_IRQ_US, metrics); }
+    }
+
+    // main loop tick, while TIM4 runs: 1ms from its start
+    if (!(TIM4->CR1 & TIM4_CR1_CEN)) { ui32_tick_us = sim.ui32_time_us + SIM_TICK_US; }
+    else
+    {
+      if (sim.ui32_time_us >= ui32_tick_us)
+      {
+	ui32_tick_us += SIM_TICK_US;
+	TIM4_UPD_OVF_IRQHandler ();
+	irq_jitter (ITC_IRQ_TIM4_OVF, SIM_TICK_IRQ_US, metrics);
+      }
+      TIM4->CNTR = (uint8_t) ((SIM_TICK_US - (ui32_tick_us - sim.ui32_time_us)) >> 3); // 8us each count
+    }
+
+    // TIM1 repetition counter: interrupt every (RCR + 1) / 2 PWM periods, the value of RCR on the last one
+    if (++ui8_pwm_irq_cycles >= ui8_pwm_irq_period)
+    {
+      ui8_pwm_irq_cycles = 0;
+      ui8_pwm_irq_period = (TIM1->RCR + 1) >> 1;
+      if (motor_pwm_cycle.ui8_idle == MOTOR_IDLE_ON) { sim.ui32_idle_interrupts++; }
+      TIM1_UPD_OVF_TRG_BRK_IRQHandler ();
+    }
+    if (motor_pwm_cycle.ui8_idle == MOTOR_IDLE_ON) { metrics->f_idle_time += f_dt; }
+
+    // main loop, as main (): the tasks ready on the tick, then wfi () up to the next interrupt
+    ebike_app_events_controller ();
+    if (ui8_system_time_tick)
+    {
+      ui8_system_time_tick = 0;
+      if (system_time_task_is_ready (SYSTEM_TIME_TASK_MOTOR_CONTROLLER, SIM_SLOW_LOOP_MS)) { motor_controller (); }
+      if (system_time_task_is_ready (SYSTEM_TIME_TASK_EBIKE_APP_CONTROLLER, SIM_SLOW_LOOP_MS)) { ebike_app_controller (); }
+    }
+    eeprom_controller ();
+
+    // independent watchdog: refreshed before the timeout of the reload value at the refresh
+    if (IWDG->KR == IWDG_KEY_REFRESH)
+    {
+      IWDG->KR = 0;
+      sim.ui32_watchdog_refresh_us = sim.ui32_time_us;
+    }
+    else if (sim.ui32_watchdog_refresh_us &&
+	((sim.ui32_time_us - sim.ui32_watchdog_refresh_us) > SIM_WATCHDOG_TIMEOUT_US (IWDG->RLR)))
+    {
+      printf ("%-12s watchdog reset at %.3fs\n", scenario->name, f_time);
+      exit (1);
+    }
+
+    // metrics
+    f_kmh = sim.f_speed * 3.6;
+    f_speed_log[ui32_cycle] = f_kmh;
+    f_current_average += (sim.f_battery_current - f_current_average) * (f_dt / RIPPLE_FILTER_TAU);
+    if (fabsf (sim.f_battery_current) > metrics->f_peak_current) { metrics->f_peak_current = fabsf (sim.f_battery_current); }
+    if (sim.inputs.ui8_brake && (ui16_motor_get_motor_speed_erps () > MOTOR_REGEN_ERPS_MIN))
+    {
+      f_brake_sum += sim.f_battery_current;
+      ui32_brake_samples++;
+
+      // regen target of the firmware, up to the max regen the motor can give at this speed: battery current with
+      // the phase voltage at half of the back EMF, 3/2 * (E/2)^2 / R, without the dead time and inductance losses
+      if (sim.ui8_motor_coupled)
+      {
+	f_bemf = sim.motor.f_flux_linkage * sim.f_rotor_speed * sim.motor.ui8_pole_pairs;
+	f_regen_max = (3.0 * f_bemf * f_bemf) / (8.0 * sim.motor.f_phase_resistance * sim.f_battery_voltage);
+	f_regen_sum -= sim.f_battery_current;
+	f_regen_target_sum += fminf (f_regen_max, 0.5 * (motor_pwm_cycle.ui8_motor_total_current_offset -
+	    motor_pwm_cycle.ui8_adc_target_motor_regen_current));
+      }
+    }
+
+    if ((ui32_cycle >= ui32_start) && (ui32_cycle < ui32_end))
+    {
+      f_ripple_sum += (sim.f_battery_current - f_current_average) * (sim.f_battery_current - f_current_average);
+      ui32_ripple_samples++;
+      if (f_kmh > f_max_speed) { f_max_speed = f_kmh; }
+      if (ui32_cycle >= (ui32_end - (uint32_t) (2.0 / f_dt)))
+      {
+	f_steady_sum += f_kmh;
+	ui32_steady_samples++;
+      }
+    }
+
+    if (trace && ((ui32_cycle % TRACE_PERIOD_PWM_CYCLES) == 0))
+    {
+      fprintf (trace, "%.3f,%.2f,%.2f,%.2f,%.2f,%u,%u,%u,%u,%u,%u\n", f_time, f_kmh, sim.f_battery_current,
+	  sim.f_battery_voltage, sim.f_phase_current[0], motor_pwm_cycle.ui8_duty_cycle, motor_pwm_cycle.ui8_duty_cycle_target,
+	  ui16_motor_get_motor_speed_erps (), motor_pwm_cycle.ui8_motor_commutation_type, motor_pwm_cycle.ui8_angle_correction, motor_pwm_cycle.ui8_motor_state);
+    }
+  }
+
+  metrics->f_steady_speed = ui32_steady_samples ? (f_steady_sum / ui32_steady_samples) : 0;
+  metrics->f_current_ripple = ui32_ripple_samples ? sqrtf (f_ripple_sum / ui32_ripple_samples) : 0;
+  metrics->f_overshoot = (metrics->f_steady_speed > 0.5) ?
+      (100.0 * (f_max_speed - metrics->f_steady_speed) / metrics->f_steady_speed) : 0;
+  metrics->f_distance = sim.f_distance;
+  metrics->f_over_current_reaction = (sim.ui32_over_current_trip_us && sim.ui32_over_current_outputs_off_us) ?
+      (float) (sim.ui32_over_current_outputs_off_us - sim.ui32_over_current_trip_us) : -1;
+  metrics->f_energy_regen = sim.f_energy_in;
+  metrics->f_brake_current = ui32_brake_samples ? (f_brake_sum / ui32_brake_samples) : 0;
+  metrics->f_idle_wakeups = (metrics->f_idle_time > 0.0) ? (sim.ui32_idle_interrupts / metrics->f_idle_time) : 0;
+  metrics->f_regen_tracking = (f_regen_target_sum > 0.0) ? (100.0 * f_regen_sum / f_regen_target_sum) : 0;
+  metrics->f_energy_per_distance = (sim.f_distance > 1.0) ?
+      ((sim.f_energy_out - sim.f_energy_in) / (sim.f_distance / 1000.0)) : 0;
+
+  // rise time: 10% to 90% of the steady state speed
+  metrics->f_rise_time = -1;
+  if (metrics->f_steady_speed > 0.5)
+  {
+    float f_time_10 = -1;
+
+    for (ui32_i = ui32_start; ui32_i < ui32_end; ui32_i++)
+    {
+      if ((f_time_10 < 0) && (f_speed_log[ui32_i] >= (0.1 * metrics->f_steady_speed))) { f_time_10 = ui32_i * f_dt; }
+      if (f_speed_log[ui32_i] >= (0.9 * metrics->f_steady_speed))
+      {
+	metrics->f_rise_time = (ui32_i * f_dt) - f_time_10;
+	break;
+      }
+    }
+  }
+
+  free (f_speed_log);
+}
+
+static void usage (const char *name)
+{
+  uint8_t ui8_i;
+
+  fprintf (stderr, "usage: %s [-m q85|q100|q11] [-t trace_prefix] [-r] [scenario ...]\n", name);
+  fprintf (stderr, "  -r: all interrupts at the ITC reset priority\n");
+  fprintf (stderr, "scenarios:\n");
+  for (ui8_i = 0; ui8_i < SCENARIOS_NUMBER; ui8_i++)
+  {
+    fprintf (stderr, "  %-12s %s\n", scenarios[ui8_i].name, scenarios[ui8_i].description);
+  }
+}
+
+static void set_default_parameters (const struc_sim_motor_parameters *motor)
+{
+  memset (&sim, 0, sizeof (sim));
+
+  sim.motor = *motor;
+
+  sim.bike.f_mass = 100;
+  sim.bike.f_wheel_perimeter = 2.0625; // 26'', same as DEFAULT_VALUE_WHEEL_SIZE
+  sim.bike.f_rolling_resistance = 0.008;
+  sim.bike.f_drag_area = 0.5;
+  sim.bike.f_brake_force = 150;
+
+  sim.battery.ui8_cells = BATTERY_LI_ION_CELLS_NUMBER;
+  sim.battery.f_capacity = 10;
+  sim.battery.f_internal_resistance = 0.15;
+  sim.battery.f_state_of_charge = 0.9;
+
+  sim.hardware.ui16_adc_current_offset_10b = 480;
+  sim.hardware.f_adc_current_per_step_10b = 0.125;
+  sim.hardware.ui16_adc_phase_b_current_offset_10b = 506;
+  sim.hardware.f_adc_phase_b_current_per_step_10b = 0.030;
+  sim.hardware.f_adc_battery_voltage_per_step_8b = ADC_BATTERY_VOLTAGE_PER_ADC_STEP;
+  sim.hardware.f_over_current = 30;
+}
+
+int main (int argc, char **argv)
+{
+#if MOTOR_TYPE == MOTOR_TYPE_Q100
+  const char *motor_name = "q100";
+#elif MOTOR_TYPE == MOTOR_TYPE_Q11
+  const char *motor_name = "q11";
+#else
+  const char *motor_name = "q85";
+#endif
+  const struc_sim_motor_parameters *motor;
+  const char *trace_prefix = 0;
+  char trace_name [256];
+  FILE *trace = 0;
+  struc_sim_metrics metrics;
+  uint8_t ui8_selected [SCENARIOS_NUMBER];
+  uint8_t ui8_i;
+  int option;
+  int status;
+  int result = 0;
+  pid_t pid;
+
+  uint8_t ui8_itc_reset_priorities = 0;
+
+  while ((option = getopt (argc, argv, "m:t:rh")) != -1)
+  {
+    switch (option)
+    {
+      case 'm':
+      motor_name = optarg;
+      break;
+
+      case 't':
+      trace_prefix = optarg;
+      break;
+
+      case 'r':
+      ui8_itc_reset_priorities = 1;
+      break;
+
+      default:
+      usage (argv[0]);
+      return 1;
+    }
+  }
+
+  motor = sim_model_get_motor_parameters (motor_name);
+  if (!motor)
+  {
+    usage (argv[0]);
+    return 1;
+  }
+
+  memset (ui8_selected, optind < argc ? 0 : 1, sizeof (ui8_selected));
+  for (; optind < argc; optind++)
+  {
+    for (ui8_i = 0; ui8_i < SCENARIOS_NUMBER; ui8_i++)
+    {
+      if (strcmp (argv[optind], scenarios[ui8_i].name) == 0) { break; }
+    }
+    if (ui8_i == SCENARIOS_NUMBER)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+    ui8_selected[ui8_i] = 1;
+  }
+
+  printf ("%-12s %-5s %8s %9s %9s %9s %8s %8s %8s %8s %8s %9s %8s %8s %8s %8s\n", "scenario", "motor", "rise_s", "overshoot",
+      "speed_kmh", "ripple_A", "Wh_km", "regen_Wh", "peak_A", "dist_m", "oc_us", "jitter_us", "idle_s", "wakeup/s", "brake_A", "regen_%");
+  fflush (stdout);
+
+  for (ui8_i = 0; ui8_i < SCENARIOS_NUMBER; ui8_i++)
+  {
+    if (!ui8_selected[ui8_i]) { continue; }
+
+    pid = fork ();
+    if (pid == 0)
+    {
+      set_default_parameters (motor);
+      sim.ui8_itc_reset_priorities = ui8_itc_reset_priorities;
+
+      if (trace_prefix)
+      {
+	snprintf (trace_name, sizeof (trace_name), "%s%s.csv", trace_prefix, scenarios[ui8_i].name);
+	trace = fopen (trace_name, "w");
+      }
+
+      run_scenario (&scenarios[ui8_i], trace, &metrics);
+      if (trace) { fclose (trace); }
+
+      printf ("%-12s %-5s %8.2f %8.1f%% %9.2f %9.3f %8.2f %8.3f %8.1f %8.1f %8.0f %9.0f %8.2f %8.0f %8.2f %7.0f%%\n", scenarios[ui8_i].name, motor->name,
+	  metrics.f_rise_time, metrics.f_overshoot, metrics.f_steady_speed, metrics.f_current_ripple,
+	  metrics.f_energy_per_distance, metrics.f_energy_regen, metrics.f_peak_current, metrics.f_distance,
+	  metrics.f_over_current_reaction, metrics.f_pwm_irq_jitter, metrics.f_idle_time, metrics.f_idle_wakeups, metrics.f_brake_current,
+	  metrics.f_regen_tracking);
+
+      // direct drive motors are coupled to the wheel: braking must send current back to the battery, near the
+      // regen target or the max regen of the motor
+      if ((sim.motor.f_gear_ratio <= 1.0) && (metrics.f_regen_tracking < REGEN_TRACKING_MIN) &&
+	  (scenarios[ui8_i].inputs == scenario_brake_regen_inputs))
+      {
+	printf ("%-12s braking battery current %.2fA, regen %.0f%% of the target\n", scenarios[ui8_i].name,
+	    metrics.f_brake_current, metrics.f_regen_tracking);
+	exit (1);
+      }
+      exit (0);
+    }
+
+    waitpid (pid, &status, 0);
+    if (!WIFEXITED (status) || (WEXITSTATUS (status) != 0))
+    {
+      printf ("%-12s failed\n", scenarios[ui8_i].name);
+      result = 1;
+    }
+    fflush (stdout);
+  }
+
+  return result;
+}
@@ -0,0 +1,146 @@
+/*
+ * BMSBattery S series motor controllers firmware
+ *
+ * Copyright (C) Casainho, 2017.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <stdint.h>
+
+#define SIM_PWM_PERIOD_US 64 // TIM1 update interrupt period
+#define SIM_ELECTRICAL_SUBSTEPS 16 // model integration steps per PWM period
+#define SIM_TICK_US 1000 // TIM4 main loop tick interrupt period
+#define SIM_SLOW_LOOP_MS 100 // main loop runs motor_controller () and ebike_app_controller () every 100ms
+#define SIM_WATCHDOG_TIMEOUT_US(reload) ((((uint32_t) (reload)) + 1) * 125 / 2) // IWDG prescaler 4, see watchdog_init ()
+
+// interrupt handlers execution time, estimates for the PWM interrupt start delay (jitter_us)
+#define SIM_UART2_IRQ_US 6
+#define SIM_BRAKE_IRQ_US 3
+#define SIM_OVER_CURRENT_IRQ_US 25 // fault log capture
+#define SIM_TICK_IRQ_US 2
+
+typedef struct _sim_motor_parameters
+{
+  const char *name;
+  uint8_t ui8_pole_pairs;
+  float f_gear_ratio; // motor shaft turns per wheel turn, 1.0 for direct drive
+  float f_phase_resistance; // ohm
+  float f_phase_inductance; // henry
+  float f_flux_linkage; // V.s/rad: phase back EMF peak = f_flux_linkage * electrical rad/s
+  float f_rotor_inertia; // kg.m^2 at the motor shaft
+  float f_rotor_friction; // N.m per rad/s at the motor shaft
+  float f_gear_efficiency;
+  uint8_t ui8_hall_offset; // electrical angle (0 - 255) between phase A back EMF zero and hall state 4
+} struc_sim_motor_parameters;
+
+typedef struct _sim_bike_parameters
+{
+  float f_mass; // kg, bike + rider
+  float f_wheel_perimeter; // m
+  float f_rolling_resistance; // Crr
+  float f_drag_area; // Cd * A, m^2
+  float f_brake_force; // N, mechanical brake when the lever is pulled
+} struc_sim_bike_parameters;
+
+typedef struct _sim_battery_parameters
+{
+  uint8_t ui8_cells; // li-ion cells in series
+  float f_capacity; // Ah
+  float f_internal_resistance; // ohm, whole pack
+  float f_state_of_charge; // 0 - 1 at start
+} struc_sim_battery_parameters;
+
+typedef struct _sim_hardware_parameters
+{
+  uint16_t ui16_adc_current_offset_10b; // motor total current amplifier output at 0A
+  float f_adc_current_per_step_10b; // A
+  uint16_t ui16_adc_phase_b_current_offset_10b;
+  float f_adc_phase_b_current_per_step_10b; // A
+  float f_adc_battery_voltage_per_step_8b; // V
+  float f_over_current; // A, comparator on PD7
+} struc_sim_hardware_parameters;
+
+// rider and environment, updated by the scenario on every PWM cycle
+typedef struct _sim_inputs
+{
+  float f_throttle; // 0 - 1
+  uint8_t ui8_brake;
+  float f_pedal_cadence; // RPM
+  float f_rider_power; // W
+  float f_grade; // rise / run
+  uint8_t ui8_phase_short; // phase A and phase B shorted on the motor cable
+} struc_sim_inputs;
+
+typedef struct _sim
+{
+  // clock and main loop
+  uint32_t ui32_time_us;
+  uint8_t ui8_running;
+  uint8_t ui8_itc_reset_priorities; // -r: all interrupts keep the ITC reset priority, as before interrupts_init ()
+  uint32_t ui32_watchdog_refresh_us; // last IWDG refresh, 0 before watchdog_init ()
+  uint32_t ui32_idle_interrupts; // taken in deep idle, each one wakes up the CPU from wfi ()
+
+  // data EEPROM
+  uint32_t ui32_eeprom_writes;
+  uint32_t ui32_eeprom_end_of_programming_us;
+
+  // LCD link
+  uint8_t ui8_lcd_tx_frame [12];
+  uint8_t ui8_lcd_tx_counter;
+  uint32_t ui32_lcd_tx_frames;
+
+  // model parameters
+  struc_sim_motor_parameters motor;
+  struc_sim_bike_parameters bike;
+  struc_sim_battery_parameters battery;
+  struc_sim_hardware_parameters hardware;
+  struc_sim_inputs inputs;
+
+  // motor and bridge state
+  float f_phase_current [3]; // A, into the motor
+  float f_rotor_angle; // electrical rad
+  float f_rotor_speed; // mechanical rad/s at the motor shaft
+  float f_motor_torque; // N.m at the motor shaft
+  uint8_t ui8_motor_coupled; // geared motors have a freewheel clutch
+
+  // battery state
+  float f_battery_voltage; // V at the controller
+  float f_battery_current; // A out of the battery, negative when regenerating
+  float f_battery_charge; // Ah left
+
+  // bike state
+  float f_speed; // m/s
+  float f_distance; // m
+  float f_wheel_angle; // wheel turns
+  float f_pedal_angle; // pedal turns
+
+  // accumulated
+  float f_energy_out; // Wh drawn from the battery
+  float f_energy_in; // Wh returned to the battery
+  uint32_t ui32_over_current_events;
+  uint32_t ui32_over_current_trip_us; // first time the comparator tripped, 0 if never
+  uint32_t ui32_over_current_outputs_off_us; // time the bridge outputs went off after the trip
+} struc_sim;
+
+extern struc_sim sim;
+
+// motor_model.c
+void sim_model_init (void);
+void sim_model_step (void);
+void sim_model_update_io (void);
+uint8_t sim_model_brake_pin (void);
+uint8_t sim_model_over_current_pin (void);
+const struc_sim_motor_parameters *sim_model_get_motor_parameters (const char *name);
+
+// sim.c
+void sim_lcd_tx_byte (uint8_t ui8_byte);
+
+// stm8s_hal_sim.c
+void sim_flash_update (void);
+uint8_t sim_itc_level (uint8_t ui8_irq);
+
+#endif /* _SIM_H_ */
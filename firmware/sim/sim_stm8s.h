@@ -0,0 +1,84 @@
+/*
+ * BMSBattery S series motor controllers firmware
+ *
+ * Copyright (C) Casainho, 2017.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+// Host build shim: this file is force included (gcc -include) before every firmware and StdPeriphLib
+// source file when building the simulator. It pulls the real stm8s.h and then moves every peripheral
+// base address into the sim_io[] array, so TIM1->CCR1H, ADC1->DB5RH, GPIOE->IDR etc. become plain host
+// memory that the motor/bike model can read and write.
+
+#ifndef _SIM_STM8S_H_
+#define _SIM_STM8S_H_
+
+#include <stdint.h>
+
+// STM8 memory map is 64k; we only need the IO registers and the data EEPROM
+#define SIM_IO_SIZE 0x8000
+extern uint8_t sim_io [SIM_IO_SIZE];
+
+#include "stm8s.h"
+
+#undef GPIOA_BaseAddress
+#undef GPIOB_BaseAddress
+#undef GPIOC_BaseAddress
+#undef GPIOD_BaseAddress
+#undef GPIOE_BaseAddress
+#undef FLASH_BaseAddress
+#undef EXTI_BaseAddress
+#undef CLK_BaseAddress
+#undef IWDG_BaseAddress
+#undef UART2_BaseAddress
+#undef TIM1_BaseAddress
+#undef TIM2_BaseAddress
+#undef TIM4_BaseAddress
+#undef ADC1_BaseAddress
+#undef ITC_BaseAddress
+#undef CFG_BaseAddress
+
+#define GPIOA_BaseAddress       (sim_io + 0x5000)
+#define GPIOB_BaseAddress       (sim_io + 0x5005)
+#define GPIOC_BaseAddress       (sim_io + 0x500A)
+#define GPIOD_BaseAddress       (sim_io + 0x500F)
+#define GPIOE_BaseAddress       (sim_io + 0x5014)
+#define FLASH_BaseAddress       (sim_io + 0x505A)
+#define EXTI_BaseAddress        (sim_io + 0x50A0)
+#define CLK_BaseAddress         (sim_io + 0x50C0)
+#define IWDG_BaseAddress        (sim_io + 0x50E0)
+#define UART2_BaseAddress       (sim_io + 0x5240)
+#define TIM1_BaseAddress        (sim_io + 0x5250)
+#define TIM2_BaseAddress        (sim_io + 0x5300)
+#define TIM4_BaseAddress        (sim_io + 0x5340)
+#define ADC1_BaseAddress        (sim_io + 0x53E0)
+#define ITC_BaseAddress         (sim_io + 0x7F70)
+#define CFG_BaseAddress         (sim_io + 0x7F60)
+
+// there is no interrupt controller on the host: the simulator calls the handlers itself
+#undef enableInterrupts
+#undef disableInterrupts
+#undef rim
+#undef sim
+#undef nop
+#undef trap
+#undef wfi
+#undef halt
+#define enableInterrupts()    {;}
+#define disableInterrupts()   {;}
+#define rim()                 {;}
+#define sim()                 {;}
+#define nop()                 {;}
+#define trap()                {;}
+#define wfi()                 {;}
+#define halt()                {;}
+
+// hal.h register accesses that can't work on plain memory: UART2 bytes sent go to the simulated LCD, ADC1
+// conversions are always complete and the data EEPROM is read from its image on sim_io[]
+void sim_lcd_tx_byte (uint8_t ui8_byte);
+#define HAL_UART2_SEND_DATA8(data)  sim_lcd_tx_byte ((uint8_t) (data))
+#define HAL_ADC1_END_OF_CONVERSION() (1)
+#define HAL_FLASH_READ_BYTE(address) (sim_io [((uint16_t) (address)) & (SIM_IO_SIZE - 1)])
+
+#endif /* _SIM_STM8S_H_ */
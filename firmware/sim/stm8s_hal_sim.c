@@ -0,0 +1,136 @@
+/*
+ * BMSBattery S series motor controllers firmware
+ *
+ * Copyright (C) Casainho, 2017.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+// Host replacements for the StdPeriphLib drivers that can't run against plain memory:
+// - TIM2 counter comes from the simulation clock
+// - UART2 status register starts with the transmitter empty, bytes sent go to the simulated LCD (sim_stm8s.h)
+// - ADC1 conversions are always complete (sim_stm8s.h, the model writes the data buffer registers)
+// - FLASH programs the data EEPROM image kept on sim_io[0x4000..0x43ff] and sets the status register flags
+// - ITC software priorities are written without reading the CPU CC register (assembly on StdPeriphLib)
+// GPIO, TIM1, TIM4, EXTI, IWDG and CLK use the original StdPeriphLib sources.
+
+#include <stdint.h>
+#include "stm8s.h"
+#include "stm8s_tim2.h"
+#include "stm8s_adc1.h"
+#include "stm8s_uart2.h"
+#include "stm8s_flash.h"
+#include "stm8s_itc.h"
+#include "sim.h"
+
+uint8_t sim_io [SIM_IO_SIZE];
+
+/***************************************************************************************/
+// TIM2: free running counter, 128us per increment
+void TIM2_DeInit (void) { ; }
+void TIM2_TimeBaseInit (TIM2_Prescaler_TypeDef TIM2_Prescaler, uint16_t TIM2_Period) { ; }
+void TIM2_Cmd (FunctionalState NewState) { ; }
+
+uint16_t TIM2_GetCounter (void)
+{
+  // before the PWM interrupt is running, firmware only reads TIM2 on busy wait loops:
+  // account each read as some CPU time so the loops end
+  if (!sim.ui8_running) { sim.ui32_time_us += 8; }
+
+  return (uint16_t) (sim.ui32_time_us >> 7);
+}
+
+/***************************************************************************************/
+// ADC1: the model updates the data buffer registers before each PWM interrupt
+void ADC1_DeInit (void) { ; }
+void ADC1_Init (ADC1_ConvMode_TypeDef ADC1_ConversionMode,
+		ADC1_Channel_TypeDef ADC1_Channel,
+		ADC1_PresSel_TypeDef ADC1_PrescalerSelection,
+		ADC1_ExtTrig_TypeDef ADC1_ExtTrigger,
+		FunctionalState ADC1_ExtTriggerState,
+		ADC1_Align_TypeDef ADC1_Align,
+		ADC1_SchmittTrigg_TypeDef ADC1_SchmittTriggerChannel,
+		FunctionalState ADC1_SchmittTriggerState) { ; }
+void ADC1_Cmd (FunctionalState NewState) { ; }
+void ADC1_ScanModeCmd (FunctionalState NewState) { ; }
+
+/***************************************************************************************/
+// UART2: LCD link
+void UART2_DeInit (void)
+{
+  UART2->SR = UART2_SR_TXE | UART2_SR_TC; // reset value
+}
+
+void UART2_Init (uint32_t BaudRate, UART2_WordLength_TypeDef WordLength, UART2_StopBits_TypeDef StopBits,
+		 UART2_Parity_TypeDef Parity, UART2_SyncMode_TypeDef SyncMode, UART2_Mode_TypeDef Mode) { ; }
+
+void UART2_ITConfig (UART2_IT_TypeDef UART2_IT, FunctionalState NewState)
+{
+  // receive interrupt enable bit is also set/cleared directly by the firmware
+  if (UART2_IT == UART2_IT_RXNE_OR)
+  {
+    if (NewState == ENABLE) { UART2->CR2 |= UART2_CR2_RIEN; }
+    else { UART2->CR2 &= (uint8_t) ~UART2_CR2_RIEN; }
+  }
+}
+
+/***************************************************************************************/
+// FLASH: data EEPROM
+void FLASH_SetProgrammingTime (FLASH_ProgramTime_TypeDef FLASH_ProgTime) { ; }
+void FLASH_Unlock (FLASH_MemType_TypeDef FLASH_MemType)
+{
+  FLASH->IAPSR |= FLASH_IAPSR_DUL;
+}
+
+void FLASH_Lock (FLASH_MemType_TypeDef FLASH_MemType)
+{
+  FLASH->IAPSR &= (uint8_t) ~FLASH_IAPSR_DUL;
+}
+
+// end of programming flag, call on every PWM cycle
+void sim_flash_update (void)
+{
+  if (sim.ui32_time_us >= sim.ui32_eeprom_end_of_programming_us) { FLASH->IAPSR |= FLASH_IAPSR_EOP; }
+}
+
+void FLASH_ProgramByte (uint32_t Address, uint8_t Data)
+{
+  sim_io [Address & (SIM_IO_SIZE - 1)] = Data;
+  sim.ui32_eeprom_writes++;
+  FLASH->IAPSR &= (uint8_t) ~FLASH_IAPSR_EOP;
+  // byte programming takes ~6ms on STM8 data EEPROM, the CPU keeps running meanwhile
+  sim.ui32_eeprom_end_of_programming_us = sim.ui32_time_us + 6000;
+}
+
+// most significant byte on the lowest address, as on STM8 memory
+void FLASH_ProgramWord (uint32_t Address, uint32_t Data)
+{
+  uint8_t ui8_i;
+
+  for (ui8_i = 0; ui8_i < 4; ui8_i++)
+  {
+    sim_io [(Address + ui8_i) & (SIM_IO_SIZE - 1)] = (uint8_t) (Data >> (24 - (8 * ui8_i)));
+  }
+  sim.ui32_eeprom_writes++;
+  FLASH->IAPSR &= (uint8_t) ~FLASH_IAPSR_EOP;
+  // word programming takes the same ~6ms as a byte
+  sim.ui32_eeprom_end_of_programming_us = sim.ui32_time_us + 6000;
+}
+
+/***************************************************************************************/
+// ITC: 2 bits for each interrupt on ISPR1..ISPR8, same as ITC_SetSoftwarePriority ()
+void ITC_SetSoftwarePriority (ITC_Irq_TypeDef IrqNum, ITC_PriorityLevel_TypeDef PriorityValue)
+{
+  volatile uint8_t *p_ispr = &ITC->ISPR1 + (IrqNum >> 2);
+  uint8_t ui8_shift = (IrqNum & 3) << 1;
+
+  *p_ispr = (uint8_t) ((*p_ispr & ~(3 << ui8_shift)) | (PriorityValue << ui8_shift));
+}
+
+// software priority level (0 - 3) of an interrupt
+uint8_t sim_itc_level (uint8_t ui8_irq)
+{
+  static const uint8_t ui8_level [4] = { 2, 1, 0, 3 }; // ISPR bits 00: level 2, 01: level 1, 10: level 0, 11: level 3
+
+  return ui8_level [((&ITC->ISPR1) [ui8_irq >> 2] >> ((ui8_irq & 3) << 1)) & 3];
+}
@@ -0,0 +1,152 @@
+/*
+ * BMSBattery S series motor controllers firmware
+ *
+ * Copyright (C) Casainho, 2017.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+#include <stdint.h>
+#include "stm8s.h"
+#include "statistics.h"
+#include "eeprom.h"
+#include "motor.h"
+#include "ebike_app.h"
+#include "uart.h"
+#include "utils.h"
+#include "battery.h"
+#include "timers.h"
+
+// totals since the controller was first powered, kept on EEPROM
+uint32_t ui32_statistics_distance_m;
+uint32_t ui32_statistics_energy_out_mwh;
+uint32_t ui32_statistics_energy_in_mwh;
+uint32_t ui32_statistics_charge_out_mah;
+uint32_t ui32_statistics_motor_on_time_s;
+uint16_t ui16_statistics_max_speed_x10;
+
+// fractions of the units above, lost on power off
+uint16_t ui16_statistics_distance_steps = 0;
+uint16_t ui16_statistics_energy_out_steps = 0;
+uint16_t ui16_statistics_energy_in_steps = 0;
+uint16_t ui16_statistics_charge_out_steps = 0;
+uint16_t ui16_statistics_motor_on_time_ms = 0;
+
+uint32_t ui32_statistics_save_ms = 0; // last save period
+uint8_t ui8_statistics_changed = 0;
+
+void statistics_to_bytes (uint8_t *p_data);
+
+// must be called after eeprom_init ()
+void statistics_init (void)
+{
+  // record is all zeros if it was never saved
+  uint8_t *p_record = eeprom_get_record (EEPROM_AREA_STATISTICS);
+
+  ui32_statistics_distance_m = ui32_from_bytes (&p_record [RECORD_STATISTICS_DISTANCE]);
+  ui32_statistics_energy_out_mwh = ui32_from_bytes (&p_record [RECORD_STATISTICS_ENERGY_OUT]);
+  ui32_statistics_energy_in_mwh = ui32_from_bytes (&p_record [RECORD_STATISTICS_ENERGY_IN]);
+  ui32_statistics_charge_out_mah = ui32_from_bytes (&p_record [RECORD_STATISTICS_CHARGE_OUT]);
+  ui32_statistics_motor_on_time_s = ui32_from_bytes (&p_record [RECORD_STATISTICS_MOTOR_ON_TIME]);
+  ui16_statistics_max_speed_x10 = ui16_from_bytes (&p_record [RECORD_STATISTICS_MAX_SPEED]);
+}
+
+// call every 100ms, after the wheel speed was calculated and battery_controller ()
+void statistics_controller (void)
+{
+  int16_t i16_motor_current_10b = i16_battery_get_current_x4 ();
+  uint16_t ui16_power;
+  uint16_t ui16_wheel_speed_x10 = ui16_ebike_app_get_wheel_speed_x10 ();
+
+  // distance
+  ui16_statistics_distance_steps += ui16_wheel_speed_x10;
+  if (ui16_statistics_distance_steps >= STATISTICS_SPEED_STEPS_PER_METER)
+  {
+    ui32_statistics_distance_m += ui16_statistics_distance_steps / STATISTICS_SPEED_STEPS_PER_METER;
+    ui16_statistics_distance_steps %= STATISTICS_SPEED_STEPS_PER_METER;
+    ui8_statistics_changed = 1;
+  }
+
+  if (ui16_wheel_speed_x10 > ui16_statistics_max_speed_x10) { ui16_statistics_max_speed_x10 = ui16_wheel_speed_x10; }
+
+  // energy and charge: positive current is from the battery, negative is regen. Limited to 127 steps (15.9A,
+  // over ADC_MOTOR_CURRENT_MAX) so the power and the steps sums fit on 16 bits
+  if (i16_motor_current_10b > 127) { i16_motor_current_10b = 127; }
+  else if (i16_motor_current_10b < -127) { i16_motor_current_10b = -127; }
+
+  if (i16_motor_current_10b > 0)
+  {
+    ui16_power = ((uint16_t) i16_motor_current_10b) * motor_get_ADC_battery_voltage_filtered ();
+    ui16_statistics_energy_out_steps += ui16_power;
+    if (ui16_statistics_energy_out_steps >= STATISTICS_POWER_STEPS_PER_MWH)
+    {
+      ui32_statistics_energy_out_mwh += ui16_statistics_energy_out_steps / STATISTICS_POWER_STEPS_PER_MWH;
+      ui16_statistics_energy_out_steps %= STATISTICS_POWER_STEPS_PER_MWH;
+      ui8_statistics_changed = 1;
+    }
+
+    ui16_statistics_charge_out_steps += (uint16_t) i16_motor_current_10b;
+    if (ui16_statistics_charge_out_steps >= STATISTICS_CURRENT_STEPS_PER_MAH)
+    {
+      ui32_statistics_charge_out_mah++;
+      ui16_statistics_charge_out_steps -= STATISTICS_CURRENT_STEPS_PER_MAH;
+      ui8_statistics_changed = 1;
+    }
+  }
+  else if (i16_motor_current_10b < 0)
+  {
+    ui16_power = ((uint16_t) (-i16_motor_current_10b)) * motor_get_ADC_battery_voltage_filtered ();
+    ui16_statistics_energy_in_steps += ui16_power;
+    if (ui16_statistics_energy_in_steps >= STATISTICS_POWER_STEPS_PER_MWH)
+    {
+      ui32_statistics_energy_in_mwh += ui16_statistics_energy_in_steps / STATISTICS_POWER_STEPS_PER_MWH;
+      ui16_statistics_energy_in_steps %= STATISTICS_POWER_STEPS_PER_MWH;
+      ui8_statistics_changed = 1;
+    }
+  }
+
+  // motor on time: motor is being driven
+  if (motor_pwm_cycle.ui8_duty_cycle)
+  {
+    ui16_statistics_motor_on_time_ms += ui16_system_time_task_elapsed_ms (SYSTEM_TIME_TASK_EBIKE_APP_CONTROLLER);
+    while (ui16_statistics_motor_on_time_ms >= 1000)
+    {
+      ui16_statistics_motor_on_time_ms -= 1000;
+      ui32_statistics_motor_on_time_s++;
+    }
+  }
+
+  if (system_time_is_timeout (ui32_statistics_save_ms, STATISTICS_SAVE_PERIOD_MS))
+  {
+    ui32_statistics_save_ms = ui32_system_time_get_ms ();
+    if (ui8_statistics_changed) { statistics_save (); }
+  }
+}
+
+// copy the totals to the EEPROM record, it will be programmed in background
+void statistics_save (void)
+{
+  statistics_to_bytes (&eeprom_get_record (EEPROM_AREA_STATISTICS) [RECORD_STATISTICS_DISTANCE]);
+  eeprom_write_record (EEPROM_AREA_STATISTICS);
+  ui8_statistics_changed = 0;
+}
+
+// answer to UART_COMMAND_READ_STATISTICS, with the current totals (same format as the EEPROM record data)
+void statistics_send (void)
+{
+  uint8_t ui8_data [RECORD_STATISTICS_DATA_SIZE];
+
+  statistics_to_bytes (ui8_data);
+  uart_send_package (UART_COMMAND_READ_STATISTICS, ui8_data, RECORD_STATISTICS_DATA_SIZE);
+}
+
+void statistics_to_bytes (uint8_t *p_data)
+{
+  ui32_to_bytes (ui32_statistics_distance_m, &p_data [RECORD_STATISTICS_DISTANCE - RECORD_STATISTICS_DISTANCE]);
+  ui32_to_bytes (ui32_statistics_energy_out_mwh, &p_data [RECORD_STATISTICS_ENERGY_OUT - RECORD_STATISTICS_DISTANCE]);
+  ui32_to_bytes (ui32_statistics_energy_in_mwh, &p_data [RECORD_STATISTICS_ENERGY_IN - RECORD_STATISTICS_DISTANCE]);
+  ui32_to_bytes (ui32_statistics_charge_out_mah, &p_data [RECORD_STATISTICS_CHARGE_OUT - RECORD_STATISTICS_DISTANCE]);
+  ui32_to_bytes (ui32_statistics_motor_on_time_s, &p_data [RECORD_STATISTICS_MOTOR_ON_TIME - RECORD_STATISTICS_DISTANCE]);
+  ui16_to_bytes (ui16_statistics_max_speed_x10, &p_data [RECORD_STATISTICS_MAX_SPEED - RECORD_STATISTICS_DISTANCE]);
+  ui16_to_bytes (ui16_battery_get_used_mah (), &p_data [RECORD_STATISTICS_BATTERY_USED - RECORD_STATISTICS_DISTANCE]);
+}
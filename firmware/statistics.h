@@ -0,0 +1,30 @@
+/*
+ * BMSBattery S series motor controllers firmware
+ *
+ * Copyright (C) Casainho, 2017.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+#ifndef _STATISTICS_H_
+#define _STATISTICS_H_
+
+#include "main.h"
+
+// statistics are saved on EEPROM every 5 minutes, if they changed, and when battery gets under voltage
+#define STATISTICS_SAVE_PERIOD_MS		300000L
+
+// integration every 100ms, in units of the filtered ADC values:
+// - motor current 10 bits, 0.125A per step: 0.125A * 0.1s = 12.5mAs = 1/288 mAh
+// - motor current 10 bits * battery voltage 8 bits: 1mWh = 3.6J / (0.125A * 0.272V * 0.1s) = 1058 steps
+// - wheel speed km/h * 10: 1m = 3600 / 0.1s / 10 = 360 steps
+#define STATISTICS_CURRENT_STEPS_PER_MAH	288
+#define STATISTICS_POWER_STEPS_PER_MWH		((uint16_t) (36.0 / (0.125 * ADC_BATTERY_VOLTAGE_PER_ADC_STEP)))
+#define STATISTICS_SPEED_STEPS_PER_METER	360
+
+void statistics_init (void);
+void statistics_controller (void);
+void statistics_save (void);
+void statistics_send (void);
+
+#endif /* _STATISTICS_H_ */
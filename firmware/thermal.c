@@ -0,0 +1,217 @@
+/*
+ * BMSBattery S series motor controllers firmware
+ *
+ * Copyright (C) Casainho, 2017.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+#include <stdint.h>
+#include "stm8s.h"
+#include "thermal.h"
+#include "motor.h"
+#include "adc.h"
+#include "uart.h"
+#include "utils.h"
+
+#define THERMAL_X64(degree)		((uint16_t) (((degree) - THERMAL_AMBIENT_TEMPERATURE) * 64))
+
+// temperature over ambient, low pass filtered: accumulated = temperature << time shift
+uint32_t ui32_thermal_controller_accumulated = 0;
+uint32_t ui32_thermal_motor_accumulated = 0;
+uint16_t ui16_thermal_controller_x64 = 0;
+uint16_t ui16_thermal_motor_x64 = 0;
+uint8_t ui8_thermal_current_max = ADC_MOTOR_CURRENT_MAX;
+
+#ifdef MOTOR_TEMPERATURE_SENSOR
+// 10k NTC, B = 3950, with a 10k pull up: 10 bits ADC value from -20 to 150 degree C, each 10 degree C
+static const uint16_t ui16_thermal_sensor_adc_table [18] =
+{
+  934, 873, 788, 684, 569, 456, 354, 270, 204, 153, 115, 87, 67, 51, 40, 31, 25, 20
+};
+
+uint16_t ui16_thermal_sensor_adc_accumulated;
+uint8_t ui8_thermal_sensor_is_started = 0;
+uint8_t ui8_thermal_sensor_is_valid = 0;
+uint8_t ui8_thermal_sensor_temperature;
+#endif
+
+uint16_t ui16_thermal_node_update (uint32_t *p_ui32_accumulated, uint32_t ui32_rise_x64, uint8_t ui8_time_shift);
+uint8_t ui8_thermal_derating_curve (uint16_t ui16_temperature_x64, uint16_t ui16_start_x64, uint16_t ui16_max_x64);
+uint8_t ui8_thermal_to_degree (uint16_t ui16_temperature_x64);
+#ifdef MOTOR_TEMPERATURE_SENSOR
+void thermal_read_sensor (void);
+uint8_t ui8_thermal_sensor_to_degree (uint16_t ui16_adc_10b);
+#endif
+
+// call every 100ms, after motor_controller ()
+void thermal_controller (void)
+{
+  int16_t i16_current_x4;
+  uint8_t ui8_duty_cycle_value;
+  uint32_t ui32_current_x4;
+  uint32_t ui32_current_squared;
+  uint32_t ui32_rise_x64;
+  uint16_t ui16_motor_x64;
+
+  // regen current also heats
+  i16_current_x4 = motor_get_current_filtered_10b ();
+  if (i16_current_x4 < 0) { i16_current_x4 = -i16_current_x4; }
+
+  // phase current: motor total current flows on the phases only during the PWM on time
+  ui8_duty_cycle_value = motor_pwm_cycle.ui8_duty_cycle;
+  if (ui8_duty_cycle_value < THERMAL_DUTY_CYCLE_MIN) { ui8_duty_cycle_value = THERMAL_DUTY_CYCLE_MIN; }
+  ui32_current_x4 = (((uint32_t) i16_current_x4) * 255) / ui8_duty_cycle_value;
+  ui32_current_squared = ui32_current_x4 * ui32_current_x4;
+
+  // controller power mosfets
+  ui32_rise_x64 = (ui32_current_squared * (THERMAL_CONTROLLER_RISE * 64)) /
+      (((uint32_t) THERMAL_REFERENCE_CURRENT_X4) * THERMAL_REFERENCE_CURRENT_X4);
+  ui16_thermal_controller_x64 = ui16_thermal_node_update (&ui32_thermal_controller_accumulated, ui32_rise_x64,
+      THERMAL_CONTROLLER_TIME_SHIFT);
+
+  // motor winding: copper and iron losses
+  ui32_rise_x64 = (ui32_current_squared * (THERMAL_MOTOR_RISE * 64)) /
+      (((uint32_t) THERMAL_REFERENCE_CURRENT_X4) * THERMAL_REFERENCE_CURRENT_X4);
+  ui32_rise_x64 += (((uint32_t) ui16_motor_get_motor_speed_erps ()) * (THERMAL_MOTOR_RISE_AT_MAX_SPEED * 64)) /
+      MOTOR_OVER_SPEED_ERPS;
+  ui16_thermal_motor_x64 = ui16_thermal_node_update (&ui32_thermal_motor_accumulated, ui32_rise_x64,
+      THERMAL_MOTOR_TIME_SHIFT);
+  ui16_motor_x64 = ui16_thermal_motor_x64;
+
+#ifdef MOTOR_TEMPERATURE_SENSOR
+  // measured motor temperature, when the sensor works, is used instead of the estimated one
+  thermal_read_sensor ();
+  if (ui8_thermal_sensor_is_valid)
+  {
+    ui16_motor_x64 = 0;
+    if (ui8_thermal_sensor_temperature > THERMAL_AMBIENT_TEMPERATURE)
+    {
+      ui16_motor_x64 = THERMAL_X64 ((uint16_t) ui8_thermal_sensor_temperature);
+    }
+  }
+#endif
+
+  ui8_thermal_current_max = ui8_min (
+      ui8_thermal_derating_curve (ui16_thermal_controller_x64, THERMAL_X64 (THERMAL_CONTROLLER_DERATING_START),
+	  THERMAL_X64 (THERMAL_CONTROLLER_MAX)),
+      ui8_thermal_derating_curve (ui16_motor_x64, THERMAL_X64 (THERMAL_MOTOR_DERATING_START),
+	  THERMAL_X64 (THERMAL_MOTOR_MAX)));
+}
+
+#ifdef MOTOR_TEMPERATURE_SENSOR
+void thermal_read_sensor (void)
+{
+  uint16_t ui16_adc_10b;
+
+  ui16_adc_10b = ui16_adc_read_motor_temperature_10b ();
+
+  // low pass filter, 800ms; starts from the first value read
+  if (!ui8_thermal_sensor_is_started)
+  {
+    ui16_thermal_sensor_adc_accumulated = ui16_adc_10b << 3;
+    ui8_thermal_sensor_is_started = 1;
+  }
+  ui16_thermal_sensor_adc_accumulated -= ui16_thermal_sensor_adc_accumulated >> 3;
+  ui16_thermal_sensor_adc_accumulated += ui16_adc_10b;
+  ui16_adc_10b = ui16_thermal_sensor_adc_accumulated >> 3;
+
+  if ((ui16_adc_10b < THERMAL_SENSOR_ADC_MIN) || (ui16_adc_10b > THERMAL_SENSOR_ADC_MAX))
+  {
+    ui8_thermal_sensor_is_valid = 0;
+  }
+  else
+  {
+    ui8_thermal_sensor_is_valid = 1;
+    ui8_thermal_sensor_temperature = ui8_thermal_sensor_to_degree (ui16_adc_10b);
+  }
+}
+
+// linear interpolation on ui16_thermal_sensor_adc_table, limited to 0 - 150 degree C
+uint8_t ui8_thermal_sensor_to_degree (uint16_t ui16_adc_10b)
+{
+  int16_t i16_temperature;
+  uint8_t ui8_i;
+
+  if (ui16_adc_10b >= ui16_thermal_sensor_adc_table [0]) { return 0; }
+
+  for (ui8_i = 1; ui8_i < 18; ui8_i++)
+  {
+    if (ui16_adc_10b > ui16_thermal_sensor_adc_table [ui8_i])
+    {
+      i16_temperature = THERMAL_SENSOR_TABLE_FIRST + (((int16_t) (ui8_i - 1)) * 10) +
+	  (int16_t) ((((uint16_t) (ui16_thermal_sensor_adc_table [ui8_i - 1] - ui16_adc_10b)) * 10) /
+	  (ui16_thermal_sensor_adc_table [ui8_i - 1] - ui16_thermal_sensor_adc_table [ui8_i]));
+      if (i16_temperature < 0) { i16_temperature = 0; }
+      return (uint8_t) i16_temperature;
+    }
+  }
+
+  return THERMAL_SENSOR_TABLE_FIRST + (17 * 10);
+}
+#endif
+
+// first order low pass filter to the steady state temperature rise, returns the new temperature
+uint16_t ui16_thermal_node_update (uint32_t *p_ui32_accumulated, uint32_t ui32_rise_x64, uint8_t ui8_time_shift)
+{
+  uint32_t ui32_temperature_x64;
+
+  *p_ui32_accumulated -= *p_ui32_accumulated >> ui8_time_shift;
+  *p_ui32_accumulated += ui32_rise_x64;
+
+  ui32_temperature_x64 = *p_ui32_accumulated >> ui8_time_shift;
+  if (ui32_temperature_x64 > 0xffff) { ui32_temperature_x64 = 0xffff; }
+  return (uint16_t) ui32_temperature_x64;
+}
+
+uint8_t ui8_thermal_derating_curve (uint16_t ui16_temperature_x64, uint16_t ui16_start_x64, uint16_t ui16_max_x64)
+{
+  if (ui16_temperature_x64 <= ui16_start_x64) { return ADC_MOTOR_CURRENT_MAX; }
+  if (ui16_temperature_x64 >= ui16_max_x64) { return 0; }
+
+  return (uint8_t) ((((uint32_t) (ui16_max_x64 - ui16_temperature_x64)) * ADC_MOTOR_CURRENT_MAX) /
+      (ui16_max_x64 - ui16_start_x64));
+}
+
+uint8_t ui8_thermal_to_degree (uint16_t ui16_temperature_x64)
+{
+  uint16_t ui16_temperature = THERMAL_AMBIENT_TEMPERATURE + (ui16_temperature_x64 >> 6);
+
+  if (ui16_temperature > 255) { ui16_temperature = 255; }
+  return (uint8_t) ui16_temperature;
+}
+
+uint8_t ui8_thermal_get_current_max (void)
+{
+  return ui8_thermal_current_max;
+}
+
+uint8_t ui8_thermal_get_controller_temperature (void)
+{
+  return ui8_thermal_to_degree (ui16_thermal_controller_x64);
+}
+
+// measured when there is a working sensor, otherwise estimated
+uint8_t ui8_thermal_get_motor_temperature (void)
+{
+#ifdef MOTOR_TEMPERATURE_SENSOR
+  if (ui8_thermal_sensor_is_valid) { return ui8_thermal_sensor_temperature; }
+#endif
+  return ui8_thermal_to_degree (ui16_thermal_motor_x64);
+}
+
+// controller and motor estimated temperatures, motor sensor temperature (THERMAL_SENSOR_NOT_VALID when there is
+// no sensor or it doesn't work) and the thermal derating max current
+void thermal_send (void)
+{
+  uint8_t ui8_data [4];
+
+  ui8_data [0] = ui8_thermal_to_degree (ui16_thermal_controller_x64);
+  ui8_data [1] = ui8_thermal_to_degree (ui16_thermal_motor_x64);
+  ui8_data [2] = THERMAL_SENSOR_NOT_VALID;
+#ifdef MOTOR_TEMPERATURE_SENSOR
+  if (ui8_thermal_sensor_is_valid) { ui8_data [2] = ui8_thermal_sensor_temperature; }
+#endif
+  ui8_data [3] = ui8_thermal_current_max;
+  uart_send_package (UART_COMMAND_READ_TEMPERATURES, ui8_data, 4);
+}
@@ -0,0 +1,48 @@
+/*
+ * BMSBattery S series motor controllers firmware
+ *
+ * Copyright (C) Casainho, 2017.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+#ifndef _THERMAL_H_
+#define _THERMAL_H_
+
+#include "main.h"
+
+// Estimated temperatures, there are no sensors: the controller power mosfets and the motor winding are
+// each one a first order thermal node, heated by the phase current squared (I2t) and, for the motor, also by
+// the iron losses that grow with the motor speed (ERPS). Phase current is the motor total current divided by
+// the PWM duty cycle. Units: temperature in 1/64 degree C over ambient, current in 0.125A steps.
+#define THERMAL_AMBIENT_TEMPERATURE		25 // degree C
+#define THERMAL_DUTY_CYCLE_MIN			64 // phase current is at most 4x the motor total current
+#define THERMAL_REFERENCE_CURRENT_X4		(ADC_MOTOR_CURRENT_MAX << 2) // phase current for the *_RISE values
+
+// temperature rise at steady state with THERMAL_REFERENCE_CURRENT and time constant: 2^shift * 100ms
+#define THERMAL_CONTROLLER_RISE			45 // degree C
+#define THERMAL_CONTROLLER_TIME_SHIFT		9 // 51 seconds
+#define THERMAL_MOTOR_RISE			60 // degree C
+#define THERMAL_MOTOR_RISE_AT_MAX_SPEED		15 // degree C, iron losses at MOTOR_OVER_SPEED_ERPS
+#define THERMAL_MOTOR_TIME_SHIFT		12 // 7 minutes
+
+// motor max current goes linearly from ADC_MOTOR_CURRENT_MAX at *_DERATING_START down to 0 at *_MAX
+#define THERMAL_CONTROLLER_DERATING_START	80 // degree C
+#define THERMAL_CONTROLLER_MAX			100
+#define THERMAL_MOTOR_DERATING_START		110
+#define THERMAL_MOTOR_MAX			130
+
+// Optional motor temperature sensor (MOTOR_TEMPERATURE_SENSOR), see config-example.h: when it reads a valid
+// value, it replaces the motor estimated temperature for the derating and the LCD.
+#define THERMAL_SENSOR_ADC_MIN			10 // 10 bits ADC, lower is a short circuit
+#define THERMAL_SENSOR_ADC_MAX			1000 // higher is the sensor disconnected
+#define THERMAL_SENSOR_TABLE_FIRST		(-20) // degree C of the first table value, then each 10 degree C
+#define THERMAL_SENSOR_NOT_VALID		0xff
+
+void thermal_controller (void);
+uint8_t ui8_thermal_get_current_max (void); // steps of 0.5A each step
+uint8_t ui8_thermal_get_controller_temperature (void); // degree C
+uint8_t ui8_thermal_get_motor_temperature (void); // degree C
+void thermal_send (void);
+
+#endif /* _THERMAL_H_ */
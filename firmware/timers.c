@@ -6,8 +6,20 @@
  * Released under the GPL License, Version 3
  */
 
+#include <stdint.h>
 #include "stm8s.h"
 #include "stm8s_tim2.h"
+#include "stm8s_tim4.h"
+#include "interrupts.h"
+#include "timers.h"
+#include "hal.h"
+
+volatile uint32_t ui32_system_time_ms = 0;
+volatile uint8_t ui8_system_time_tick = 0;
+
+// main loop tasks, see system_time_task_is_ready ()
+uint32_t ui32_system_time_task_last_ms [SYSTEM_TIME_TASKS_NUMBER];
+uint16_t ui16_system_time_task_period_ms [SYSTEM_TIME_TASKS_NUMBER];
 
 void timer2_init (void)
 {
@@ -21,3 +33,78 @@ void timer2_init (void)
   // IMPORTANT: this software delay is needed so timer2 work after this
   for(ui16_i = 0; ui16_i < (29000); ui16_i++) { ; }
 }
+
+// main loop tick: TIM4 update interrupt every 1ms
+void timer4_init (void)
+{
+  TIM4_DeInit ();
+  TIM4_TimeBaseInit (TIM4_PRESCALER_128, (125 - 1)); // 16MHz / 128 = 125kHz; 125 counts = 1ms
+  TIM4_ClearFlag (TIM4_FLAG_UPDATE);
+  TIM4_ITConfig (TIM4_IT_UPDATE, ENABLE);
+  TIM4_Cmd (ENABLE);
+}
+
+// system time and wakes up the main loop from wfi (), see main ()
+void TIM4_UPD_OVF_IRQHandler (void) __interrupt(TIM4_UPD_OVF_IRQHANDLER)
+{
+  ui32_system_time_ms++;
+  ui8_system_time_tick = 1;
+  HAL_TIM4_CLEAR_UPDATE_FLAG ();
+}
+
+uint32_t ui32_system_time_get_ms (void)
+{
+  uint32_t ui32_ms;
+
+  disableInterrupts ();
+  ui32_ms = ui32_system_time_ms;
+  enableInterrupts ();
+
+  return ui32_ms;
+}
+
+uint32_t ui32_system_time_get_us (void)
+{
+  uint32_t ui32_ms;
+  uint8_t ui8_counter;
+
+  disableInterrupts ();
+  ui32_ms = ui32_system_time_ms;
+  ui8_counter = TIM4->CNTR;
+  // the counter did wrap and the interrupt is still waiting: read it again, now surely after the wrap
+  if (TIM4->SR1 & TIM4_SR1_UIF)
+  {
+    ui8_counter = TIM4->CNTR;
+    ui32_ms++;
+  }
+  enableInterrupts ();
+
+  return (ui32_ms * 1000) + (((uint16_t) ui8_counter) << 3); // 125kHz: 8us each count
+}
+
+uint32_t ui32_system_time_elapsed_ms (uint32_t ui32_start_ms)
+{
+  return ui32_system_time_get_ms () - ui32_start_ms;
+}
+
+uint8_t system_time_is_timeout (uint32_t ui32_start_ms, uint32_t ui32_timeout_ms)
+{
+  return (ui32_system_time_elapsed_ms (ui32_start_ms) >= ui32_timeout_ms) ? 1 : 0;
+}
+
+uint8_t system_time_task_is_ready (uint8_t ui8_task, uint16_t ui16_period_ms)
+{
+  uint32_t ui32_now = ui32_system_time_get_ms ();
+  uint32_t ui32_elapsed = ui32_now - ui32_system_time_task_last_ms [ui8_task];
+
+  if (ui32_elapsed < ui16_period_ms) { return 0; }
+
+  ui16_system_time_task_period_ms [ui8_task] = (ui32_elapsed > 0xffff) ? 0xffff : (uint16_t) ui32_elapsed;
+  ui32_system_time_task_last_ms [ui8_task] = ui32_now;
+  return 1;
+}
+
+uint16_t ui16_system_time_task_elapsed_ms (uint8_t ui8_task)
+{
+  return ui16_system_time_task_period_ms [ui8_task];
+}
@@ -9,6 +9,26 @@
 #ifndef _TIMERS_H_
 #define _TIMERS_H_
 
+#include <stdint.h>
+
+// System time: ms since power up on 32 bits, counted by the TIM4 1ms tick interrupt, wraps after 49.7 days. In deep
+// idle the PWM cycle interrupt counts it instead, in steps of MOTOR_IDLE_TICK_MS (main.h).
+// Compare times only with differences, (now - start), that stay right over the wrap; the helpers do it.
+// The get functions disable the interrupts for a few cycles: main loop only, not from the interrupts
+#define SYSTEM_TIME_TASK_MOTOR_CONTROLLER	0
+#define SYSTEM_TIME_TASK_EBIKE_APP_CONTROLLER	1
+#define SYSTEM_TIME_TASKS_NUMBER		2
+
+extern volatile uint32_t ui32_system_time_ms;
+extern volatile uint8_t ui8_system_time_tick; // set on each tick, cleared by the main loop
+
 void timer2_init (void);
+void timer4_init (void);
+uint32_t ui32_system_time_get_ms (void);
+uint32_t ui32_system_time_get_us (void); // 8us resolution, MOTOR_IDLE_TICK_MS in deep idle, wraps after 71 minutes
+uint32_t ui32_system_time_elapsed_ms (uint32_t ui32_start_ms);
+uint8_t system_time_is_timeout (uint32_t ui32_start_ms, uint32_t ui32_timeout_ms);
+uint8_t system_time_task_is_ready (uint8_t ui8_task, uint16_t ui16_period_ms); // once each period, the task must run then
+uint16_t ui16_system_time_task_elapsed_ms (uint8_t ui8_task); // between the last 2 runs of the task, for its integrals
 
 #endif /* _TIMERS_H_ */
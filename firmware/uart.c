@@ -13,6 +13,8 @@
 #include "stm8s.h"
 #include "stm8s_uart2.h"
 #include "main.h"
+#include "uart.h"
+#include "hal.h"
 
 void uart_init (void)
 {
@@ -31,23 +33,42 @@ void uart_init (void)
   UART2_ITConfig(UART2_IT_RXNE_OR, ENABLE);
 }
 
+void uart_send_package (uint8_t ui8_command, uint8_t *p_data, uint8_t ui8_length)
+{
+  uint8_t ui8_crc;
+  uint8_t ui8_i;
+
+  putchar (UART_COMMAND_START);
+  putchar (ui8_command);
+  putchar (ui8_length);
+  ui8_crc = UART_COMMAND_START ^ ui8_command ^ ui8_length;
+
+  for (ui8_i = 0; ui8_i < ui8_length; ui8_i++)
+  {
+    putchar (p_data [ui8_i]);
+    ui8_crc ^= p_data [ui8_i];
+  }
+
+  putchar (ui8_crc);
+}
+
 #if __SDCC_REVISION < 9624
 void putchar(char c)
 {
   //Write a character to the UART2
-  UART2_SendData8(c);
+  HAL_UART2_SEND_DATA8 (c);
 
   //Loop until the end of transmission
-  while (UART2_GetFlagStatus(UART2_FLAG_TXE) == RESET);
+  while (!HAL_UART2_TX_EMPTY ()) ;
 }
 #else
 int putchar(int c)
 {
   //Write a character to the UART2
-  UART2_SendData8(c);
+  HAL_UART2_SEND_DATA8 (c);
 
   //Loop until the end of transmission
-  while (UART2_GetFlagStatus(UART2_FLAG_TXE) == RESET);
+  while (!HAL_UART2_TX_EMPTY ()) ;
 
   return((unsigned char)c);
 }
@@ -62,9 +83,9 @@ int getchar(void)
   uint8_t c = 0;
 
   /* Loop until the Read data register flag is SET */
-  while (UART2_GetFlagStatus(UART2_FLAG_RXNE) == RESET) ;
+  while (!HAL_UART2_RX_NOT_EMPTY ()) ;
 
-  c = UART2_ReceiveData8();
+  c = HAL_UART2_RECEIVE_DATA8 ();
 
   return (c);
 }
@@ -11,7 +11,17 @@
 
 #include "main.h"
 
+// Maintenance commands, on the same UART as the LCD: the tool sends UART_COMMAND_START, the command and
+// the command xor 0xff; the firmware answers with UART_COMMAND_START, the command, the data length, the data
+// and the xor of all the previous bytes.
+#define UART_COMMAND_START			0x3a
+#define UART_COMMAND_READ_STATISTICS		0x01
+#define UART_COMMAND_READ_FAULT_LOG		0x02
+#define UART_COMMAND_READ_TEMPERATURES		0x03
+#define UART_COMMAND_READ_EVENTS		0x04
+
 void uart_init (void);
+void uart_send_package (uint8_t ui8_command, uint8_t *p_data, uint8_t ui8_length);
 
 #if __SDCC_REVISION < 9624
 void putchar(char c);
@@ -19,6 +29,10 @@ void putchar(char c);
 int putchar(int c);
 #endif
 
+#if __SDCC_REVISION < 9989
 char getchar(void);
+#else
+int getchar(void);
+#endif
 
 #endif /* _UART_H */
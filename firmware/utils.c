@@ -37,3 +37,29 @@ uint8_t ui8_max (uint8_t value_a, uint8_t value_b)
   if (value_a > value_b) return value_a;
   else return value_b;
 }
+
+// big endian, the same as STM8 memory
+void ui32_to_bytes (uint32_t ui32_value, uint8_t *p_bytes)
+{
+  p_bytes [0] = (uint8_t) (ui32_value >> 24);
+  p_bytes [1] = (uint8_t) (ui32_value >> 16);
+  p_bytes [2] = (uint8_t) (ui32_value >> 8);
+  p_bytes [3] = (uint8_t) ui32_value;
+}
+
+uint32_t ui32_from_bytes (uint8_t *p_bytes)
+{
+  return (((uint32_t) p_bytes [0]) << 24) | (((uint32_t) p_bytes [1]) << 16) |
+      (((uint32_t) p_bytes [2]) << 8) | ((uint32_t) p_bytes [3]);
+}
+
+void ui16_to_bytes (uint16_t ui16_value, uint8_t *p_bytes)
+{
+  p_bytes [0] = (uint8_t) (ui16_value >> 8);
+  p_bytes [1] = (uint8_t) ui16_value;
+}
+
+uint16_t ui16_from_bytes (uint8_t *p_bytes)
+{
+  return (((uint16_t) p_bytes [0]) << 8) | ((uint16_t) p_bytes [1]);
+}
@@ -14,5 +14,9 @@
 int32_t map (int32_t x, int32_t in_min, int32_t in_max, int32_t out_min, int32_t out_max);
 uint8_t ui8_max (uint8_t value_a, uint8_t value_b);
 uint8_t ui8_min (uint8_t value_a, uint8_t value_b);
+void ui32_to_bytes (uint32_t ui32_value, uint8_t *p_bytes);
+uint32_t ui32_from_bytes (uint8_t *p_bytes);
+void ui16_to_bytes (uint16_t ui16_value, uint8_t *p_bytes);
+uint16_t ui16_from_bytes (uint8_t *p_bytes);
 
 #endif /* _UTILS_H */
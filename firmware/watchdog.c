@@ -9,6 +9,7 @@
 #include "stm8s.h"
 #include "stm8s_clk.h"
 #include "stm8s_iwdg.h"
+#include "main.h"
 
 // PLEASE NOTE: while debuging using STLinkV2, watchdog seems to be disable and to test, you will need to run without the debugger
 void watchdog_init (void)
@@ -30,6 +31,6 @@ void watchdog_init (void)
 //  0.0001 = 2 * (1 / 128000) * 4 * R
 //  R = 1.6 ; rounding to R = 2
 //  R = 2 means a value of reload register = 1
-  IWDG_SetReload (2); // 187.5us; for some reason, a value of 1 don't work, only 2
+  IWDG_SetReload (MOTOR_WATCHDOG_RELOAD); // 187.5us; for some reason, a value of 1 don't work, only 2
   IWDG_ReloadCounter ();
 }